@@ -0,0 +1,112 @@
+#pragma once
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SS_ARENA_DEFAULT_BLOCK_SIZE 4096
+#define SS_ARENA_ALIGNMENT 16
+
+/**
+ * One chunk of memory handed out by an arena. Blocks are chained newest first
+ * so that the one we are currently bumping through is always at the head.
+ */
+struct ss_arena_block {
+    struct ss_arena_block *next;
+    size_t capacity;
+    size_t used;
+    SS_ALIGNAS(SS_ARENA_ALIGNMENT) char data[];
+};
+
+/**
+ * A bump allocator. Everything needed to build a string for one request can
+ * come out of here, and it all goes away at once with `ss_arena_reset` rather
+ * than object by object.
+ *
+ * Objects allocated from an arena are never freed individually. `sd_release`
+ * and `ss_free` know this and leave arena memory alone. Anything that points
+ * into an arena (including heap clones of arena strings) is invalid after a
+ * reset.
+ */
+struct ss_arena {
+    struct ss_arena_block *head;
+    size_t block_size;
+};
+
+SS_RESULT _ss_arena_add_block(struct ss_arena *arena, size_t minimum) {
+    size_t capacity = arena->block_size;
+    if (capacity < minimum) capacity = minimum;
+
+    struct ss_arena_block *block = (struct ss_arena_block *)SS_MALLOC(
+        sizeof(struct ss_arena_block) + capacity
+    );
+    if (block == NULL) return SS_ALLOC_ERROR;
+
+    block->next = arena->head;
+    block->capacity = capacity;
+    block->used = 0;
+    arena->head = block;
+
+    return SS_OK;
+}
+
+/**
+ * Creates an arena. `block_size` is how much we grab from malloc at a time; 0
+ * picks a sensible default. Requests bigger than a block get a block of their
+ * own.
+ */
+SS_RESULT ss_arena_create(size_t block_size, struct ss_arena **arena) {
+    *arena = (struct ss_arena *)SS_MALLOC(sizeof(struct ss_arena));
+    if (*arena == NULL) return SS_ALLOC_ERROR;
+
+    (*arena)->head = NULL;
+    (*arena)->block_size = block_size == 0 ? SS_ARENA_DEFAULT_BLOCK_SIZE : block_size;
+
+    return SS_OK;
+}
+
+/**
+ * Bump-allocates `size` bytes. The result is aligned to SS_ARENA_ALIGNMENT
+ * and uninitialized. Returns NULL if we could not get a new block.
+ */
+void *ss_arena_alloc(struct ss_arena *arena, size_t size) {
+    size = (size + SS_ARENA_ALIGNMENT - 1) & ~((size_t)SS_ARENA_ALIGNMENT - 1);
+
+    if (arena->head == NULL || arena->head->capacity - arena->head->used < size) {
+        if (_ss_arena_add_block(arena, size) != SS_OK) return NULL;
+    }
+
+    void *result = &arena->head->data[arena->head->used];
+    arena->head->used += size;
+
+    return result;
+}
+
+/**
+ * Throws away everything allocated from this arena in one go. The newest
+ * block is kept around so that the next request does not have to go back to
+ * malloc.
+ */
+void ss_arena_reset(struct ss_arena *arena) {
+    if (arena->head == NULL) return;
+
+    struct ss_arena_block *block = arena->head->next;
+    while (block != NULL) {
+        struct ss_arena_block *next = block->next;
+        SS_FREE(block);
+        block = next;
+    }
+
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+SS_RESULT ss_arena_free(struct ss_arena *arena) {
+    ss_arena_reset(arena);
+    SS_FREE(arena->head);
+    SS_FREE(arena);
+
+    return SS_OK;
+}
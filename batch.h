@@ -0,0 +1,240 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A flattened view of a compiled template for bulk rendering. The template is
+ * reduced to `fragment 0, placeholder 0, fragment 1, ..., fragment N`, where
+ * every fragment is all of the static pieces between two placeholders copied
+ * into one contiguous blob. Rendering a row is then N + 1 memcpys and N table
+ * lookups, with no piece walking at all.
+ */
+struct ss_batch_plan {
+    uint32_t placeholder_count;
+
+    /**
+     * The slot of each placeholder, in order.
+     */
+    uint32_t *slots;
+
+    /**
+     * `placeholder_count + 1` end offsets into `statics`. Fragment i runs from
+     * the end of fragment i - 1 (or 0) to `fragment_ends[i]`.
+     */
+    size_t *fragment_ends;
+    char *statics;
+};
+
+/**
+ * Builds the plan for a compiled template. The plan is one allocation; hand
+ * it to `SS_FREE` when done.
+ */
+SS_RESULT _ss_batch_plan_create(struct segmented_string *ss, struct ss_batch_plan **plan) {
+    uint32_t placeholder_count = 0;
+    size_t static_length = 0;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        if (ssp_is_template(&ss->pieces[i])) {
+            /**
+             * The columns are uint8.
+             */
+            if (ss->pieces[i].type != STRING_PIECE_TYPE_PLACEHOLDER_UINT8) return SS_INVALID_STRING_TYPE;
+            placeholder_count++;
+        } else if (ss->pieces[i].type == STRING_PIECE_TYPE_STATIC) {
+            static_length += ss->pieces[i].length;
+        } else {
+            /**
+             * Nested strings are fully rendered already, so they are just more
+             * static bytes as far as the plan is concerned. One with a string
+             * placeholder inside renders as its value does now, which is why
+             * such plans aren't kept (see `_ss_batch_plan_get`).
+             */
+            size_t length;
+            SS_RESULT res = ssp_render_length(&ss->pieces[i], ss->values, &length);
+            if (res != SS_OK) return res;
+
+            static_length += length;
+        }
+    }
+
+    *plan = (struct ss_batch_plan *)SS_MALLOC(
+        sizeof(struct ss_batch_plan)
+            + sizeof(size_t) * (placeholder_count + 1)
+            + sizeof(uint32_t) * placeholder_count
+            + static_length
+    );
+    if (*plan == NULL) return SS_ALLOC_ERROR;
+
+    (*plan)->placeholder_count = placeholder_count;
+    (*plan)->fragment_ends = (size_t *)(*plan + 1);
+    (*plan)->slots = (uint32_t *)((*plan)->fragment_ends + placeholder_count + 1);
+    (*plan)->statics = (char *)((*plan)->slots + placeholder_count);
+
+    char *cursor = (*plan)->statics;
+    uint32_t placeholder = 0;
+
+    (*plan)->fragment_ends[0] = 0;
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        if (ssp_is_template(ssp)) {
+            (*plan)->slots[placeholder] = ssp->slot;
+            placeholder++;
+            (*plan)->fragment_ends[placeholder] = cursor - (*plan)->statics;
+        } else if (ssp->type == STRING_PIECE_TYPE_STATIC) {
+            memcpy(cursor, ssp->data.static_string->data, ssp->length);
+            cursor += ssp->length;
+            (*plan)->fragment_ends[placeholder] = cursor - (*plan)->statics;
+        } else {
+            SS_RESULT res = ssp_render_into(ssp, ss->values, cursor, &cursor);
+            if (res != SS_OK) {
+                SS_FREE(*plan);
+                return res;
+            }
+            (*plan)->fragment_ends[placeholder] = cursor - (*plan)->statics;
+        }
+    }
+
+    return SS_OK;
+}
+
+/**
+ * The plan for `ss`. It is made the first time and kept in our render cache
+ * (see `struct ss_render_cache`) until the pieces change, so that rendering
+ * batch after batch from one template only flattens it once. Frozen strings
+ * aren't written to, and nested strings with a string placeholder somewhere
+ * inside can change without our pieces changing (as in `ss_render_cached`),
+ * so those get a new plan every time, and `*owned` says that the caller has
+ * to free it.
+ */
+SS_RESULT _ss_batch_plan_get(struct segmented_string *ss, struct ss_batch_plan **plan, bool *owned) {
+    if (ss->cache != NULL && ss->cache->batch != NULL) {
+        *plan = ss->cache->batch;
+        *owned = false;
+        return SS_OK;
+    }
+
+    SS_RESULT res = _ss_batch_plan_create(ss, plan);
+    if (res != SS_OK) return res;
+
+    *owned = true;
+    if (ss->frozen || _ss_has_string_placeholders(ss)) return SS_OK;
+
+    if (ss->cache == NULL) {
+        /**
+         * Not being able to keep the plan isn't an error.
+         */
+        ss->cache = (struct ss_render_cache *)SS_CALLOC(1, sizeof(struct ss_render_cache));
+        if (ss->cache == NULL) return SS_OK;
+    }
+
+    ss->cache->batch = *plan;
+    *owned = false;
+    return SS_OK;
+}
+
+/**
+ * Renders `rows` instances of a template into one buffer, back to back.
+ *
+ * `columns` is indexed by slot id (see `ss_slot_lookup`): `columns[slot][row]`
+ * is the value of that placeholder in that row. This replaces the
+ * clone / fill / render loop for bulk export: the template is flattened once,
+ * the exact output size is worked out from the columns up front, and each row
+ * is then written with memcpys of the precomputed static fragments and
+ * table-driven number formatting.
+ *
+ * If `row_ends` is not NULL it receives the end offset of every row, so that
+ * row `r` spans `[r ? row_ends[r - 1] : 0, row_ends[r])`. `*written` is set to
+ * the total output size, including when SS_BUFFER_TOO_SMALL is returned, so
+ * that a caller can size the buffer with a first call and a capacity of 0.
+ *
+ * The template's pieces and values are not modified, but the flattened
+ * template is kept with it for the next call (see `_ss_batch_plan_get`). Its
+ * placeholders all have to be uint8 placeholders.
+ *
+ * Keeping the plan writes to the template, so like `ss_render_cached` this
+ * must not be called on the same template from several threads at once
+ * unless it is frozen. Freeze a template to batch render it in parallel.
+ *
+ * Valid String Types: Compiled templates (see `ss_compile`)
+ */
+SS_RESULT ss_render_batch_uint8(
+    struct segmented_string *ss,
+    const uint8_t *const *columns,
+    size_t rows,
+    char *buf,
+    size_t capacity,
+    size_t *row_ends,
+    size_t *written
+) {
+    if (ss->slots == NULL) return SS_NOT_COMPILED;
+
+    struct ss_batch_plan *plan;
+    bool owned;
+    SS_RESULT res = _ss_batch_plan_get(ss, &plan, &owned);
+    if (res != SS_OK) return res;
+
+    uint32_t placeholder_count = plan->placeholder_count;
+    size_t static_length = plan->fragment_ends[placeholder_count];
+
+    /**
+     * Exact output size: the statics once per row, plus the width of every
+     * value in every column that is used. The width sums are straight table
+     * lookups that the compiler can vectorize.
+     */
+    size_t total = static_length * rows;
+    for (uint32_t p = 0; p < placeholder_count; p++) {
+        const uint8_t *column = columns[plan->slots[p]];
+        size_t widths = 0;
+
+        for (size_t r = 0; r < rows; r++) {
+            widths += (uint8_t)_ssp_uint8_decimal[column[r]][3];
+        }
+        total += widths;
+    }
+
+    *written = total;
+    if (total > capacity) {
+        if (owned) SS_FREE(plan);
+        return SS_BUFFER_TOO_SMALL;
+    }
+
+    /**
+     * The wide stores only go where the output itself will be, so nothing
+     * past `*written` is ever touched, however big the buffer is.
+     */
+    char *cursor = buf;
+    char *end = buf + total;
+
+    for (size_t r = 0; r < rows; r++) {
+        size_t fragment_start = 0;
+
+        for (uint32_t p = 0; p < placeholder_count; p++) {
+            size_t fragment_end = plan->fragment_ends[p];
+            memcpy(cursor, plan->statics + fragment_start, fragment_end - fragment_start);
+            cursor += fragment_end - fragment_start;
+            fragment_start = fragment_end;
+
+            uint8_t value = columns[plan->slots[p]][r];
+            if (end - cursor >= 4) {
+                cursor = _ssp_format_uint8_wide(cursor, value);
+            } else {
+                cursor = _ssp_format_uint8(cursor, value);
+            }
+        }
+
+        memcpy(cursor, plan->statics + fragment_start, static_length - fragment_start);
+        cursor += static_length - fragment_start;
+
+        if (row_ends != NULL) row_ends[r] = cursor - buf;
+    }
+
+    if (owned) SS_FREE(plan);
+    return SS_OK;
+}
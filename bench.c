@@ -0,0 +1,697 @@
+/**
+ * Microbenchmarks for the hot paths. `make bench` builds this with
+ * optimization and `make bench.csv` runs it. The output is CSV, one row per
+ * benchmark and size:
+ *
+ *     benchmark,pieces,length,iterations,ns_per_op,allocs_per_op,bytes_per_op
+ *
+ * `pieces` is how many pieces the string being worked on has, and `length` how
+ * long each of its static pieces is. An op is one call of the function being
+ * measured. Where a benchmark has to build or free something for every call
+ * (appends need a string to append to, clones need freeing), that cost is
+ * included and spread over the calls.
+ *
+ * Allocations are counted by routing the library's SS_MALLOC hooks through the
+ * counters below. `bytes_per_op` is what was asked for; frees aren't counted.
+ *
+ * Built with SS_ENABLE_STATS (`make bench-stats`), every row also gets the
+ * library's own counters from `ss_stats`, per op.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+size_t bench_allocs = 0;
+size_t bench_bytes = 0;
+
+void *bench_malloc(size_t size) {
+    bench_allocs++;
+    bench_bytes += size;
+    return malloc(size);
+}
+
+void *bench_calloc(size_t count, size_t size) {
+    bench_allocs++;
+    bench_bytes += count * size;
+    return calloc(count, size);
+}
+
+void *bench_realloc(void *ptr, size_t size) {
+    bench_allocs++;
+    bench_bytes += size;
+    return realloc(ptr, size);
+}
+
+#define SS_MALLOC(size) bench_malloc(size)
+#define SS_CALLOC(count, size) bench_calloc(count, size)
+#define SS_REALLOC(ptr, size) bench_realloc(ptr, size)
+#define SS_FREE(ptr) free(ptr)
+
+#include "common.h"
+#include "string_data.h"
+#include "segmented_string.h"
+#include "batch.h"
+#include "find.h"
+#include "hash.h"
+#include "image.h"
+#include "iov.h"
+#include "parse.h"
+
+/**
+ * Keep each measurement running for at least this long.
+ */
+#define BENCH_MIN_NS 20000000ull
+
+#define BENCH_CHECK(expr) do { if ((expr) != SS_OK) { fprintf(stderr, "%s failed\n", #expr); exit(1); } } while (0)
+
+struct bench {
+    const char *name;
+    uint32_t pieces;
+    uint32_t length;
+
+    /**
+     * Calls of the function under test per run of `fn`.
+     */
+    uint32_t ops;
+
+    void (*fn)(struct bench *bench);
+
+    /**
+     * Set up once before timing, for benchmarks that work on an existing
+     * string.
+     */
+    struct segmented_string *ss;
+    struct segmented_string *other;
+    char *static_data;
+    char *source;
+    size_t source_length;
+    char *buf;
+    size_t buf_capacity;
+    char name_buf[16];
+    int null_fd;
+};
+
+uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Stops the compiler from deciding results are unused.
+ */
+void bench_escape(void *p) {
+    __asm__ volatile("" : : "g"(p) : "memory");
+}
+
+void bench_release(struct segmented_string *ss) {
+    BENCH_CHECK(ss_free(ss));
+    SS_FREE(ss);
+}
+
+/**
+ * `pieces` pieces of `static_data`, alternating with placeholders p0, p1, ...
+ * when `placeholders` is set. Every placeholder is filled with `i % 256`.
+ */
+struct segmented_string *bench_build(struct bench *bench, bool placeholders) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create_initialized(EMPTY_STRING, bench->pieces, &ss));
+
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        if (placeholders && i % 2 == 1) {
+            snprintf(bench->name_buf, sizeof(bench->name_buf), "p%u", i / 2);
+            BENCH_CHECK(ss_append_placeholder_uint8(ss, bench->name_buf));
+            BENCH_CHECK(ss_fill_uint8(ss, bench->name_buf, i % 256));
+        } else {
+            BENCH_CHECK(ss_append_static_copy(ss, bench->static_data, bench->length));
+        }
+    }
+
+    return ss;
+}
+
+/**
+ * Like `bench_build` with placeholders, but uint64 or double ones, filled
+ * with values that take most of their width: `i * 0x9e3779b97f4a7c15` and
+ * that over 10^9.
+ */
+struct segmented_string *bench_build_typed(struct bench *bench, bool doubles) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create_initialized(EMPTY_STRING, bench->pieces, &ss));
+
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        if (i % 2 == 1) {
+            uint64_t value = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+            snprintf(bench->name_buf, sizeof(bench->name_buf), "p%u", i / 2);
+            if (doubles) {
+                BENCH_CHECK(ss_append_placeholder_double(ss, bench->name_buf));
+                BENCH_CHECK(ss_fill_double(ss, bench->name_buf, (double)value / 1e9));
+            } else {
+                BENCH_CHECK(ss_append_placeholder_uint64(ss, bench->name_buf));
+                BENCH_CHECK(ss_fill_uint64(ss, bench->name_buf, value));
+            }
+        } else {
+            BENCH_CHECK(ss_append_static_copy(ss, bench->static_data, bench->length));
+        }
+    }
+
+    return ss;
+}
+
+/**
+ * What formatting the values of `bench_build_typed(bench, false)` costs with
+ * snprintf, which is what callers did before there were uint64 placeholders.
+ */
+void bench_snprintf_uint64(struct bench *bench) {
+    char *cursor = bench->buf;
+    for (uint32_t i = 1; i < bench->pieces; i += 2) {
+        cursor += snprintf(cursor, 21, "%llu", (unsigned long long)((uint64_t)i * 0x9e3779b97f4a7c15ULL));
+    }
+    bench_escape(bench->buf);
+}
+
+/**
+ * The source text `bench_build` would make with placeholders, for the parser:
+ * `pieces` runs, alternately the static data and `$p0`, `$p1`, ... The static
+ * data has no `$` in it.
+ */
+void bench_build_source(struct bench *bench) {
+    bench->source = (char *)malloc((size_t)bench->pieces * (bench->length + 16));
+    bench->source_length = 0;
+
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        if (i % 2 == 1) {
+            bench->source_length += sprintf(bench->source + bench->source_length, "$p%u", i / 2);
+        } else {
+            memcpy(bench->source + bench->source_length, bench->static_data, bench->length);
+            bench->source_length += bench->length;
+        }
+    }
+}
+
+void bench_create_initialized(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create_initialized(STATIC_STRING, bench->pieces, &ss));
+    bench_escape(ss);
+    bench_release(ss);
+}
+
+/**
+ * The whole life of a small string: build a four piece template, fill its two
+ * placeholders, render it and free it. Most strings are about this size, so
+ * this is where 32-bit lengths and counts would show if they cost anything.
+ */
+void bench_small_template(struct bench *bench) {
+    struct segmented_string *ss;
+    size_t written;
+
+    BENCH_CHECK(ss_create(&ss));
+    BENCH_CHECK(ss_append_static_copy_static(ss, "id="));
+    BENCH_CHECK(ss_append_placeholder_uint8(ss, "id"));
+    BENCH_CHECK(ss_append_static_copy_static(ss, ", age="));
+    BENCH_CHECK(ss_append_placeholder_uint8(ss, "age"));
+    BENCH_CHECK(ss_fill_uint8(ss, "id", 42));
+    BENCH_CHECK(ss_fill_uint8(ss, "age", 7));
+    BENCH_CHECK(ss_render_into(ss, bench->name_buf, sizeof(bench->name_buf), &written));
+    bench_escape(bench->name_buf);
+    bench_release(ss);
+}
+
+void bench_append_static_copy(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create(&ss));
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        BENCH_CHECK(ss_append_static_copy(ss, bench->static_data, bench->length));
+    }
+    bench_release(ss);
+}
+
+void bench_append_static_borrow(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create(&ss));
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        BENCH_CHECK(ss_append_static_borrow(ss, bench->static_data, bench->length));
+    }
+    bench_release(ss);
+}
+
+void bench_append_placeholder_uint8(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create(&ss));
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        BENCH_CHECK(ss_append_placeholder_uint8(ss, "value"));
+    }
+    bench_release(ss);
+}
+
+/**
+ * The same template as `ss_parse` builds, through the append API.
+ */
+void bench_build_template(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create_initialized(EMPTY_STRING, bench->pieces, &ss));
+
+    for (uint32_t i = 0; i < bench->pieces; i++) {
+        if (i % 2 == 1) {
+            snprintf(bench->name_buf, sizeof(bench->name_buf), "p%u", i / 2);
+            BENCH_CHECK(ss_append_placeholder_uint8(ss, bench->name_buf));
+        } else {
+            BENCH_CHECK(ss_append_static_copy(ss, bench->static_data, bench->length));
+        }
+    }
+
+    bench_release(ss);
+}
+
+void bench_parse(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_parse(bench->source, bench->source_length, &ss));
+    bench_escape(ss);
+    bench_release(ss);
+}
+
+/**
+ * Loads an image of one template, compiled and ready to clone, from
+ * `source`.
+ */
+void bench_image_load(struct bench *bench) {
+    struct ss_image *image;
+    BENCH_CHECK(ss_image_load(bench->source, bench->source_length, &image));
+    bench_escape(image);
+    ss_image_free(image);
+}
+
+/**
+ * Fills the last placeholder, so the uncompiled lookup has to look at every
+ * piece.
+ */
+void bench_fill_uint8(struct bench *bench) {
+    BENCH_CHECK(ss_fill_uint8(bench->ss, bench->name_buf, 7));
+}
+
+void bench_clone(struct bench *bench) {
+    struct segmented_string *clone;
+    BENCH_CHECK(ss_clone(bench->ss, &clone));
+    bench_escape(clone);
+    bench_release(clone);
+}
+
+/**
+ * Concatenates the whole string onto a fresh one, which is what building a
+ * page out of sub-templates does for each of them.
+ */
+void bench_concat(struct bench *bench) {
+    struct segmented_string *ss;
+    BENCH_CHECK(ss_create(&ss));
+    BENCH_CHECK(ss_concat(ss, bench->ss));
+    bench_escape(ss);
+    bench_release(ss);
+}
+
+/**
+ * Compacts a clone of the string, with the values baked in, which is what
+ * putting a finished string in a cache costs. The clone is included.
+ */
+void bench_compact(struct bench *bench) {
+    struct segmented_string *clone;
+    BENCH_CHECK(ss_clone(bench->ss, &clone));
+    BENCH_CHECK(ss_compact_values(clone));
+    bench_escape(clone);
+    bench_release(clone);
+}
+
+/**
+ * Swaps the string for a compacted clone of it, for the rows after.
+ */
+void bench_use_compacted(struct bench *bench) {
+    struct segmented_string *clone;
+    BENCH_CHECK(ss_clone(bench->ss, &clone));
+    BENCH_CHECK(ss_compact_values(clone));
+    bench_release(bench->ss);
+    bench->ss = clone;
+}
+
+void bench_explode_by_char(struct bench *bench) {
+    struct segmented_string *list;
+    BENCH_CHECK(ss_explode_by_char(bench->ss, ',', &list));
+    bench_escape(list);
+    bench_release(list);
+}
+
+void bench_render_into(struct bench *bench) {
+    size_t written;
+    BENCH_CHECK(ss_render_into(bench->ss, bench->buf, bench->buf_capacity, &written));
+    bench_escape(bench->buf);
+}
+
+/**
+ * Fills one placeholder, alternating between one and three digits, then
+ * brings the cached rendering up to date: what re-rendering a mostly static
+ * page costs when a single value changes.
+ */
+void bench_render_cached(struct bench *bench) {
+    static uint32_t calls = 0;
+    const char *data;
+    size_t length;
+
+    BENCH_CHECK(ss_fill_slot_uint8(bench->ss, 0, ++calls & 1 ? 7 : 200));
+    BENCH_CHECK(ss_render_cached(bench->ss, &data, &length));
+    bench_escape((void *)data);
+}
+
+/**
+ * Looks for a marker that isn't there, so every byte is searched.
+ */
+void bench_find(struct bench *bench) {
+    struct ss_match match;
+    bool found;
+    BENCH_CHECK(ss_find(bench->ss, "<!--x", 5, &match, &found));
+    if (found) exit(1);
+}
+
+/**
+ * What searching cost before `ss_find`: render, then search the rendering.
+ */
+void bench_render_find(struct bench *bench) {
+    size_t written;
+    BENCH_CHECK(ss_render_into(bench->ss, bench->buf, bench->buf_capacity, &written));
+    if (ss_find_bytes(bench->buf, written, "<!--x", 5) != written) exit(1);
+}
+
+void bench_hash(struct bench *bench) {
+    uint64_t hash;
+    BENCH_CHECK(ss_hash(bench->ss, &hash));
+    bench_escape(&hash);
+}
+
+/**
+ * What hashing cost before `ss_hash`: render, then hash the rendering.
+ */
+void bench_render_hash(struct bench *bench) {
+    size_t written;
+    BENCH_CHECK(ss_render_into(bench->ss, bench->buf, bench->buf_capacity, &written));
+    uint64_t hash = ss_hash_bytes(bench->buf, written);
+    bench_escape(&hash);
+}
+
+/**
+ * Against `other`, the same bytes as a single piece of separate memory, so
+ * that every byte is compared.
+ */
+void bench_equals(struct bench *bench) {
+    bool equal;
+    BENCH_CHECK(ss_equals(bench->ss, bench->other, &equal));
+    if (!equal) exit(1);
+}
+
+/**
+ * Renders `bench->ss` into a single static piece for `bench_equals`.
+ */
+struct segmented_string *bench_flatten(struct bench *bench) {
+    size_t written;
+    struct segmented_string *flat;
+    BENCH_CHECK(ss_render_into(bench->ss, bench->buf, bench->buf_capacity, &written));
+    BENCH_CHECK(ss_create(&flat));
+    BENCH_CHECK(ss_append_static_copy(flat, bench->buf, written));
+    return flat;
+}
+
+/**
+ * Writes to /dev/null, so what is timed is building the iovecs plus the
+ * system call, without any device behind it.
+ */
+void bench_writev(struct bench *bench) {
+    BENCH_CHECK(ss_writev(bench->ss, bench->null_fd));
+}
+
+void bench_run(struct bench *bench) {
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+
+    while (true) {
+        bench_allocs = 0;
+        bench_bytes = 0;
+        ss_stats_reset();
+
+        uint64_t start = bench_now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench->fn(bench);
+        }
+        elapsed = bench_now() - start;
+
+        if (elapsed >= BENCH_MIN_NS) break;
+        iterations *= 2;
+    }
+
+    double ops = (double)iterations * bench->ops;
+    printf(
+        "%s,%u,%u,%llu,%.2f,%.3f,%.1f",
+        bench->name,
+        bench->pieces,
+        bench->length,
+        (unsigned long long)iterations,
+        elapsed / ops,
+        bench_allocs / ops,
+        bench_bytes / ops
+    );
+
+#ifdef SS_ENABLE_STATS
+    struct ss_stats stats;
+    ss_stats_snapshot(&stats);
+    printf(
+        ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f",
+        stats.sd_creates / ops,
+        stats.sd_retains / ops,
+        stats.sd_releases / ops,
+        stats.sd_frees / ops,
+        stats.piece_growths / ops,
+        stats.ssp_clones / ops,
+        stats.ss_clones / ops
+    );
+#endif
+
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const uint32_t piece_counts[] = { 1, 8, 64, 512 };
+    static const uint32_t lengths[] = { 8, 64 };
+
+    printf("benchmark,pieces,length,iterations,ns_per_op,allocs_per_op,bytes_per_op");
+#ifdef SS_ENABLE_STATS
+    printf(",sd_creates_per_op,sd_retains_per_op,sd_releases_per_op,sd_frees_per_op");
+    printf(",piece_growths_per_op,ssp_clones_per_op,ss_clones_per_op");
+#endif
+    printf("\n");
+
+    struct bench bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.null_fd = open("/dev/null", O_WRONLY);
+
+    bench.name = "ss_create+fill+render_into/small";
+    bench.ops = 1;
+    bench.fn = bench_small_template;
+    bench_run(&bench);
+
+    for (size_t p = 0; p < sizeof(piece_counts) / sizeof(piece_counts[0]); p++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            bench.pieces = piece_counts[p];
+            bench.length = lengths[l];
+
+            /**
+             * Creating doesn't touch the data, so once per piece count.
+             */
+            if (l == 0) {
+                bench.name = "ss_create_initialized";
+                bench.ops = 1;
+                bench.fn = bench_create_initialized;
+                bench_run(&bench);
+            }
+
+            /**
+             * Static data with a comma every eight bytes, for the explode.
+             */
+            bench.static_data = (char *)malloc(bench.length);
+            for (uint32_t i = 0; i < bench.length; i++) {
+                bench.static_data[i] = i % 8 == 7 ? ',' : 'a' + i % 8;
+            }
+
+            bench.name = "ss_append_static_copy";
+            bench.ops = bench.pieces;
+            bench.fn = bench_append_static_copy;
+            bench_run(&bench);
+
+            bench.name = "ss_append_static_borrow";
+            bench.fn = bench_append_static_borrow;
+            bench_run(&bench);
+
+            bench.name = "ss_append_placeholder_uint8";
+            bench.fn = bench_append_placeholder_uint8;
+            bench_run(&bench);
+
+            bench.ops = 1;
+
+            bench.ss = bench_build(&bench, false);
+            BENCH_CHECK(ss_render_length(bench.ss, &bench.buf_capacity));
+            bench.buf = (char *)malloc(bench.buf_capacity);
+
+            bench.name = "ss_render_into/static";
+            bench.fn = bench_render_into;
+            bench_run(&bench);
+
+            bench.name = "ss_writev/static";
+            bench.fn = bench_writev;
+            bench_run(&bench);
+
+            bench.name = "ss_explode_by_char";
+            bench.fn = bench_explode_by_char;
+            bench_run(&bench);
+
+            bench.name = "ss_clone/static";
+            bench.fn = bench_clone;
+            bench_run(&bench);
+
+            bench.name = "ss_find/static";
+            bench.fn = bench_find;
+            bench_run(&bench);
+
+            bench.name = "ss_render_into+find/static";
+            bench.fn = bench_render_find;
+            bench_run(&bench);
+
+            bench.name = "ss_hash/static";
+            bench.fn = bench_hash;
+            bench_run(&bench);
+
+            bench.other = bench_flatten(&bench);
+            bench.name = "ss_equals/static";
+            bench.fn = bench_equals;
+            bench_run(&bench);
+            bench_release(bench.other);
+
+            bench.name = "ss_concat/static";
+            bench.fn = bench_concat;
+            bench_run(&bench);
+
+            bench.name = "ss_compact_values/static";
+            bench.fn = bench_compact;
+            bench_run(&bench);
+
+            bench_use_compacted(&bench);
+            bench.name = "ss_render_into/static/compacted";
+            bench.fn = bench_render_into;
+            bench_run(&bench);
+
+            bench_release(bench.ss);
+            free(bench.buf);
+
+            if (bench.pieces > 1) {
+                bench.name = "ss_append/template";
+                bench.fn = bench_build_template;
+                bench_run(&bench);
+
+                bench_build_source(&bench);
+                bench.name = "ss_parse";
+                bench.fn = bench_parse;
+                bench_run(&bench);
+                free(bench.source);
+
+                bench.ss = bench_build(&bench, true);
+                ss_image_write(&bench.ss, 1, NULL, 0, &bench.source_length);
+                bench.source = (char *)malloc(bench.source_length);
+                BENCH_CHECK(ss_image_write(&bench.ss, 1, bench.source, bench.source_length, &bench.source_length));
+                bench.name = "ss_image_load";
+                bench.fn = bench_image_load;
+                bench_run(&bench);
+                free(bench.source);
+
+                BENCH_CHECK(ss_render_length(bench.ss, &bench.buf_capacity));
+                bench.buf = (char *)malloc(bench.buf_capacity + 4 * bench.pieces);
+                bench.buf_capacity += 4 * bench.pieces;
+
+                bench.name = "ss_fill_uint8";
+                bench.fn = bench_fill_uint8;
+                bench_run(&bench);
+
+                BENCH_CHECK(ss_compile(bench.ss));
+                bench.name = "ss_fill_uint8/compiled";
+                bench_run(&bench);
+
+                bench.name = "ss_render_into/template";
+                bench.fn = bench_render_into;
+                bench_run(&bench);
+
+                bench.name = "ss_writev/template";
+                bench.fn = bench_writev;
+                bench_run(&bench);
+
+                bench.name = "ss_clone/template";
+                bench.fn = bench_clone;
+                bench_run(&bench);
+
+                bench.name = "ss_find/template";
+                bench.fn = bench_find;
+                bench_run(&bench);
+
+                bench.name = "ss_render_into+find/template";
+                bench.fn = bench_render_find;
+                bench_run(&bench);
+
+                bench.name = "ss_hash/template";
+                bench.fn = bench_hash;
+                bench_run(&bench);
+
+                bench.name = "ss_render_into+hash/template";
+                bench.fn = bench_render_hash;
+                bench_run(&bench);
+
+                bench.other = bench_flatten(&bench);
+                bench.name = "ss_equals/template";
+                bench.fn = bench_equals;
+                bench_run(&bench);
+                bench_release(bench.other);
+
+                bench.name = "ss_render_cached";
+                bench.fn = bench_render_cached;
+                bench_run(&bench);
+
+                bench.name = "ss_compact_values/template";
+                bench.fn = bench_compact;
+                bench_run(&bench);
+
+                bench_use_compacted(&bench);
+                bench.name = "ss_render_into/template/compacted";
+                bench.fn = bench_render_into;
+                bench_run(&bench);
+
+                bench_release(bench.ss);
+                free(bench.buf);
+
+                for (int doubles = 0; doubles < 2; doubles++) {
+                    bench.ss = bench_build_typed(&bench, doubles);
+                    BENCH_CHECK(ss_render_length(bench.ss, &bench.buf_capacity));
+                    bench.buf = (char *)malloc(bench.buf_capacity + 21);
+
+                    bench.name = doubles ? "ss_render_into/double" : "ss_render_into/uint64";
+                    bench.fn = bench_render_into;
+                    bench_run(&bench);
+
+                    if (!doubles) {
+                        bench.name = "snprintf/uint64";
+                        bench.fn = bench_snprintf_uint64;
+                        bench_run(&bench);
+                    }
+
+                    bench_release(bench.ss);
+                    free(bench.buf);
+                }
+            }
+
+            free(bench.static_data);
+        }
+    }
+
+    return 0;
+}
@@ -1,20 +1,99 @@
 #pragma once
 
+#include "stats.h"
+
 #include <stddef.h>
+#include <stdlib.h>
+
+/**
+ * Every heap allocation the library makes goes through these. Define them
+ * before including any of our headers to plug in a different allocator, or to
+ * count allocations as the benchmarks do. They have to be overridden together.
+ */
+#ifndef SS_MALLOC
+#ifdef SS_ENABLE_STATS
+#define SS_MALLOC(size) _ss_stats_malloc(size)
+#define SS_CALLOC(count, size) _ss_stats_calloc(count, size)
+#define SS_REALLOC(ptr, size) _ss_stats_realloc(ptr, size)
+#define SS_FREE(ptr) _ss_stats_free(ptr)
+#else
+#define SS_MALLOC(size) malloc(size)
+#define SS_CALLOC(count, size) calloc(count, size)
+#define SS_REALLOC(ptr, size) realloc(ptr, size)
+#define SS_FREE(ptr) free(ptr)
+#endif
+#endif
+
+/**
+ * `_Alignas` is spelled `alignas` in C++, which these headers are also
+ * included from (see fixed_template.hpp).
+ */
+#ifdef __cplusplus
+#define SS_ALIGNAS(n) alignas(n)
+#else
+#define SS_ALIGNAS(n) _Alignas(n)
+#endif
+
+/**
+ * Likewise `_Thread_local` and `thread_local`.
+ */
+#ifdef __cplusplus
+#define SS_THREAD_LOCAL thread_local
+#else
+#define SS_THREAD_LOCAL _Thread_local
+#endif
+
+/**
+ * Likewise `_Static_assert` and `static_assert`.
+ */
+#ifdef __cplusplus
+#define SS_STATIC_ASSERT(condition, message) static_assert(condition, message)
+#else
+#define SS_STATIC_ASSERT(condition, message) _Static_assert(condition, message)
+#endif
 
 typedef enum {
     SS_OK,
     SS_ERR,
     SS_ALLOC_ERROR,
     SS_INVALID_STRING_TYPE,
+    SS_BUFFER_TOO_SMALL,
+    SS_NOT_COMPILED,
+    SS_UNKNOWN_PLACEHOLDER,
+    SS_FROZEN,
+    SS_BAD_IMAGE,
     SS_RESULT_COUNT
 } SS_RESULT;
 
 const char* const SS_ERROR_STRS[] = {
     "OK",
-    "ERROR"
+    "ERROR",
+    "ALLOCATION ERROR",
+    "INVALID STRING TYPE",
+    "BUFFER TOO SMALL",
+    "NOT COMPILED",
+    "UNKNOWN PLACEHOLDER",
+    "FROZEN",
+    "BAD IMAGE"
 };
 
+/**
+ * Every reference count in the library goes through these. By default they
+ * are plain increments and decrements. Build with SS_THREAD_SAFE defined and
+ * they become atomic, so that strings sharing data can be cloned and released
+ * on different threads. Both evaluate to the new count.
+ *
+ * Taking a reference only has to be atomic; dropping one also has to order
+ * every earlier use of the object before whoever frees it.
+ */
+#ifdef SS_THREAD_SAFE
+#define SS_REF_INC(count) __atomic_add_fetch(&(count), 1, __ATOMIC_RELAXED)
+#define SS_REF_DEC(count) __atomic_sub_fetch(&(count), 1, __ATOMIC_ACQ_REL)
+#else
+#define SS_REF_INC(count) (++(count))
+#define SS_REF_DEC(count) (--(count))
+#endif
+
 const char *ss_error_str(SS_RESULT result) {
     if (result >= SS_RESULT_COUNT) return NULL;
     return SS_ERROR_STRS[result];
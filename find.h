@@ -0,0 +1,315 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+#include "simd.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Where a match starts. `position` is the byte offset into the rendering of
+ * the whole string. `piece` is the index of the top level piece the match
+ * starts in, and `offset` is how far into that piece's own rendering it
+ * starts (a nested piece or a string placeholder counts as one piece). The
+ * match may carry on into the pieces after it.
+ */
+struct ss_match {
+    size_t position;
+    uint32_t piece;
+    size_t offset;
+};
+
+/**
+ * Spans shorter than this are copied into a buffer and searched in bulk, up
+ * to `SS_FIND_STAGE` bytes at a time: per call, the search costs more than
+ * the copy. Longer spans are searched where they lie.
+ */
+#define SS_FIND_SPAN_MIN 256
+#define SS_FIND_STAGE 1024
+
+/**
+ * Needles up to this long have their buffer on the stack.
+ */
+#define SS_FIND_STACK_NEEDLE 64
+
+struct _ss_find_state {
+    const char *needle;
+    size_t needle_length;
+
+    /**
+     * How much has been seen so far, and the first position a match may
+     * start at: matches don't overlap.
+     */
+    size_t position;
+    size_t next;
+
+    /**
+     * The last `fill` bytes seen. Between spans that have been searched,
+     * it's the last `needle_length - 1` of them (fewer near the start),
+     * which is all a match straddling spans can start in.
+     */
+    char *buffer;
+    size_t fill;
+    size_t capacity;
+
+    struct ss_match *matches;
+    size_t match_capacity;
+    size_t count;
+    bool first_only;
+};
+
+/**
+ * Notes a match at `position`. Returns false once we should stop looking.
+ */
+bool _ss_find_found(struct _ss_find_state *state, size_t position) {
+    if (state->count < state->match_capacity) state->matches[state->count].position = position;
+    state->count++;
+    state->next = position + state->needle_length;
+
+    return !state->first_only;
+}
+
+/**
+ * Finds the matches inside `data[0, length)`, which starts at `position`.
+ */
+SS_RESULT _ss_find_in(struct _ss_find_state *state, const char *data, size_t length, size_t position) {
+    size_t m = state->needle_length;
+    size_t start = state->next > position ? state->next - position : 0;
+
+    while (start + m <= length) {
+        size_t i = start + ss_find_bytes(data + start, length - start, state->needle, m);
+        if (i == length) break;
+
+        if (!_ss_find_found(state, position + i)) return SS_ERR;
+        start = i + m;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Searches the buffer, then keeps just the bytes a match could still start in.
+ * A match found before can't start in those, so none is found twice.
+ */
+SS_RESULT _ss_find_flush(struct _ss_find_state *state) {
+    SS_RESULT res = _ss_find_in(state, state->buffer, state->fill, state->position - state->fill);
+    if (res != SS_OK) return res;
+
+    size_t keep = state->fill < state->needle_length - 1 ? state->fill : state->needle_length - 1;
+    memmove(state->buffer, state->buffer + state->fill - keep, keep);
+    state->fill = keep;
+    return SS_OK;
+}
+
+/**
+ * Looks for matches in one span, or buffers it if it's short.
+ */
+SS_RESULT _ss_find_span(struct _ss_find_state *state, const char *data, size_t length) {
+    const char *needle = state->needle;
+    size_t m = state->needle_length;
+
+    if (length < SS_FIND_SPAN_MIN) {
+        if (state->fill + length > state->capacity) {
+            SS_RESULT res = _ss_find_flush(state);
+            if (res != SS_OK) return res;
+        }
+
+        memcpy(state->buffer + state->fill, data, length);
+        state->fill += length;
+        state->position += length;
+        return SS_OK;
+    }
+
+    SS_RESULT res = _ss_find_flush(state);
+    if (res != SS_OK) return res;
+
+    /**
+     * A match starting `j` into the buffer takes `fill - j` bytes from it and
+     * the rest from this span. Once the rest doesn't fit in this span it
+     * won't for any later `j` either; the spans after will see them.
+     */
+    size_t buffer_start = state->position - state->fill;
+    size_t j = state->next > buffer_start ? state->next - buffer_start : 0;
+
+    for (; j < state->fill && m - (state->fill - j) <= length; j++) {
+        size_t in_buffer = state->fill - j;
+        if (state->buffer[j] != needle[0]) continue;
+
+        if (memcmp(state->buffer + j, needle, in_buffer) == 0
+            && memcmp(data, needle + in_buffer, m - in_buffer) == 0) {
+            if (!_ss_find_found(state, buffer_start + j)) return SS_ERR;
+            break;
+        }
+    }
+
+    res = _ss_find_in(state, data, length, state->position);
+    if (res != SS_OK) return res;
+
+    if (length >= m - 1) {
+        memcpy(state->buffer, data + length - (m - 1), m - 1);
+        state->fill = m - 1;
+    } else {
+        size_t keep = state->fill + length < m - 1 ? state->fill : m - 1 - length;
+        memmove(state->buffer, state->buffer + state->fill - keep, keep);
+        memcpy(state->buffer + keep, data, length);
+        state->fill = keep + length;
+    }
+
+    state->position += length;
+    return SS_OK;
+}
+
+/**
+ * Feeds everything this string renders to through `_ss_find_span`, in order.
+ * The pieces are walked directly rather than with `ss_for_each_span`, as in
+ * `ss_render_into`: with short pieces the call per piece costs more than
+ * searching them.
+ */
+SS_RESULT _ss_find_walk(struct segmented_string *ss, struct _ss_find_state *state) {
+    char scratch[SSP_SCRATCH_SIZE];
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+        SS_RESULT res;
+
+        switch (ssp->type) {
+            case STRING_PIECE_TYPE_STATIC:
+                res = _ss_find_span(state, ssp->data.static_string->data, ssp->length);
+                break;
+            case STRING_PIECE_TYPE_NESTED:
+                res = _ss_find_walk(&ssp->data.nested->ss, state);
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_STRING:
+                {
+                    struct segmented_string *value = ss->values[ssp->slot].s;
+                    if (!_ss_is_renderable(value)) return SS_INVALID_STRING_TYPE;
+
+                    res = _ss_value_enter();
+                    if (res != SS_OK) return res;
+
+                    res = _ss_find_walk(value, state);
+                    _ss_value_leave();
+                }
+                break;
+            default:
+                {
+                    char *end = _ssp_format_value(ssp->type, ss->values[ssp->slot], scratch);
+                    if (end == NULL) return SS_INVALID_STRING_TYPE;
+
+                    res = _ss_find_span(state, scratch, end - scratch);
+                }
+                break;
+        }
+        if (res != SS_OK) return res;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Works out `piece` and `offset` for each match, given their positions in
+ * order, from the rendered lengths of the top level pieces.
+ */
+SS_RESULT _ss_find_locate(struct segmented_string *ss, struct ss_match *matches, size_t count) {
+    size_t start = 0;
+    size_t k = 0;
+
+    for (uint32_t i = 0; i < ss->length && k < count; i++) {
+        size_t length;
+        SS_RESULT res = ssp_render_length(&ss->pieces[i], ss->values, &length);
+        if (res != SS_OK) return res;
+
+        while (k < count && matches[k].position < start + length) {
+            matches[k].piece = i;
+            matches[k].offset = matches[k].position - start;
+            k++;
+        }
+
+        start += length;
+    }
+
+    return SS_OK;
+}
+
+SS_RESULT _ss_find(struct segmented_string *ss, const char *needle, size_t needle_length, struct _ss_find_state *state) {
+    if (needle_length == 0) return SS_ERR;
+
+    char stack_buffer[SS_FIND_STAGE + SS_FIND_STACK_NEEDLE];
+
+    state->needle = needle;
+    state->needle_length = needle_length;
+    state->position = 0;
+    state->next = 0;
+    state->fill = 0;
+    state->capacity = SS_FIND_STAGE + needle_length - 1;
+    state->count = 0;
+    state->buffer = needle_length <= SS_FIND_STACK_NEEDLE
+        ? stack_buffer
+        : (char *)SS_MALLOC(state->capacity);
+    if (state->buffer == NULL) return SS_ALLOC_ERROR;
+
+    SS_RESULT res = _ss_is_renderable(ss) ? _ss_find_walk(ss, state) : SS_INVALID_STRING_TYPE;
+    if (res == SS_OK) res = _ss_find_flush(state);
+    if (state->buffer != stack_buffer) SS_FREE(state->buffer);
+
+    /**
+     * SS_ERR from `_ss_find_span` just means we stopped early.
+     */
+    if (res == SS_ERR && state->first_only && state->count > 0) res = SS_OK;
+    if (res != SS_OK) return res;
+
+    return _ss_find_locate(ss, state->matches, state->count < state->match_capacity ? state->count : state->match_capacity);
+}
+
+/**
+ * Finds the first occurrence of `needle[0, needle_length)` in what this
+ * string renders to, without rendering it. Static data is searched where it
+ * lies and placeholders are formatted as they are reached, and matches that
+ * straddle any number of pieces are found as well as ones inside a piece.
+ * The search itself is `ss_find_bytes`, which is vectorized; short pieces are
+ * gathered up a kilobyte at a time to give it enough to work with. `*found` says
+ * whether there was one, and if so `*match` is where.
+ *
+ * An empty needle is SS_ERR.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_find(struct segmented_string *ss, const char *needle, size_t needle_length, struct ss_match *match, bool *found) {
+    struct _ss_find_state state;
+    state.matches = match;
+    state.match_capacity = 1;
+    state.first_only = true;
+
+    SS_RESULT res = _ss_find(ss, needle, needle_length, &state);
+    if (res != SS_OK) return res;
+
+    *found = state.count > 0;
+    return SS_OK;
+}
+
+/**
+ * Same as `ss_find`, for every occurrence, left to right. Matches don't
+ * overlap: the search carries on after the end of each one, so "aa" is found
+ * twice in "aaaa", not three times.
+ *
+ * `*count` is always set to how many there are. If that is more than
+ * `capacity`, the first `capacity` are stored and SS_BUFFER_TOO_SMALL is
+ * returned, as with `ss_render_into`; a capacity of 0 just counts them.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_find_all(struct segmented_string *ss, const char *needle, size_t needle_length, struct ss_match *matches, size_t capacity, size_t *count) {
+    struct _ss_find_state state;
+    state.matches = matches;
+    state.match_capacity = capacity;
+    state.first_only = false;
+
+    SS_RESULT res = _ss_find(ss, needle, needle_length, &state);
+    if (res != SS_OK) return res;
+
+    *count = state.count;
+    return state.count > capacity ? SS_BUFFER_TOO_SMALL : SS_OK;
+}
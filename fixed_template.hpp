@@ -0,0 +1,421 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ss {
+
+/**
+ * A string literal as a template argument: `fixed_template<"...">`.
+ */
+template <std::size_t N>
+struct literal {
+    char text[N];
+
+    consteval literal(const char (&source)[N]) {
+        for (std::size_t i = 0; i < N; i++) text[i] = source[i];
+    }
+
+    constexpr std::string_view view() const {
+        return std::string_view(text, N - 1);
+    }
+};
+
+/**
+ * `_ss_parse_is_name_char`, usable at compile time.
+ */
+constexpr bool _template_is_name_char(char c, bool first) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') return true;
+    return !first && c >= '0' && c <= '9';
+}
+
+/**
+ * Walks `source` as `ss_parse` does, calling `on_text(offset, length)` for
+ * each run of text (empty ones included) and `on_name(offset, length)` for
+ * each placeholder name, in order. A `$$` ends a run with its first `$`.
+ */
+template <typename Text, typename Name>
+constexpr void _template_walk(std::string_view source, Text on_text, Name on_name) {
+    std::size_t run = 0;
+    std::size_t cursor = 0;
+
+    while (true) {
+        std::size_t sigil = cursor;
+        while (sigil < source.size() && source[sigil] != '$') sigil++;
+        if (sigil == source.size()) break;
+
+        std::size_t name = sigil + 1;
+        if (name < source.size() && source[name] == '$') {
+            on_text(run, name - run);
+            run = cursor = name + 1;
+            continue;
+        }
+
+        std::size_t end = name;
+        while (end < source.size() && _template_is_name_char(source[end], end == name)) end++;
+
+        if (end == name) {
+            cursor = name;
+            continue;
+        }
+
+        on_text(run, sigil - run);
+        on_name(name, end - name);
+        run = cursor = end;
+    }
+
+    on_text(run, source.size() - run);
+}
+
+/**
+ * One piece of a parsed template. Static pieces are `text[offset, offset +
+ * length)` of the table; placeholders are uint8 placeholders, like the ones
+ * `ss_parse` makes, using `slot`.
+ */
+struct _template_piece {
+    bool placeholder;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t slot;
+};
+
+/**
+ * Where each slot's name is in the source.
+ */
+struct _template_name {
+    uint32_t offset;
+    uint32_t length;
+};
+
+/**
+ * How big the tables for a source have to be.
+ */
+struct _template_shape {
+    std::size_t pieces;
+    std::size_t statics;
+    std::size_t slots;
+    std::size_t text;
+};
+
+template <std::size_t Pieces, std::size_t Slots, std::size_t Text>
+struct _template_table {
+    std::array<_template_piece, Pieces> pieces;
+    std::array<_template_name, Slots> names;
+    std::array<char, Text> text;
+};
+
+/**
+ * Parses `source`, calling `on_piece(piece)` for each piece, `on_name(name)`
+ * for each slot as it is first seen and `on_byte(c)` for each byte of static
+ * text. Unlike `ss_parse`, runs of text either side of a `$$` are one piece.
+ */
+template <typename Piece, typename Name, typename Byte>
+constexpr void _template_parse(std::string_view source, Piece on_piece, Name on_name, Byte on_byte) {
+    std::vector<std::string_view> names;
+    _template_piece text = {false, 0, 0, 0};
+    uint32_t text_length = 0;
+
+    auto flush = [&]() {
+        if (text.length > 0) on_piece(text);
+        text = {false, text_length, 0, 0};
+    };
+
+    _template_walk(
+        source,
+        [&](std::size_t offset, std::size_t length) {
+            for (std::size_t i = 0; i < length; i++) on_byte(source[offset + i]);
+            text.length += length;
+            text_length += length;
+        },
+        [&](std::size_t offset, std::size_t length) {
+            flush();
+
+            std::string_view name = source.substr(offset, length);
+            uint32_t slot = 0;
+            while (slot < names.size() && names[slot] != name) slot++;
+            if (slot == names.size()) {
+                names.push_back(name);
+                on_name(_template_name{(uint32_t)offset, (uint32_t)length});
+            }
+
+            on_piece(_template_piece{true, 0, 0, slot});
+        }
+    );
+    flush();
+}
+
+template <literal Source>
+consteval _template_shape _template_measure() {
+    _template_shape shape = {0, 0, 0, 0};
+    _template_parse(
+        Source.view(),
+        [&](_template_piece piece) {
+            shape.pieces++;
+            if (!piece.placeholder) shape.statics++;
+        },
+        [&](_template_name) { shape.slots++; },
+        [&](char) { shape.text++; }
+    );
+    return shape;
+}
+
+template <literal Source>
+consteval auto _template_build() {
+    constexpr _template_shape shape = _template_measure<Source>();
+    _template_table<shape.pieces, shape.slots, shape.text> table = {};
+
+    std::size_t pieces = 0, names = 0, text = 0;
+    _template_parse(
+        Source.view(),
+        [&](_template_piece piece) { table.pieces[pieces++] = piece; },
+        [&](_template_name name) { table.names[names++] = name; },
+        [&](char c) { table.text[text++] = c; }
+    );
+    return table;
+}
+
+/**
+ * `sd_poly_hash_bytes(0, data, length)`, one byte at a time, while compiling.
+ */
+constexpr uint64_t _template_hash(const char *data, uint32_t length) {
+    uint64_t hash = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        unsigned __int128 sum = (unsigned __int128)hash * SD_POLY_BASE + ((unsigned char)data[i] + 1u);
+        hash = (uint64_t)(sum % SD_POLY_MOD);
+    }
+    return hash;
+}
+
+/**
+ * A string_data in static storage for bytes that are never freed, like the
+ * headers `ss_append_static_literal` makes. It is frozen from the start, so
+ * its fragment hash `hash` is cached here (see `sd_fragment_hash`), in the
+ * byte order `_sd_load_hash` reads it back in. The bytes `data` points at
+ * can't be read while compiling, so the caller hashes its own copy of them.
+ */
+constexpr struct string_data _template_data(char *data, uint32_t length, uint64_t hash) {
+    struct string_data sd = {};
+    sd.data = data;
+    sd.length = length;
+    sd.ref_count = 1;
+    sd.flags = STRING_DATA_ASCII | STRING_EXTERNAL_HEADER | STRING_FROZEN;
+
+    uint64_t word = hash | 1ULL << 63;
+    for (int i = 0; i < 8; i++) {
+        int shift = std::endian::native == std::endian::little ? 8 * i : 8 * (7 - i);
+        sd.inline_data[SD_HASH_WORD_OFFSET + i] = (char)(word >> shift);
+    }
+    return sd;
+}
+
+/**
+ * A template whose source is known at compile time, such as one in generated
+ * code. `Source` is parsed while compiling, with the same syntax as
+ * `ss_parse`, and nothing about the template is built at run time:
+ *
+ * - Placeholder names are resolved to slot ids by `slot`, which fails to
+ *   compile for a name the template doesn't have, and `fill` fills by one.
+ * - `static_length` is the length of all the text, and `max_length` the most
+ *   a rendering can take.
+ * - `prototype` is the parsed template as a frozen `struct segmented_string`,
+ *   constant initialized: its pieces, string_data headers and slot state are
+ *   all in static storage, filled in by the compiler. It can be used with
+ *   anything that takes a frozen string. `create` clones it, which like any
+ *   clone of a frozen template (see `ss_freeze`) copies nothing but the slot
+ *   values, and can be done on any number of threads at once.
+ * - `render_into` renders a clone with one straight line of copies and
+ *   formats, one per piece, with every static length a constant.
+ *
+ *     using row = ss::fixed_template<"<td>$name</td><td>$age</td>">;
+ *     static_assert(row::slot("age") == 1);
+ *
+ *     struct segmented_string *ss;
+ *     row::create(&ss);
+ *     row::fill<"age">(ss, 42);
+ *
+ * Header-only like the rest, and C++20.
+ */
+template <literal Source>
+class fixed_template {
+    static constexpr auto _table = _template_build<Source>();
+    static constexpr _template_shape _shape = _template_measure<Source>();
+
+public:
+    static constexpr uint32_t piece_count = _shape.pieces;
+    static constexpr uint32_t slot_count = _shape.slots;
+    static constexpr std::size_t static_length = _shape.text;
+
+    /**
+     * Every placeholder is a uint8 one, at most three digits.
+     */
+    static constexpr std::size_t max_length = static_length + 3 * (_shape.pieces - _shape.statics);
+
+    /**
+     * The slot id of the placeholder called `name`. Only usable at compile
+     * time, where an unknown name is an error.
+     */
+    static consteval uint32_t slot(std::string_view name) {
+        for (uint32_t i = 0; i < slot_count; i++) {
+            if (Source.view().substr(_table.names[i].offset, _table.names[i].length) == name) return i;
+        }
+        throw "no placeholder with that name";
+    }
+
+private:
+    static inline constinit std::remove_const_t<decltype(Source)> _source = Source;
+    static inline constinit std::array<char, _shape.text> _text = _table.text;
+
+    static inline constinit std::array<struct string_data, _shape.statics> _static_data = [] {
+        std::array<struct string_data, _shape.statics> out = {};
+        std::size_t k = 0;
+        for (const _template_piece &piece : _table.pieces) {
+            if (piece.placeholder) continue;
+            out[k++] = _template_data(
+                _text.data() + piece.offset,
+                piece.length,
+                _template_hash(_table.text.data() + piece.offset, piece.length)
+            );
+        }
+        return out;
+    }();
+
+    static inline constinit std::array<struct string_data, _shape.slots> _names = [] {
+        std::array<struct string_data, _shape.slots> out = {};
+        for (std::size_t i = 0; i < _shape.slots; i++) {
+            const _template_name &name = _table.names[i];
+            out[i] = _template_data(
+                _source.text + name.offset,
+                name.length,
+                _template_hash(Source.text + name.offset, name.length)
+            );
+        }
+        return out;
+    }();
+
+    static inline constinit std::array<struct segmented_string_piece, _shape.pieces> _pieces = [] {
+        std::array<struct segmented_string_piece, _shape.pieces> out = {};
+        std::size_t k = 0;
+        for (std::size_t i = 0; i < _shape.pieces; i++) {
+            const _template_piece &piece = _table.pieces[i];
+            if (piece.placeholder) {
+                out[i].data.placeholder_data = {&_names[piece.slot]};
+                out[i].slot = piece.slot;
+                out[i].type = STRING_PIECE_TYPE_PLACEHOLDER_UINT8;
+            } else {
+                out[i].data.static_string = &_static_data[k++];
+                out[i].length = piece.length;
+                out[i].type = STRING_PIECE_TYPE_STATIC;
+            }
+        }
+        return out;
+    }();
+
+    static inline constinit std::array<uint64_t, (_shape.slots + 63) / 64> _filled = {};
+    static inline constinit std::array<union ss_value, _shape.slots> _values = {};
+    static inline constinit std::array<uint8_t, _shape.slots> _slot_types = [] {
+        std::array<uint8_t, _shape.slots> out = {};
+        for (uint8_t &type : out) type = STRING_PIECE_TYPE_PLACEHOLDER_UINT8;
+        return out;
+    }();
+
+    static inline constinit struct segmented_string _prototype = [] {
+        struct segmented_string ss = {};
+        ss.type = _shape.slots > 0 ? UNFILLED_TEMPLATE_STRING : _shape.pieces > 0 ? STATIC_STRING : EMPTY_STRING;
+        ss.length = _shape.pieces;
+        ss.capacity = _shape.pieces;
+        ss.pieces = _shape.pieces > 0 ? _pieces.data() : nullptr;
+        ss.slot_count = _shape.slots;
+        ss.slot_capacity = _shape.slots;
+        ss.unfilled_slots = _shape.slots;
+        if (_shape.slots > 0) {
+            ss.filled = _filled.data();
+            ss.values = _values.data();
+            ss.slot_types = _slot_types.data();
+        }
+        ss.frozen = true;
+        return ss;
+    }();
+
+    template <std::size_t I>
+    static char *_render_piece(char *cursor, const union ss_value *values) {
+        constexpr _template_piece piece = _table.pieces[I];
+
+        if constexpr (piece.placeholder) {
+            return _ssp_format_uint8(cursor, (uint8_t)values[piece.slot].u);
+        } else {
+            std::memcpy(cursor, _table.text.data() + piece.offset, piece.length);
+            return cursor + piece.length;
+        }
+    }
+
+    template <std::size_t I>
+    static std::size_t _piece_length(const union ss_value *values) {
+        constexpr _template_piece piece = _table.pieces[I];
+
+        if constexpr (piece.placeholder) {
+            return _ssp_uint8_width((uint8_t)values[piece.slot].u);
+        } else {
+            return piece.length;
+        }
+    }
+
+public:
+    /**
+     * The template itself. It is in static storage, so it is never freed.
+     */
+    static struct segmented_string *prototype() {
+        return &_prototype;
+    }
+
+    /**
+     * A new, unfilled instance of the template, to be filled, rendered and
+     * freed like any other clone.
+     */
+    static SS_RESULT create(struct segmented_string **out) {
+        return ss_clone(&_prototype, out);
+    }
+
+    /**
+     * Fills the placeholder called `Name`, found while compiling.
+     */
+    template <literal Name>
+    static SS_RESULT fill(struct segmented_string *ss, uint8_t value) {
+        constexpr uint32_t id = slot(Name.view());
+        return ss_fill_slot_uint8(ss, id, value);
+    }
+
+    /**
+     * Same as `ss_render_into`, which is what it falls back on for a string
+     * that isn't a clone of this template with its pieces untouched. Room for
+     * `max_length` bytes saves working out the length first.
+     */
+    static SS_RESULT render_into(struct segmented_string *ss, char *buf, std::size_t capacity, std::size_t *written) {
+        if (ss->pieces != _prototype.pieces || ss->length != piece_count || ss->unfilled_slots != 0) {
+            return ss_render_into(ss, buf, capacity, written);
+        }
+
+        return [&]<std::size_t... I>(std::index_sequence<I...>) {
+            if (capacity < max_length && (_piece_length<I>(ss->values) + ... + 0) > capacity) {
+                return SS_BUFFER_TOO_SMALL;
+            }
+
+            char *cursor = buf;
+            ((cursor = _render_piece<I>(cursor, ss->values)), ...);
+
+            *written = cursor - buf;
+            return SS_OK;
+        }(std::make_index_sequence<piece_count>{});
+    }
+};
+
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+#include "string_data.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Spans shorter than this are hashed byte by byte even when their
+ * string_data has a cached hash: below it, working out B^length costs more
+ * than the bytes do.
+ */
+#define SS_HASH_CACHE_MIN 32
+
+/**
+ * Carries the polynomial hash (see `sd_fragment_hash`) on over everything
+ * this string renders to. The pieces are walked directly rather than with
+ * `ss_for_each_span`, for the same reason `ss_render_into` does: with short
+ * pieces the call per piece costs more than hashing them.
+ */
+SS_RESULT _ss_hash_into(struct segmented_string *ss, uint64_t *hash) {
+    char scratch[SSP_SCRATCH_SIZE];
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        switch (ssp->type) {
+            case STRING_PIECE_TYPE_STATIC:
+                {
+                    struct string_data *sd = ssp->data.static_string;
+
+                    if (ssp->length >= SS_HASH_CACHE_MIN && (sd->flags & STRING_INLINE_DATA) == 0) {
+                        *hash = _sd_poly_reduce((unsigned __int128)*hash * sd_poly_power(ssp->length) + sd_fragment_hash(sd));
+                    } else {
+                        *hash = sd_poly_hash_bytes(*hash, sd->data, ssp->length);
+                    }
+                }
+                break;
+            case STRING_PIECE_TYPE_NESTED:
+                {
+                    SS_RESULT res = _ss_hash_into(&ssp->data.nested->ss, hash);
+                    if (res != SS_OK) return res;
+                }
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_STRING:
+                {
+                    struct segmented_string *value = ss->values[ssp->slot].s;
+                    if (!_ss_is_renderable(value)) return SS_INVALID_STRING_TYPE;
+
+                    SS_RESULT res = _ss_value_enter();
+                    if (res != SS_OK) return res;
+
+                    res = _ss_hash_into(value, hash);
+                    _ss_value_leave();
+                    if (res != SS_OK) return res;
+                }
+                break;
+            default:
+                {
+                    char *end = _ssp_format_value(ssp->type, ss->values[ssp->slot], scratch);
+                    if (end == NULL) return SS_INVALID_STRING_TYPE;
+
+                    *hash = sd_poly_hash_bytes(*hash, scratch, end - scratch);
+                }
+                break;
+        }
+    }
+
+    return SS_OK;
+}
+
+/**
+ * The murmur3 finalizer.
+ */
+uint64_t _ss_hash_finish(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * Hashes the bytes this string renders to, without rendering it. Static data
+ * and formatted placeholders are streamed through in order, nested strings
+ * and string placeholders included, so two strings that render the same
+ * bytes hash the same however they are segmented, and the same as
+ * `ss_hash_bytes` of the rendering. The hash of a static piece's string_data
+ * is cached in the string_data the first time (see `sd_fragment_hash`), so
+ * the static parts of a template are only hashed once however many strings
+ * share them. After that a static piece costs a few multiplies however long
+ * it is.
+ *
+ * The polynomial hash is scrambled on the way out, so every bit of the
+ * result is usable as a hash table index. It is not meant to stand up to
+ * anyone choosing strings to make it collide.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_hash(struct segmented_string *ss, uint64_t *hash) {
+    if (!_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+
+    uint64_t state = 0;
+    SS_RESULT res = _ss_hash_into(ss, &state);
+    if (res != SS_OK) return res;
+
+    *hash = _ss_hash_finish(state);
+    return SS_OK;
+}
+
+/**
+ * What `ss_hash` gives for a string rendering to `data[0, length)`.
+ */
+uint64_t ss_hash_bytes(const char *data, size_t length) {
+    return _ss_hash_finish(sd_poly_hash_bytes(0, data, length));
+}
+
+/**
+ * A string being walked span by span at the caller's pace, for when two
+ * strings have to be walked side by side. `ss_for_each_span` calls us; this
+ * is the other way round. Every string we are inside of has a frame, which
+ * says which of its pieces is next.
+ */
+struct _ss_span_frame {
+    struct segmented_string *ss;
+    uint32_t index;
+};
+
+#define SS_CURSOR_STACK_FRAMES 16
+
+/**
+ * Every string value can be SS_CONCAT_MAX_DEPTH nested strings deep, so this
+ * is as deep as the walkers that recurse (see `_ss_value_enter`) can go.
+ */
+#define SS_CURSOR_MAX_FRAMES ((SS_VALUE_MAX_DEPTH + 1) * (SS_CONCAT_MAX_DEPTH + 1))
+
+struct _ss_span_cursor {
+    struct _ss_span_frame *frames;
+    uint32_t depth;
+    uint32_t capacity;
+
+    /**
+     * What is left of the current span. Formatted placeholders are in
+     * `scratch`, and good until the next `_ss_cursor_next`.
+     */
+    const char *data;
+    size_t length;
+
+    char scratch[SSP_SCRATCH_SIZE];
+    struct _ss_span_frame stack_frames[SS_CURSOR_STACK_FRAMES];
+};
+
+SS_RESULT _ss_cursor_push(struct _ss_span_cursor *cursor, struct segmented_string *ss) {
+    if (!_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+    if (cursor->depth == SS_CURSOR_MAX_FRAMES) return SS_ERR;
+
+    if (cursor->depth == cursor->capacity) {
+        uint32_t capacity = cursor->capacity * 2;
+        struct _ss_span_frame *frames = (struct _ss_span_frame *)SS_MALLOC(sizeof(struct _ss_span_frame) * capacity);
+        if (frames == NULL) return SS_ALLOC_ERROR;
+
+        memcpy(frames, cursor->frames, sizeof(struct _ss_span_frame) * cursor->depth);
+        if (cursor->frames != cursor->stack_frames) SS_FREE(cursor->frames);
+        cursor->frames = frames;
+        cursor->capacity = capacity;
+    }
+
+    cursor->frames[cursor->depth].ss = ss;
+    cursor->frames[cursor->depth].index = 0;
+    cursor->depth++;
+    return SS_OK;
+}
+
+SS_RESULT _ss_cursor_init(struct _ss_span_cursor *cursor, struct segmented_string *ss) {
+    cursor->frames = cursor->stack_frames;
+    cursor->depth = 0;
+    cursor->capacity = SS_CURSOR_STACK_FRAMES;
+    cursor->data = NULL;
+    cursor->length = 0;
+
+    return _ss_cursor_push(cursor, ss);
+}
+
+void _ss_cursor_free(struct _ss_span_cursor *cursor) {
+    if (cursor->frames != cursor->stack_frames) SS_FREE(cursor->frames);
+}
+
+/**
+ * Moves on to the next span that isn't empty. At the end of the string,
+ * `length` is left at 0.
+ */
+SS_RESULT _ss_cursor_next(struct _ss_span_cursor *cursor) {
+    cursor->length = 0;
+
+    while (cursor->depth > 0) {
+        struct _ss_span_frame *frame = &cursor->frames[cursor->depth - 1];
+        if (frame->index == frame->ss->length) {
+            cursor->depth--;
+            continue;
+        }
+
+        struct segmented_string *ss = frame->ss;
+        struct segmented_string_piece *ssp = &ss->pieces[frame->index++];
+        SS_RESULT res;
+
+        if (ssp->type == STRING_PIECE_TYPE_NESTED) {
+            res = _ss_cursor_push(cursor, &ssp->data.nested->ss);
+        } else if (ssp->type == STRING_PIECE_TYPE_PLACEHOLDER_STRING) {
+            res = _ss_cursor_push(cursor, ss->values[ssp->slot].s);
+        } else {
+            res = ssp_bytes(ssp, ss->values, cursor->scratch, &cursor->data, &cursor->length);
+            if (res == SS_OK && cursor->length > 0) return SS_OK;
+        }
+        if (res != SS_OK) return res;
+    }
+
+    return SS_OK;
+}
+
+struct _ss_equals_state {
+    struct _ss_span_cursor cursor;
+    bool mismatch;
+};
+
+/**
+ * Checks one span of the first string against the second string's cursor.
+ * Bytes that are the very same bytes (two strings sharing static data) aren't
+ * compared.
+ */
+SS_RESULT _ss_equals_span(void *ctx, const char *data, size_t length, struct string_data *source) {
+    struct _ss_equals_state *state = (struct _ss_equals_state *)ctx;
+    struct _ss_span_cursor *cursor = &state->cursor;
+    (void)source;
+
+    while (length > 0) {
+        if (cursor->length == 0) {
+            SS_RESULT res = _ss_cursor_next(cursor);
+            if (res != SS_OK) return res;
+
+            if (cursor->length == 0) {
+                state->mismatch = true;
+                return SS_ERR;
+            }
+        }
+
+        size_t n = length < cursor->length ? length : cursor->length;
+        if (cursor->data != data && memcmp(cursor->data, data, n) != 0) {
+            state->mismatch = true;
+            return SS_ERR;
+        }
+
+        data += n;
+        length -= n;
+        cursor->data += n;
+        cursor->length -= n;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Sets `*equal` to whether `a` and `b` render to the same bytes, without
+ * rendering either. Like `ss_hash`, only the bytes count: a template filled
+ * with 42 equals the static string "42", and how either is split into pieces
+ * makes no difference. Flags on the string_data don't count either, unlike
+ * `sd_matches`.
+ *
+ * The rendered lengths are compared first, which only costs a walk over the
+ * pieces. After that both strings are walked side by side and compared a run
+ * at a time, stopping at the first difference.
+ *
+ * Valid String Types (a, b): FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_equals(struct segmented_string *a, struct segmented_string *b, bool *equal) {
+    if (!_ss_is_renderable(a) || !_ss_is_renderable(b)) return SS_INVALID_STRING_TYPE;
+
+    size_t a_length, b_length;
+    SS_RESULT res = ss_render_length(a, &a_length);
+    if (res != SS_OK) return res;
+    res = ss_render_length(b, &b_length);
+    if (res != SS_OK) return res;
+
+    if (a_length != b_length) {
+        *equal = false;
+        return SS_OK;
+    }
+    if (a == b) {
+        *equal = true;
+        return SS_OK;
+    }
+
+    struct _ss_equals_state state;
+    state.mismatch = false;
+
+    res = _ss_cursor_init(&state.cursor, b);
+    if (res == SS_OK) res = ss_for_each_span(a, _ss_equals_span, &state);
+    _ss_cursor_free(&state.cursor);
+
+    if (state.mismatch) {
+        *equal = false;
+        return SS_OK;
+    }
+    if (res != SS_OK) return res;
+
+    /**
+     * The lengths match, so there is nothing left of `b`.
+     */
+    *equal = true;
+    return SS_OK;
+}
@@ -0,0 +1,557 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * A template image is a set of templates written out as one flat block of
+ * bytes, so that a process can map its templates in at startup instead of
+ * building them with `ss_create` and `ss_append_*` calls.
+ *
+ * The block is made of:
+ *
+ *     struct ss_image_header
+ *     struct ss_image_template[template_count]
+ *     struct ss_image_piece[piece_count]
+ *     struct ss_image_name[name_count]
+ *     blob_size bytes of static text and placeholder names
+ *
+ * Everything in it is an offset, never a pointer, so the same bytes are good
+ * at any address and in any number of processes at once. Integers are in the
+ * byte order of the machine that wrote the image, and a loader with the other
+ * byte order refuses it rather than swapping.
+ */
+#define SS_IMAGE_MAGIC "SSIMAGE"
+#define SS_IMAGE_VERSION 1
+#define SS_IMAGE_BYTE_ORDER 0x01020304u
+
+struct ss_image_header {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t template_count;
+    uint32_t piece_count;
+    uint32_t name_count;
+    uint32_t blob_size;
+};
+
+/**
+ * A template's pieces are `pieces[first_piece, first_piece + piece_count)`,
+ * and slot `s` is named `names[first_name + s]`.
+ */
+struct ss_image_template {
+    uint32_t first_piece;
+    uint32_t piece_count;
+    uint32_t first_name;
+    uint32_t slot_count;
+};
+
+/**
+ * `type` is a `StringPieceType`: STATIC or one of the placeholder types. A
+ * static piece is `length` bytes of the blob from `offset`; a placeholder
+ * stores its slot in `length` and has no offset.
+ */
+struct ss_image_piece {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct ss_image_name {
+    uint32_t offset;
+    uint32_t length;
+};
+
+/**
+ * A loaded image. `templates[i]` is the i-th template that was written, and
+ * is frozen: it is meant to be cloned and filled, never changed. Its static
+ * pieces point straight into `data`.
+ *
+ * What a template needs beyond the image bytes -- its header, its pieces, a
+ * string_data header for each static piece and name, and its slot state --
+ * is made in a single allocation, `block`, however many pieces there are.
+ * The name indexes built for filling by name are the only other allocations.
+ */
+struct ss_image {
+    const char *data;
+    size_t size;
+    bool mapped;
+
+    uint32_t template_count;
+    struct segmented_string *templates;
+    void *block;
+};
+
+/**
+ * Cursors into the image being written. With `buf` NULL nothing is written
+ * and the counts just add up to the size of the image.
+ */
+struct _ss_image_writer {
+    char *buf;
+    struct ss_image_template *templates;
+    struct ss_image_piece *pieces;
+    struct ss_image_name *names;
+    char *blob;
+
+    size_t template_count;
+    size_t piece_count;
+    size_t name_count;
+    size_t blob_size;
+
+    /**
+     * Whether the last piece written for the current template is static.
+     * Static bytes are written to the blob in order, so a static piece right
+     * after another one just makes that one longer, and a loaded template has
+     * at most one static piece between two placeholders however it was built.
+     */
+    bool open_static;
+};
+
+void _ss_image_static(struct _ss_image_writer *w, const char *data, size_t length) {
+    if (length == 0) return;
+
+    if (!w->open_static) {
+        if (w->buf != NULL) {
+            w->pieces[w->piece_count].type = STRING_PIECE_TYPE_STATIC;
+            w->pieces[w->piece_count].offset = (uint32_t)w->blob_size;
+            w->pieces[w->piece_count].length = 0;
+        }
+        w->piece_count++;
+        w->open_static = true;
+    }
+
+    if (w->buf != NULL) {
+        memcpy(w->blob + w->blob_size, data, length);
+        w->pieces[w->piece_count - 1].length += (uint32_t)length;
+    }
+    w->blob_size += length;
+}
+
+SS_RESULT _ss_image_span(void *ctx, const char *data, size_t length, struct string_data *source) {
+    (void)source;
+    _ss_image_static((struct _ss_image_writer *)ctx, data, length);
+    return SS_OK;
+}
+
+/**
+ * Adds one template. Nested pieces are flattened into their bytes.
+ */
+SS_RESULT _ss_image_template(struct _ss_image_writer *w, struct segmented_string *ss) {
+    if (ss->type == STRING_LIST) return SS_INVALID_STRING_TYPE;
+
+    struct ss_image_template *t = w->buf != NULL ? &w->templates[w->template_count] : NULL;
+    if (t != NULL) {
+        t->first_piece = (uint32_t)w->piece_count;
+        t->first_name = (uint32_t)w->name_count;
+        t->slot_count = ss->slot_count;
+    }
+    w->open_static = false;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        if (ssp->type == STRING_PIECE_TYPE_STATIC) {
+            _ss_image_static(w, ssp->data.static_string->data, ssp->length);
+        } else if (ssp->type == STRING_PIECE_TYPE_NESTED) {
+            SS_RESULT res = ss_for_each_span(&ssp->data.nested->ss, _ss_image_span, w);
+            if (res != SS_OK) return res;
+        } else {
+            if (w->buf != NULL) {
+                w->pieces[w->piece_count].type = ssp->type;
+                w->pieces[w->piece_count].offset = 0;
+                w->pieces[w->piece_count].length = ssp->slot;
+            }
+            w->piece_count++;
+            w->open_static = false;
+        }
+    }
+
+    if (t != NULL) t->piece_count = (uint32_t)(w->piece_count - t->first_piece);
+
+    /**
+     * Slots were numbered in order of first appearance, so the first
+     * placeholder for each slot we haven't named yet names it.
+     */
+    uint32_t named = 0;
+    for (uint32_t i = 0; i < ss->length && named < ss->slot_count; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+        if (!ssp_is_template(ssp) || ssp->slot != named) continue;
+
+        struct string_data *name = ssp->data.placeholder_data.placeholder;
+        if (w->buf != NULL) {
+            w->names[w->name_count].offset = (uint32_t)w->blob_size;
+            w->names[w->name_count].length = name->length;
+            memcpy(w->blob + w->blob_size, name->data, name->length);
+        }
+        w->name_count++;
+        w->blob_size += name->length;
+        named++;
+    }
+
+    w->template_count++;
+    return SS_OK;
+}
+
+SS_RESULT _ss_image_templates(struct _ss_image_writer *w, struct segmented_string *const *templates, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        SS_RESULT res = _ss_image_template(w, templates[i]);
+        if (res != SS_OK) return res;
+    }
+    return SS_OK;
+}
+
+/**
+ * Writes `templates[0, count)` into `buf` as an image that `ss_image_load` or
+ * `ss_image_map` can read back. This follows the same protocol as
+ * `ss_render_into`: `*written` is always set to the size of the image, and if
+ * that is more than `capacity` nothing is written and SS_BUFFER_TOO_SMALL is
+ * returned, so a first call with a capacity of 0 gets the size to allocate.
+ *
+ * What is saved is each template's text and placeholders. Slot values are
+ * not, so a loaded template always starts out unfilled. Nested strings are
+ * saved as the text they render to.
+ *
+ * Valid String Types: All except STRING_LIST
+ */
+SS_RESULT ss_image_write(struct segmented_string *const *templates, uint32_t count, char *buf, size_t capacity, size_t *written) {
+    struct _ss_image_writer w;
+    memset(&w, 0, sizeof(w));
+
+    SS_RESULT res = _ss_image_templates(&w, templates, count);
+    if (res != SS_OK) return res;
+
+    if (w.piece_count > UINT32_MAX || w.name_count > UINT32_MAX || w.blob_size > UINT32_MAX) return SS_ERR;
+
+    size_t tables = sizeof(struct ss_image_header)
+        + sizeof(struct ss_image_template) * w.template_count
+        + sizeof(struct ss_image_piece) * w.piece_count
+        + sizeof(struct ss_image_name) * w.name_count;
+
+    *written = tables + w.blob_size;
+    if (*written > capacity) return SS_BUFFER_TOO_SMALL;
+
+    struct ss_image_header *header = (struct ss_image_header *)buf;
+    memset(header, 0, sizeof(struct ss_image_header));
+    memcpy(header->magic, SS_IMAGE_MAGIC, sizeof(SS_IMAGE_MAGIC));
+    header->byte_order = SS_IMAGE_BYTE_ORDER;
+    header->version = SS_IMAGE_VERSION;
+    header->template_count = (uint32_t)w.template_count;
+    header->piece_count = (uint32_t)w.piece_count;
+    header->name_count = (uint32_t)w.name_count;
+    header->blob_size = (uint32_t)w.blob_size;
+
+    w.buf = buf;
+    w.templates = (struct ss_image_template *)(header + 1);
+    w.pieces = (struct ss_image_piece *)(w.templates + w.template_count);
+    w.names = (struct ss_image_name *)(w.pieces + w.piece_count);
+    w.blob = (char *)(w.names + w.name_count);
+    w.template_count = w.piece_count = w.name_count = w.blob_size = 0;
+
+    return _ss_image_templates(&w, templates, count);
+}
+
+/**
+ * Checks everything the loader is going to rely on, so that a truncated or
+ * corrupt image is refused instead of read out of bounds. Counts the static
+ * pieces as it goes.
+ */
+SS_RESULT _ss_image_check(const char *data, size_t size, size_t *static_count) {
+    if (((uintptr_t)data & 3) != 0) return SS_BAD_IMAGE;
+    if (size < sizeof(struct ss_image_header)) return SS_BAD_IMAGE;
+
+    const struct ss_image_header *header = (const struct ss_image_header *)data;
+    if (memcmp(header->magic, SS_IMAGE_MAGIC, sizeof(SS_IMAGE_MAGIC)) != 0) return SS_BAD_IMAGE;
+    if (header->byte_order != SS_IMAGE_BYTE_ORDER) return SS_BAD_IMAGE;
+    if (header->version != SS_IMAGE_VERSION) return SS_BAD_IMAGE;
+
+    uint64_t expected = sizeof(struct ss_image_header)
+        + (uint64_t)sizeof(struct ss_image_template) * header->template_count
+        + (uint64_t)sizeof(struct ss_image_piece) * header->piece_count
+        + (uint64_t)sizeof(struct ss_image_name) * header->name_count
+        + header->blob_size;
+    if (expected != size) return SS_BAD_IMAGE;
+
+    const struct ss_image_template *templates = (const struct ss_image_template *)(header + 1);
+    const struct ss_image_piece *pieces = (const struct ss_image_piece *)(templates + header->template_count);
+    const struct ss_image_name *names = (const struct ss_image_name *)(pieces + header->piece_count);
+
+    for (uint32_t i = 0; i < header->name_count; i++) {
+        if ((uint64_t)names[i].offset + names[i].length > header->blob_size) return SS_BAD_IMAGE;
+    }
+
+    *static_count = 0;
+    for (uint32_t i = 0; i < header->template_count; i++) {
+        const struct ss_image_template *t = &templates[i];
+        if ((uint64_t)t->first_piece + t->piece_count > header->piece_count) return SS_BAD_IMAGE;
+        if ((uint64_t)t->first_name + t->slot_count > header->name_count) return SS_BAD_IMAGE;
+
+        for (uint32_t j = t->first_piece; j < t->first_piece + t->piece_count; j++) {
+            if (pieces[j].type == STRING_PIECE_TYPE_STATIC) {
+                if ((uint64_t)pieces[j].offset + pieces[j].length > header->blob_size) return SS_BAD_IMAGE;
+                (*static_count)++;
+            } else if (_ssp_is_placeholder_type((enum StringPieceType)pieces[j].type)) {
+                if (pieces[j].length >= t->slot_count) return SS_BAD_IMAGE;
+            } else {
+                return SS_BAD_IMAGE;
+            }
+        }
+    }
+
+    return SS_OK;
+}
+
+/**
+ * A string_data for bytes that live in the image. It is frozen from the
+ * start, so its fragment hash is cached here (see `sd_fragment_hash`).
+ */
+void _ss_image_sd(struct string_data *sd, const char *blob, uint32_t offset, uint32_t length) {
+    memset(sd, 0, sizeof(struct string_data));
+    sd->data = (char *)blob + offset;
+    sd->length = length;
+    sd->ref_count = 1;
+    sd->flags = STRING_DATA_ASCII | STRING_EXTERNAL_HEADER | STRING_FROZEN;
+    _sd_store_hash(sd, sd_poly_hash_bytes(0, sd->data, length) | 1ULL << 63);
+}
+
+/**
+ * Releases everything `ss_image_load` made. Does not unmap anything.
+ */
+void _ss_image_release(struct ss_image *image) {
+    for (uint32_t i = 0; i < image->template_count; i++) {
+        SS_FREE(image->templates[i].slots);
+    }
+    SS_FREE(image->block);
+}
+
+/**
+ * Loads the templates in an image made by `ss_image_write`. `data` has to be
+ * 4-byte aligned, which anything from malloc or mmap is, and has to stay
+ * where it is until `ss_image_free`: nothing is copied out of it. Neither is
+ * anything written to it, so a read-only mapping of a file shared by many
+ * processes is fine, and is what `ss_image_map` does.
+ *
+ * The image is checked before anything is built from it. If anything in it
+ * is out of bounds, or it was written by a different version or on a
+ * machine with a different byte order, this returns SS_BAD_IMAGE.
+ *
+ * Every template is compiled and frozen, so it can be filled by name and
+ * cloned from any number of threads. Clones borrow from the image, which has
+ * to outlive them (see `ss_freeze`).
+ */
+SS_RESULT ss_image_load(const void *data, size_t size, struct ss_image **image) {
+    size_t static_count;
+    SS_RESULT res = _ss_image_check((const char *)data, size, &static_count);
+    if (res != SS_OK) return res;
+
+    const struct ss_image_header *header = (const struct ss_image_header *)data;
+    const struct ss_image_template *templates = (const struct ss_image_template *)(header + 1);
+    const struct ss_image_piece *pieces = (const struct ss_image_piece *)(templates + header->template_count);
+    const struct ss_image_name *names = (const struct ss_image_name *)(pieces + header->piece_count);
+    const char *blob = (const char *)(names + header->name_count);
+
+    size_t slot_state = 0;
+    for (uint32_t i = 0; i < header->template_count; i++) {
+        slot_state += (_ss_slot_state_size(templates[i].slot_count) + 7) & ~(size_t)7;
+    }
+
+    size_t block_size = sizeof(struct segmented_string) * header->template_count
+        + sizeof(struct segmented_string_piece) * header->piece_count
+        + sizeof(struct string_data) * (static_count + header->name_count)
+        + slot_state;
+
+    *image = (struct ss_image *)SS_MALLOC(sizeof(struct ss_image));
+    if (*image == NULL) return SS_ALLOC_ERROR;
+
+    char *block = (char *)SS_MALLOC(block_size > 0 ? block_size : 1);
+    if (block == NULL) {
+        SS_FREE(*image);
+        return SS_ALLOC_ERROR;
+    }
+
+    (*image)->data = (const char *)data;
+    (*image)->size = size;
+    (*image)->mapped = false;
+    (*image)->template_count = header->template_count;
+    (*image)->block = block;
+
+    struct segmented_string *ss = (struct segmented_string *)block;
+    struct segmented_string_piece *ssp = (struct segmented_string_piece *)(ss + header->template_count);
+    struct string_data *name_sds = (struct string_data *)(ssp + header->piece_count);
+    struct string_data *static_sds = name_sds + header->name_count;
+    char *slot_cursor = (char *)(static_sds + static_count);
+
+    (*image)->templates = ss;
+
+    for (uint32_t i = 0; i < header->name_count; i++) {
+        _ss_image_sd(&name_sds[i], blob, names[i].offset, names[i].length);
+    }
+
+    for (uint32_t i = 0; i < header->template_count; i++) {
+        const struct ss_image_template *t = &templates[i];
+        struct segmented_string *loaded = &ss[i];
+
+        _ss_init(loaded, EMPTY_STRING, NULL);
+        loaded->length = t->piece_count;
+        loaded->capacity = t->piece_count;
+        loaded->pieces = t->piece_count > 0 ? ssp : NULL;
+
+        if (t->slot_count > 0) {
+            size_t size = _ss_slot_state_size(t->slot_count);
+            memset(slot_cursor, 0, size);
+            _ss_slot_state_bind(loaded, slot_cursor, t->slot_count);
+            slot_cursor += (size + 7) & ~(size_t)7;
+
+            loaded->slot_count = t->slot_count;
+            loaded->slot_capacity = t->slot_count;
+            loaded->unfilled_slots = t->slot_count;
+        }
+
+        for (uint32_t j = 0; j < t->piece_count; j++) {
+            const struct ss_image_piece *piece = &pieces[t->first_piece + j];
+            ssp->type = (enum StringPieceType)piece->type;
+
+            if (piece->type == STRING_PIECE_TYPE_STATIC) {
+                _ss_image_sd(static_sds, blob, piece->offset, piece->length);
+                ssp->data.static_string = static_sds++;
+                ssp->length = piece->length;
+            } else {
+                ssp->data.placeholder_data.placeholder = &name_sds[t->first_name + piece->length];
+                ssp->slot = piece->length;
+
+                /**
+                 * Every placeholder of a slot has to have the same type. 0 is
+                 * STATIC, which no slot ever has, so it means "not seen yet".
+                 */
+                uint8_t *slot_type = &loaded->slot_types[ssp->slot];
+                if (*slot_type == 0) *slot_type = (uint8_t)piece->type;
+                if (*slot_type != piece->type) res = SS_BAD_IMAGE;
+            }
+            ssp++;
+        }
+
+        for (uint32_t s = 0; s < t->slot_count && res == SS_OK; s++) {
+            if (loaded->slot_types[s] == 0) res = SS_BAD_IMAGE;
+        }
+
+        if (res == SS_OK && t->slot_count > 0) {
+            res = _ss_slot_table_create(NULL, t->slot_count, &loaded->slots);
+        }
+
+        if (res != SS_OK) {
+            (*image)->template_count = i;
+            _ss_image_release(*image);
+            SS_FREE(*image);
+            return res;
+        }
+
+        if (t->slot_count > 0) {
+            for (uint32_t s = 0; s < t->slot_count; s++) {
+                _ss_slot_table_add(loaded->slots, s, &name_sds[t->first_name + s]);
+            }
+            loaded->slots->frozen = true;
+
+            loaded->type = UNFILLED_TEMPLATE_STRING;
+        } else if (t->piece_count > 0) {
+            loaded->type = STATIC_STRING;
+        }
+
+        loaded->frozen = true;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Maps the image file at `path` read-only and loads it (see `ss_image_load`).
+ * The mapping is shared, so every process that maps the same file shares the
+ * same physical pages for it. Returns SS_ERR if the file can't be opened or
+ * mapped.
+ */
+SS_RESULT ss_image_map(const char *path, struct ss_image **image) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return SS_ERR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return SS_ERR;
+    }
+    if (st.st_size < (off_t)sizeof(struct ss_image_header)) {
+        close(fd);
+        return SS_BAD_IMAGE;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return SS_ERR;
+
+    SS_RESULT res = ss_image_load(data, size, image);
+    if (res != SS_OK) {
+        munmap(data, size);
+        return res;
+    }
+
+    (*image)->mapped = true;
+    return SS_OK;
+}
+
+/**
+ * Writes `templates[0, count)` to the file at `path` as an image (see
+ * `ss_image_write`), replacing whatever was there. Returns SS_ERR if the
+ * file can't be written.
+ *
+ * Valid String Types: All except STRING_LIST
+ */
+SS_RESULT ss_image_save(const char *path, struct segmented_string *const *templates, uint32_t count) {
+    size_t size;
+    SS_RESULT res = ss_image_write(templates, count, NULL, 0, &size);
+    if (res != SS_BUFFER_TOO_SMALL) return res;
+
+    char *buf = (char *)SS_MALLOC(size);
+    if (buf == NULL) return SS_ALLOC_ERROR;
+
+    res = ss_image_write(templates, count, buf, size, &size);
+    if (res == SS_OK) {
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+            res = SS_ERR;
+        } else {
+            if (fwrite(buf, 1, size, file) != size) res = SS_ERR;
+            if (fclose(file) != 0) res = SS_ERR;
+        }
+    }
+
+    SS_FREE(buf);
+    return res;
+}
+
+/**
+ * The `index`-th template in the image, in the order they were written.
+ */
+SS_RESULT ss_image_template(struct ss_image *image, uint32_t index, struct segmented_string **out) {
+    if (index >= image->template_count) return SS_ERR;
+
+    *out = &image->templates[index];
+    return SS_OK;
+}
+
+/**
+ * Frees a loaded image, and unmaps it if it was mapped by `ss_image_map`.
+ * Every clone of its templates has to have been freed first.
+ */
+void ss_image_free(struct ss_image *image) {
+    _ss_image_release(image);
+    if (image->mapped) munmap((void *)image->data, image->size);
+    SS_FREE(image);
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "common.h"
+#include "string_data.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef SS_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+#define SD_INTERN_INITIAL_CAPACITY 64
+
+/**
+ * A set of string_data keyed by content. Interning the same bytes twice gives
+ * back the same instance with its reference count bumped, so repeated
+ * fragments share one allocation, and two interned strings from the same table
+ * are equal exactly when their pointers are.
+ *
+ * The table holds a reference to every entry, so interned strings stay alive
+ * until the table is cleared even if nobody else is using them.
+ *
+ * This is an open addressed hash table with linear probing, kept at most half
+ * full. It is not safe to use from more than one thread at a time; see
+ * `sd_intern_default` for the one table that is.
+ */
+struct sd_intern_table {
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t *hashes;
+    struct string_data **entries;
+};
+
+SS_RESULT sd_intern_table_create(struct sd_intern_table **table) {
+    *table = (struct sd_intern_table *)SS_MALLOC(sizeof(struct sd_intern_table));
+    if (*table == NULL) return SS_ALLOC_ERROR;
+
+    (*table)->count = 0;
+    (*table)->capacity = SD_INTERN_INITIAL_CAPACITY;
+    (*table)->hashes = (uint64_t *)SS_MALLOC(sizeof(uint64_t) * SD_INTERN_INITIAL_CAPACITY);
+    (*table)->entries = (struct string_data **)SS_CALLOC(SD_INTERN_INITIAL_CAPACITY, sizeof(struct string_data *));
+    if ((*table)->hashes == NULL || (*table)->entries == NULL) return SS_ALLOC_ERROR;
+
+    return SS_OK;
+}
+
+/**
+ * Gives up the table's reference to every entry and empties it.
+ */
+void sd_intern_table_clear(struct sd_intern_table *table) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i] != NULL) {
+            table->entries[i]->flags &= ~STRING_INTERNED;
+            sd_release(table->entries[i]);
+            table->entries[i] = NULL;
+        }
+    }
+
+    table->count = 0;
+}
+
+SS_RESULT sd_intern_table_free(struct sd_intern_table *table) {
+    sd_intern_table_clear(table);
+    SS_FREE(table->hashes);
+    SS_FREE(table->entries);
+    SS_FREE(table);
+
+    return SS_OK;
+}
+
+/**
+ * The process wide table used for placeholder names. Created on first use.
+ * Returns NULL only if that creation failed.
+ *
+ * Templates are filled and parsed on any thread, so the library itself only
+ * goes through `sd_intern_shared` and `sd_intern_shared_find`, which in
+ * SS_THREAD_SAFE builds hold a lock around the table. Anything else done to
+ * it, clearing it included, has to happen while no other thread is using it.
+ */
+#ifdef SS_THREAD_SAFE
+pthread_mutex_t _sd_intern_default_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define _SD_INTERN_DEFAULT_LOCK() pthread_mutex_lock(&_sd_intern_default_mutex)
+#define _SD_INTERN_DEFAULT_UNLOCK() pthread_mutex_unlock(&_sd_intern_default_mutex)
+#else
+#define _SD_INTERN_DEFAULT_LOCK() ((void)0)
+#define _SD_INTERN_DEFAULT_UNLOCK() ((void)0)
+#endif
+
+struct sd_intern_table *_sd_intern_default_locked(void) {
+    static struct sd_intern_table *table = NULL;
+
+    if (table == NULL) {
+        if (sd_intern_table_create(&table) != SS_OK) table = NULL;
+    }
+
+    return table;
+}
+
+struct sd_intern_table *sd_intern_default(void) {
+    _SD_INTERN_DEFAULT_LOCK();
+    struct sd_intern_table *table = _sd_intern_default_locked();
+    _SD_INTERN_DEFAULT_UNLOCK();
+
+    return table;
+}
+
+/**
+ * Index of the slot holding `value`, or of the empty slot where it would go.
+ */
+uint32_t _sd_intern_probe(struct sd_intern_table *table, uint64_t hash, const char *value, uint32_t length) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = hash & mask;
+
+    while (table->entries[index] != NULL) {
+        if (table->hashes[index] == hash && sd_is_equal_bytes(table->entries[index], value, length)) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+SS_RESULT _sd_intern_grow(struct sd_intern_table *table) {
+    uint32_t old_capacity = table->capacity;
+    uint64_t *old_hashes = table->hashes;
+    struct string_data **old_entries = table->entries;
+
+    table->capacity *= 2;
+    table->hashes = (uint64_t *)SS_MALLOC(sizeof(uint64_t) * table->capacity);
+    table->entries = (struct string_data **)SS_CALLOC(table->capacity, sizeof(struct string_data *));
+    if (table->hashes == NULL || table->entries == NULL) return SS_ALLOC_ERROR;
+
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i] == NULL) continue;
+
+        uint32_t index = old_hashes[i] & mask;
+        while (table->entries[index] != NULL) index = (index + 1) & mask;
+
+        table->hashes[index] = old_hashes[i];
+        table->entries[index] = old_entries[i];
+    }
+
+    SS_FREE(old_hashes);
+    SS_FREE(old_entries);
+    return SS_OK;
+}
+
+/**
+ * Looks `value` up without adding it. Returns NULL if it has never been
+ * interned. No reference is taken.
+ */
+struct string_data *sd_intern_find(struct sd_intern_table *table, const char *value, uint32_t length) {
+    uint64_t hash = sd_hash_bytes(value, length);
+    return table->entries[_sd_intern_probe(table, hash, value, length)];
+}
+
+/**
+ * Returns the shared instance for these bytes in `*sd`, creating an owned
+ * copy the first time they are seen. Either way the caller gets a reference of
+ * their own and gives it back with `sd_release` as usual.
+ */
+SS_RESULT sd_intern(struct sd_intern_table *table, const char *value, uint32_t length, struct string_data **sd) {
+    uint64_t hash = sd_hash_bytes(value, length);
+    uint32_t index = _sd_intern_probe(table, hash, value, length);
+
+    if (table->entries[index] == NULL) {
+        if ((table->count + 1) * 2 > table->capacity) {
+            SS_RESULT res = _sd_intern_grow(table);
+            if (res != SS_OK) return res;
+            index = _sd_intern_probe(table, hash, value, length);
+        }
+
+        SS_RESULT res = sd_create_copy(value, length, &table->entries[index]);
+        if (res != SS_OK) return res;
+
+        table->entries[index]->flags |= STRING_INTERNED;
+        table->hashes[index] = hash;
+        table->count++;
+    }
+
+    *sd = table->entries[index];
+    sd_retain(*sd);
+
+    return SS_OK;
+}
+
+/**
+ * Same as `sd_intern`, for a string_data we already have. Content is compared
+ * byte for byte, as `sd_intern` does, so the encoding flags don't make two
+ * entries out of the same bytes. If `in` is not in the table yet and owns its
+ * data, `in` itself is what gets stored.
+ */
+SS_RESULT sd_intern_sd(struct sd_intern_table *table, struct string_data *in, struct string_data **sd) {
+    if ((in->flags & STRING_INTERNED) == STRING_INTERNED) {
+        *sd = in;
+        sd_retain(in);
+        return SS_OK;
+    }
+
+    size_t length = sd_length(in);
+    uint64_t hash = sd_hash_bytes(in->data, length);
+    uint32_t index = _sd_intern_probe(table, hash, in->data, length);
+
+    if (table->entries[index] != NULL) {
+        *sd = table->entries[index];
+        sd_retain(*sd);
+        return SS_OK;
+    }
+
+    if ((table->count + 1) * 2 > table->capacity) {
+        SS_RESULT res = _sd_intern_grow(table);
+        if (res != SS_OK) return res;
+        index = _sd_intern_probe(table, hash, in->data, length);
+    }
+
+    /**
+     * We can only keep `in` itself if nothing else decides how long it lives.
+     * Views and arena strings get copied into an entry of our own.
+     */
+    bool keep = (in->flags & (STRING_OWNS_DATA | STRING_EXTERNAL_HEADER)) == STRING_OWNS_DATA;
+    if (keep) {
+        sd_retain(in);
+        table->entries[index] = in;
+    } else {
+        SS_RESULT res = sd_create_copy(in->data, length, &table->entries[index]);
+        if (res != SS_OK) return res;
+        table->entries[index]->flags = (in->flags & (STRING_DATA_ASCII | STRING_DATA_UTF8))
+            | (table->entries[index]->flags & ~STRING_DATA_ASCII);
+    }
+
+    table->entries[index]->flags |= STRING_INTERNED;
+    table->hashes[index] = hash;
+    table->count++;
+
+    /**
+     * The table has its reference; now the caller gets one.
+     */
+    *sd = table->entries[index];
+    sd_retain(*sd);
+    return SS_OK;
+}
+
+/**
+ * `sd_intern` into `sd_intern_default()`, safe to call from any thread.
+ */
+SS_RESULT sd_intern_shared(const char *value, uint32_t length, struct string_data **sd) {
+    SS_RESULT res = SS_ALLOC_ERROR;
+
+    _SD_INTERN_DEFAULT_LOCK();
+    struct sd_intern_table *table = _sd_intern_default_locked();
+    if (table != NULL) res = sd_intern(table, value, length, sd);
+    _SD_INTERN_DEFAULT_UNLOCK();
+
+    return res;
+}
+
+/**
+ * `sd_intern_find` in `sd_intern_default()`, safe to call from any thread.
+ * The entry stays valid until the table is cleared.
+ */
+struct string_data *sd_intern_shared_find(const char *value, uint32_t length) {
+    struct string_data *found = NULL;
+
+    _SD_INTERN_DEFAULT_LOCK();
+    struct sd_intern_table *table = _sd_intern_default_locked();
+    if (table != NULL) found = sd_intern_find(table, value, length);
+    _SD_INTERN_DEFAULT_UNLOCK();
+
+    return found;
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * Static runs shorter than this are copied into the scratch buffer, along
+ * with their neighbours, rather than getting an iovec of their own. Below
+ * this size the kernel spends more on an extra iovec than on copying the
+ * bytes.
+ */
+#define SS_IOV_COALESCE 64
+
+/**
+ * glibc only defines IOV_MAX for _XOPEN_SOURCE; 1024 is what Linux takes.
+ */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/**
+ * How many iovecs `ss_writev` keeps on the stack, and how much scratch.
+ */
+#define SS_IOV_STACK_COUNT 64
+#define SS_IOV_STACK_SCRATCH 4096
+
+/**
+ * Where `ss_render_iov` is up to. Once either array runs out it stops
+ * writing, but keeps counting so that it can say how much it needed.
+ */
+struct _ss_iov_state {
+    struct iovec *iov;
+    size_t iov_capacity;
+    size_t iov_count;
+
+    char *scratch;
+    size_t scratch_capacity;
+    size_t scratch_length;
+
+    /**
+     * Whether the last iovec is the end of the scratch buffer, so that more
+     * small bytes can go on the end of it.
+     */
+    bool open_scratch;
+    bool full;
+};
+
+/**
+ * Adds `data[0, length)`. `borrow` says whether the bytes will still be
+ * there once we return, so that an iovec can point straight at them.
+ */
+void _ss_iov_bytes(struct _ss_iov_state *state, const char *data, size_t length, bool borrow) {
+    if (length == 0) return;
+
+    if (borrow && length >= SS_IOV_COALESCE) {
+        if (state->iov_count >= state->iov_capacity) state->full = true;
+        if (!state->full) {
+            state->iov[state->iov_count].iov_base = (void *)data;
+            state->iov[state->iov_count].iov_len = length;
+        }
+        state->iov_count++;
+        state->open_scratch = false;
+        return;
+    }
+
+    if (!state->open_scratch) {
+        if (state->iov_count >= state->iov_capacity) state->full = true;
+        if (!state->full) {
+            state->iov[state->iov_count].iov_base = state->scratch + state->scratch_length;
+            state->iov[state->iov_count].iov_len = 0;
+        }
+        state->iov_count++;
+        state->open_scratch = true;
+    }
+
+    if (length > state->scratch_capacity - state->scratch_length) state->full = true;
+    if (!state->full) {
+        memcpy(state->scratch + state->scratch_length, data, length);
+        state->iov[state->iov_count - 1].iov_len += length;
+    }
+    state->scratch_length += length;
+}
+
+/**
+ * The pieces are walked directly rather than with `ss_for_each_span`, for
+ * the same reason `ss_render_into` does: a call through a function pointer
+ * per piece costs more than handling a short piece.
+ */
+SS_RESULT _ss_render_iov(struct segmented_string *ss, struct _ss_iov_state *state) {
+    char scratch[SSP_SCRATCH_SIZE];
+    const char *data;
+    size_t length;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        if (ssp->type == STRING_PIECE_TYPE_STATIC) {
+            _ss_iov_bytes(state, ssp->data.static_string->data, ssp->length, true);
+        } else if (ssp->type == STRING_PIECE_TYPE_NESTED) {
+            SS_RESULT res = _ss_render_iov(&ssp->data.nested->ss, state);
+            if (res != SS_OK) return res;
+        } else if (ssp->type == STRING_PIECE_TYPE_PLACEHOLDER_STRING) {
+            struct segmented_string *value = ss->values[ssp->slot].s;
+            if (!_ss_is_renderable(value)) return SS_INVALID_STRING_TYPE;
+
+            SS_RESULT res = _ss_value_enter();
+            if (res != SS_OK) return res;
+
+            res = _ss_render_iov(value, state);
+            _ss_value_leave();
+            if (res != SS_OK) return res;
+        } else {
+            SS_RESULT res = ssp_bytes(ssp, ss->values, scratch, &data, &length);
+            if (res != SS_OK) return res;
+            _ss_iov_bytes(state, data, length, false);
+        }
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Renders this segmented string as a list of iovecs for `writev`, without
+ * copying the bulk of it anywhere. Static data of SS_IOV_COALESCE bytes or
+ * more gets an iovec pointing straight at its string_data. Formatted
+ * placeholders and short static runs are copied into `scratch`, and each
+ * stretch of them between two long runs goes out as a single iovec. Nested
+ * strings and string placeholders are walked into, so the result doesn't
+ * depend on how the string is segmented.
+ *
+ * `*iov_count` and `*scratch_length` are set to what the whole string
+ * needs. If that is more than `iov_capacity` or `scratch_capacity`,
+ * SS_BUFFER_TOO_SMALL is returned and the contents of `iov` and `scratch`
+ * are unspecified, so the caller can size both and call again, as with
+ * `ss_render_into`. On any other error both are 0.
+ *
+ * The iovecs point into this string's data and into `scratch`, and are good
+ * for as long as both are left alone.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_render_iov(struct segmented_string *ss, struct iovec *iov, size_t iov_capacity, char *scratch, size_t scratch_capacity, size_t *iov_count, size_t *scratch_length) {
+    struct _ss_iov_state state;
+    state.iov = iov;
+    state.iov_capacity = iov_capacity;
+    state.iov_count = 0;
+    state.scratch = scratch;
+    state.scratch_capacity = scratch_capacity;
+    state.scratch_length = 0;
+    state.open_scratch = false;
+    state.full = false;
+
+    *iov_count = 0;
+    *scratch_length = 0;
+    if (!_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+
+    SS_RESULT res = _ss_render_iov(ss, &state);
+    if (res != SS_OK) return res;
+
+    *iov_count = state.iov_count;
+    *scratch_length = state.scratch_length;
+    return state.full ? SS_BUFFER_TOO_SMALL : SS_OK;
+}
+
+/**
+ * Writes all of `iov[0, count)` to `fd`, however many calls that takes:
+ * `writev` can stop part way through, and takes at most IOV_MAX iovecs at a
+ * time. Consumes `iov` as it goes.
+ */
+SS_RESULT _ss_writev_all(int fd, struct iovec *iov, size_t count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count < IOV_MAX ? (int)count : IOV_MAX);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return SS_ERR;
+        }
+
+        size_t done = (size_t)n;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Writes this segmented string to the file descriptor `fd` -- a file, pipe or
+ * socket -- with `writev`, by way of `ss_render_iov`. This is the output path
+ * for large strings: unlike `ss_print` nothing goes through stdio, and long
+ * static runs go to the kernel straight from where they are. Short strings
+ * are done with stack buffers; longer ones allocate once. Returns SS_ERR if
+ * a write fails, with `errno` saying why.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_writev(struct segmented_string *ss, int fd) {
+    struct iovec stack_iov[SS_IOV_STACK_COUNT];
+    char stack_scratch[SS_IOV_STACK_SCRATCH];
+    size_t iov_count = 0, scratch_length = 0;
+
+    SS_RESULT res = ss_render_iov(ss, stack_iov, SS_IOV_STACK_COUNT, stack_scratch, SS_IOV_STACK_SCRATCH, &iov_count, &scratch_length);
+    if (res == SS_OK) return _ss_writev_all(fd, stack_iov, iov_count);
+    if (res != SS_BUFFER_TOO_SMALL) return res;
+
+    struct iovec *iov = (struct iovec *)SS_MALLOC(sizeof(struct iovec) * iov_count + scratch_length);
+    if (iov == NULL) return SS_ALLOC_ERROR;
+    char *scratch = (char *)(iov + iov_count);
+
+    res = ss_render_iov(ss, iov, iov_count, scratch, scratch_length, &iov_count, &scratch_length);
+    if (res == SS_OK) res = _ss_writev_all(fd, iov, iov_count);
+
+    SS_FREE(iov);
+    return res;
+}
@@ -1,6 +1,13 @@
 #include "common.h"
 #include "string_data.h"
 #include "segmented_string.h"
+#include "batch.h"
+#include "find.h"
+#include "hash.h"
+#include "image.h"
+#include "iov.h"
+#include "parallel.h"
+#include "parse.h"
 
 #include <assert.h>
 
@@ -49,14 +56,41 @@ int main(int argc, char *argv[]) {
     assert(strncmp(ss->pieces[0].data.static_string->data, "hello world mate", ss->pieces[0].data.static_string->length) == 0);
     assert(ss->pieces[0].data.static_string->ref_count == 1);
 
+
     /**
      * Now more in-depth tests for the placeholder.
      */
     assert(ss->pieces[1].type == STRING_PIECE_TYPE_PLACEHOLDER_UINT8);
-    assert(ss->pieces[1].data.uint8_data.value == 8);
-    assert((ss->pieces[1].data.uint8_data.placeholder->flags & STRING_DATA_ASCII) == STRING_DATA_ASCII);
-    assert(ss->pieces[1].data.uint8_data.placeholder->flags != STRING_CSTRING);
-    assert(strncmp(ss->pieces[1].data.uint8_data.placeholder->data, "test", strlen("test")) == 0);
+    assert(ss->values[ss->pieces[1].slot].u == 8);
+    assert((ss->pieces[1].data.placeholder_data.placeholder->flags & STRING_DATA_ASCII) == STRING_DATA_ASCII);
+    assert(ss->pieces[1].data.placeholder_data.placeholder->flags != STRING_CSTRING);
+    assert(strncmp(ss->pieces[1].data.placeholder_data.placeholder->data, "test", strlen("test")) == 0);
+
+    /**
+     * Short names like this are stored inline in the string_data. Sixteen
+     * bytes is one too many.
+     */
+    assert(sizeof(struct string_data) == 32);
+    assert(sizeof(struct segmented_string_piece) == 16);
+    assert(ss->pieces[0].length == sd_length(ss->pieces[0].data.static_string));
+    assert((ss->pieces[1].data.placeholder_data.placeholder->flags & STRING_INLINE_DATA) == STRING_INLINE_DATA);
+    assert(ss->pieces[1].data.placeholder_data.placeholder->data == ss->pieces[1].data.placeholder_data.placeholder->inline_data);
+    assert((ss->pieces[0].data.static_string->flags & STRING_INLINE_DATA) == 0);
+
+    /**
+     * Render the filled template into a flat buffer. The length should be
+     * exact, and a buffer one byte too small should be refused.
+     */
+    size_t render_length;
+    assert(SS_OK == ss_render_length(ss, &render_length));
+    assert(render_length == strlen("hello world mate8"));
+
+    char render_buf[32];
+    size_t render_written;
+    assert(SS_OK == ss_render_into(ss, render_buf, sizeof(render_buf), &render_written));
+    assert(render_written == render_length);
+    assert(strncmp(render_buf, "hello world mate8", render_written) == 0);
+    assert(SS_BUFFER_TOO_SMALL == ss_render_into(ss, render_buf, render_length - 1, &render_written));
 
     /**
      * Create a completely blank segmented string.
@@ -81,5 +115,1641 @@ int main(int argc, char *argv[]) {
     assert(SS_OK == ss_free(ss));
     assert(SS_OK == ss_free(ss2));
 
+    /**
+     * Anything longer than SD_INLINE_CAPACITY still gets its own buffer.
+     */
+    struct string_data *long_sd;
+    assert(SS_OK == sd_create_copy("this is longer than sixteen bytes", 33, &long_sd));
+    assert((long_sd->flags & STRING_INLINE_DATA) == 0);
+    assert((long_sd->flags & STRING_OWNS_DATA) == STRING_OWNS_DATA);
+    assert(long_sd->data != long_sd->inline_data);
+    assert(strncmp(long_sd->data, "this is longer than sixteen bytes", 33) == 0);
+    assert(SS_OK == sd_release(long_sd));
+
+    /**
+     * Nothing about a string is limited to 255 any more: not the length of a
+     * static copy, not the number of pieces, and not the number of references.
+     */
+    char big[300];
+    memset(big, 'x', sizeof(big));
+
+    struct segmented_string *big_ss;
+    assert(SS_OK == ss_create(&big_ss));
+    assert(SS_OK == ss_append_static_copy(big_ss, big, sizeof(big)));
+    assert(big_ss->pieces[0].data.static_string->length == 300);
+
+    struct segmented_string_piece big_piece = big_ss->pieces[0];
+    for (int i = 0; i < 299; i++) {
+        assert(SS_OK == ss_append_ssp(big_ss, &big_piece));
+    }
+    assert(big_ss->length == 300);
+    assert(big_ss->capacity == 512);
+    assert(big_ss->pieces[0].data.static_string->ref_count == 300);
+    assert(SS_OK == ss_render_length(big_ss, &render_length));
+    assert(render_length == 300 * 300);
+    assert(SS_OK == ss_free(big_ss));
+
+    /**
+     * Compile a template with a repeated placeholder name. Slots are handed
+     * out per distinct name, and the fill state is exact no matter what order
+     * we fill in.
+     */
+    struct segmented_string *tmpl;
+    assert(SS_OK == ss_create(&tmpl));
+    assert(SS_OK == ss_append_placeholder_uint8(tmpl, "a"));
+    assert(SS_OK == ss_append_static_copy_static(tmpl, "-"));
+    assert(SS_OK == ss_append_placeholder_uint8(tmpl, "b"));
+    assert(SS_OK == ss_append_static_copy_static(tmpl, "-"));
+    assert(SS_OK == ss_append_placeholder_uint8(tmpl, "a"));
+
+    uint32_t slot_a, slot_b, slot_unused;
+    assert(SS_NOT_COMPILED == ss_slot_lookup(tmpl, "a", &slot_a));
+    assert(SS_OK == ss_compile(tmpl));
+    assert(tmpl->slots->slot_count == 2);
+    assert(tmpl->unfilled_slots == 2);
+    assert(SS_OK == ss_slot_lookup(tmpl, "a", &slot_a));
+    assert(SS_OK == ss_slot_lookup(tmpl, "b", &slot_b));
+    assert(slot_a != slot_b);
+    assert(SS_UNKNOWN_PLACEHOLDER == ss_slot_lookup(tmpl, "c", &slot_unused));
+
+    struct segmented_string *row;
+    assert(SS_OK == ss_clone(tmpl, &row));
+    assert(row->slots == tmpl->slots);
+    assert(tmpl->slots->ref_count == 2);
+
+    /**
+     * The clone shares its pieces with the template; filling only touches its
+     * own slot values, so it keeps sharing them.
+     */
+    assert(row->pieces == tmpl->pieces);
+    assert(*row->pieces_ref_count == 2);
+
+    assert(SS_OK == ss_fill_slot_uint8(row, slot_b, 2));
+    assert(row->type == PARTIALLY_FILLED_TEMPLATE_STRING);
+    assert(SS_OK == ss_fill_uint8(row, "a", 1));
+    assert(row->type == FULLY_FILLED_TEMPLATE_STRING);
+    assert(tmpl->type == UNFILLED_TEMPLATE_STRING);
+    assert(SS_OK == ss_render_into(row, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "1-2-1", render_written) == 0);
+
+    /**
+     * Refilling a fully filled compiled string is fine.
+     */
+    assert(SS_OK == ss_fill_slot_uint8(row, slot_a, 100));
+    assert(row->type == FULLY_FILLED_TEMPLATE_STRING);
+    assert(SS_OK == ss_render_into(row, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "100-2-100", render_written) == 0);
+    assert(SS_UNKNOWN_PLACEHOLDER == ss_fill_slot_uint8(row, 2, 0));
+    assert(row->pieces == tmpl->pieces);
+
+    /**
+     * Appending is what makes the clone take its own copy of the pieces.
+     */
+    assert(SS_OK == ss_append_static_copy_static(row, "!"));
+    assert(row->pieces != tmpl->pieces);
+    assert(row->pieces_ref_count == NULL);
+    assert(tmpl->length == 5);
+    assert(SS_OK == ss_render_into(row, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "100-2-100!", render_written) == 0);
+
+    assert(SS_OK == ss_free(row));
+    assert(tmpl->slots->ref_count == 1);
+
+    /**
+     * Clones of a frozen template borrow everything from it, so cloning
+     * writes nothing to the template, not even a reference count.
+     */
+    struct segmented_string *frozen;
+    assert(SS_OK == ss_create(&frozen));
+    assert(SS_OK == ss_append_static_copy_static(frozen, "id="));
+    assert(SS_OK == ss_append_placeholder_uint8(frozen, "id"));
+    assert(SS_OK == ss_compile(frozen));
+    assert(SS_OK == ss_freeze(frozen));
+    assert(SS_FROZEN == ss_append_static_copy_static(frozen, "!"));
+    assert(SS_FROZEN == ss_fill_uint8(frozen, "id", 1));
+
+    uint32_t frozen_refs = frozen->pieces[0].data.static_string->ref_count;
+    assert(SS_OK == ss_clone(frozen, &row));
+    assert(row->borrowed);
+    assert(row->pieces == frozen->pieces);
+    assert(frozen->pieces_ref_count == NULL);
+    assert(frozen->slots->ref_count == 1);
+    assert(frozen->pieces[0].data.static_string->ref_count == frozen_refs);
+
+    assert(SS_OK == ss_fill_uint8(row, "id", 42));
+    assert(SS_OK == ss_render_into(row, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "id=42", render_written) == 0);
+
+    /**
+     * Appending to the clone gives it pieces and references of its own. The
+     * slot index is frozen with the template, and stays borrowed.
+     */
+    assert(SS_OK == ss_append_static_copy_static(row, "!"));
+    assert(!row->borrowed);
+    assert(row->pieces != frozen->pieces);
+    assert(row->slots == frozen->slots);
+    assert(frozen->slots->ref_count == 1);
+    assert(SS_OK == ss_render_into(row, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "id=42!", render_written) == 0);
+    assert(SS_OK == ss_free(row));
+    assert(frozen->slots->ref_count == 1);
+    assert(frozen->pieces[0].data.static_string->ref_count == frozen_refs);
+
+    assert(SS_OK == ss_clone(frozen, &row));
+    assert(SS_OK == ss_free(row));
+    assert(SS_OK == ss_free(frozen));
+
+    /**
+     * Freezing reaches data shared with strings that aren't frozen, which
+     * keep working without counting references to it.
+     */
+    struct segmented_string *thawed;
+    assert(SS_OK == ss_create(&thawed));
+    assert(SS_OK == ss_append_static_copy_static(thawed, "shared"));
+    assert(SS_OK == ss_clone(thawed, &frozen));
+    assert(SS_OK == ss_freeze(frozen));
+    assert(!thawed->frozen);
+    assert(sd_is_frozen(thawed->pieces[0].data.static_string));
+    assert(SS_OK == ss_free(frozen));
+    assert(SS_OK == ss_render_into(thawed, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "shared", render_written) == 0);
+    assert(SS_OK == ss_free(thawed));
+
+    /**
+     * Batch render every combination of a few values through the template,
+     * and check each row against the clone / fill / render path.
+     */
+    uint8_t column_a[6] = {0, 9, 10, 99, 100, 255};
+    uint8_t column_b[6] = {255, 100, 99, 10, 9, 0};
+    const uint8_t *columns[2];
+    columns[slot_a] = column_a;
+    columns[slot_b] = column_b;
+
+    size_t batch_length;
+    size_t row_ends[6];
+    assert(SS_BUFFER_TOO_SMALL == ss_render_batch_uint8(tmpl, columns, 6, NULL, 0, NULL, &batch_length));
+
+    char *batch_buf = (char *)malloc(batch_length);
+    size_t batch_written;
+    assert(SS_OK == ss_render_batch_uint8(tmpl, columns, 6, batch_buf, batch_length, row_ends, &batch_written));
+    assert(batch_written == batch_length);
+    assert(row_ends[5] == batch_length);
+
+    for (int r = 0; r < 6; r++) {
+        struct segmented_string *expected;
+        assert(SS_OK == ss_clone(tmpl, &expected));
+        assert(SS_OK == ss_fill_slot_uint8(expected, slot_a, column_a[r]));
+        assert(SS_OK == ss_fill_slot_uint8(expected, slot_b, column_b[r]));
+        assert(SS_OK == ss_render_into(expected, render_buf, sizeof(render_buf), &render_written));
+
+        size_t row_start = r == 0 ? 0 : row_ends[r - 1];
+        assert(row_ends[r] - row_start == render_written);
+        assert(memcmp(batch_buf + row_start, render_buf, render_written) == 0);
+        assert(SS_OK == ss_free(expected));
+    }
+    free(batch_buf);
+
+    /**
+     * A buffer with room to spare is only written up to `*written`, and the
+     * flattened template is kept for the next call until the pieces change.
+     */
+    char spare_buf[64];
+    memset(spare_buf, '#', sizeof(spare_buf));
+    assert(SS_OK == ss_render_batch_uint8(tmpl, columns, 1, spare_buf, sizeof(spare_buf), NULL, &batch_written));
+    assert(batch_written < sizeof(spare_buf) - 4);
+    for (size_t i = batch_written; i < sizeof(spare_buf); i++) assert(spare_buf[i] == '#');
+
+    struct ss_batch_plan *plan = tmpl->cache->batch;
+    assert(plan != NULL);
+    assert(SS_OK == ss_render_batch_uint8(tmpl, columns, 1, spare_buf, sizeof(spare_buf), NULL, &batch_written));
+    assert(tmpl->cache->batch == plan);
+
+    assert(SS_OK == ss_append_static_copy_static(tmpl, ";"));
+    assert(tmpl->cache->batch == NULL);
+    size_t longer_written;
+    assert(SS_OK == ss_render_batch_uint8(tmpl, columns, 1, spare_buf, sizeof(spare_buf), NULL, &longer_written));
+    assert(longer_written == batch_written + 1);
+    assert(spare_buf[longer_written - 1] == ';');
+
+    /**
+     * Appending a placeholder throws the index away.
+     */
+    assert(SS_OK == ss_append_placeholder_uint8(tmpl, "c"));
+    assert(tmpl->slots == NULL);
+    assert(SS_OK == ss_free(tmpl));
+
+    /**
+     * A nested string placeholder's value can change under a template
+     * without its pieces changing, so no plan is kept for that.
+     */
+    struct segmented_string *batch_value, *batch_inner;
+    assert(SS_OK == ss_create(&batch_value));
+    assert(SS_OK == ss_append_static_copy_static(batch_value, "old"));
+    assert(SS_OK == ss_create(&batch_inner));
+    assert(SS_OK == ss_append_placeholder_string(batch_inner, "s"));
+    assert(SS_OK == ss_fill_string(batch_inner, "s", batch_value));
+    assert(SS_OK == ss_parse_cstring("p=$p", &tmpl));
+    assert(SS_OK == ss_concat(tmpl, batch_inner));
+    assert(SS_OK == ss_compile(tmpl));
+
+    uint8_t column_p[1] = {7};
+    const uint8_t *batch_columns[1] = {column_p};
+    assert(SS_OK == ss_render_batch_uint8(tmpl, batch_columns, 1, spare_buf, sizeof(spare_buf), NULL, &batch_written));
+    assert(batch_written == 6 && memcmp(spare_buf, "p=7old", 6) == 0);
+    assert(tmpl->cache == NULL || tmpl->cache->batch == NULL);
+
+    assert(SS_OK == ss_append_static_copy_static(batch_value, "NEW"));
+    assert(SS_OK == ss_render_batch_uint8(tmpl, batch_columns, 1, spare_buf, sizeof(spare_buf), NULL, &batch_written));
+    assert(batch_written == 9 && memcmp(spare_buf, "p=7oldNEW", 9) == 0);
+
+    assert(SS_OK == ss_free(tmpl));
+    free(tmpl);
+    assert(SS_OK == ss_free(batch_inner));
+    free(batch_inner);
+    assert(SS_OK == ss_free(batch_value));
+    free(batch_value);
+
+    /**
+     * More slots than fit in a single word of filled bits.
+     */
+    assert(SS_OK == ss_create(&tmpl));
+    char name[8];
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "p%d", i);
+        assert(SS_OK == ss_append_placeholder_uint8(tmpl, name));
+    }
+    assert(SS_OK == ss_compile(tmpl));
+    assert(tmpl->slots->slot_count == 100);
+    assert(tmpl->slot_count == 100);
+    for (uint32_t i = 0; i < 100; i++) {
+        assert(SS_OK == ss_fill_slot_uint8(tmpl, i, 7));
+        assert(tmpl->type == (i == 99 ? FULLY_FILLED_TEMPLATE_STRING : PARTIALLY_FILLED_TEMPLATE_STRING));
+    }
+    assert(SS_OK == ss_render_length(tmpl, &render_length));
+    assert(render_length == 100);
+    assert(SS_OK == ss_free(tmpl));
+
+    /**
+     * The SIMD scanners have to agree with the scalar ones at every length
+     * and alignment, including the tails.
+     */
+    char scan[100];
+    for (int i = 0; i < 100; i++) scan[i] = (i % 7 == 3) ? ',' : 'a' + (i % 26);
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t n = 0; n + offset <= sizeof(scan); n++) {
+            size_t find = _ss_find_char_scalar(scan + offset, n, ',');
+            size_t count = _ss_count_char_scalar(scan + offset, n, ',');
+            assert(ss_find_char(scan + offset, n, ',') == find);
+            assert(ss_count_char(scan + offset, n, ',') == count);
+#ifdef SS_SIMD_X86
+            assert(_ss_find_char_sse2(scan + offset, n, ',') == find);
+            assert(_ss_count_char_sse2(scan + offset, n, ',') == count);
+            if (ss_simd_level() >= 2) {
+                assert(_ss_find_char_avx2(scan + offset, n, ',') == find);
+                assert(_ss_count_char_avx2(scan + offset, n, ',') == count);
+            }
+#endif
+        }
+    }
+
+    /**
+     * Explode a filled template. Fields inside one static piece are views,
+     * the one that runs into the placeholder has to be copied.
+     */
+    struct segmented_string *csv;
+    assert(SS_OK == ss_create(&csv));
+    assert(SS_OK == ss_append_static_copy_static(csv, "a,b"));
+    assert(SS_OK == ss_append_placeholder_uint8(csv, "n"));
+    assert(SS_OK == ss_append_static_copy_static(csv, ",c,,d"));
+    assert(SS_OK == ss_fill_uint8(csv, "n", 5));
+
+    struct segmented_string *fields;
+    assert(SS_OK == ss_explode_by_char(csv, ',', &fields));
+    assert(fields->type == STRING_LIST);
+    assert(fields->length == 5);
+    assert(fields->views->count == 4);
+
+    const char *expected_fields[] = {"a", "b5", "c", "", "d"};
+    for (uint32_t i = 0; i < fields->length; i++) {
+        struct string_data *field = fields->pieces[i].data.static_string;
+        assert(field->length == strlen(expected_fields[i]));
+        assert(strncmp(field->data, expected_fields[i], field->length) == 0);
+    }
+    assert(fields->pieces[0].data.static_string->data == csv->pieces[0].data.static_string->data);
+    assert((fields->pieces[1].data.static_string->flags & STRING_OWNS_DATA) == STRING_OWNS_DATA);
+
+    /**
+     * A field handed to another string outlives the list it came from.
+     */
+    struct segmented_string *holder;
+    assert(SS_OK == ss_create(&holder));
+    assert(SS_OK == ss_append_ssp(holder, &fields->pieces[4]));
+    assert(holder->pieces[0].data.static_string != fields->pieces[4].data.static_string);
+    assert(SS_OK == ss_free(fields));
+
+    char holder_buf[8];
+    size_t holder_written;
+    assert(SS_OK == ss_render_into(holder, holder_buf, sizeof(holder_buf), &holder_written));
+    assert(holder_written == 1 && holder_buf[0] == 'd');
+    assert(SS_OK == ss_free(holder));
+    assert(SS_OK == ss_free(csv));
+
+    /**
+     * The delimiter can also turn up inside a placeholder's digits.
+     */
+    assert(SS_OK == ss_create(&csv));
+    assert(SS_OK == ss_append_static_copy_static(csv, "x"));
+    assert(SS_OK == ss_append_placeholder_uint8(csv, "n"));
+    assert(SS_OK == ss_fill_uint8(csv, "n", 151));
+    assert(SS_OK == ss_explode_by_char(csv, '5', &fields));
+    assert(fields->length == 2);
+    assert(strncmp(fields->pieces[0].data.static_string->data, "x1", 2) == 0);
+    assert(strncmp(fields->pieces[1].data.static_string->data, "1", 1) == 0);
+    assert(SS_OK == ss_free(fields));
+    assert(SS_OK == ss_free(csv));
+
+    /**
+     * An intern table hands back one shared instance per distinct content,
+     * and keeps working as it grows.
+     */
+    struct sd_intern_table *interns;
+    assert(SS_OK == sd_intern_table_create(&interns));
+
+    struct string_data *first, *second;
+    assert(SS_OK == sd_intern(interns, "frag", 4, &first));
+    assert(SS_OK == sd_intern(interns, "fragment", 4, &second));
+    assert(first == second);
+    assert(first->ref_count == 3);
+    assert((first->flags & STRING_INTERNED) == STRING_INTERNED);
+    assert(sd_intern_find(interns, "frag", 4) == first);
+    assert(sd_intern_find(interns, "fra", 3) == NULL);
+
+    for (int i = 0; i < 200; i++) {
+        struct string_data *many;
+        snprintf(name, sizeof(name), "n%d", i);
+        assert(SS_OK == sd_intern(interns, name, strlen(name), &many));
+        assert(SS_OK == sd_release(many));
+    }
+    assert(interns->count == 201);
+    assert(sd_intern_find(interns, "frag", 4) == first);
+    assert(sd_intern_find(interns, "n150", 4) != NULL);
+
+    /**
+     * Interning an existing string_data matches on content, not on who owns
+     * the bytes.
+     */
+    struct string_data *copy, *shared;
+    assert(SS_OK == sd_create_copy("frag", 4, &copy));
+    assert(sd_matches(copy, first));
+    assert(SS_OK == sd_intern_sd(interns, copy, &shared));
+    assert(shared == first);
+    assert(SS_OK == sd_release(copy));
+    assert(SS_OK == sd_release(shared));
+
+    /**
+     * Both ways in compare the same bytes, whatever the encoding flags say.
+     */
+    assert(SS_OK == sd_create_copy("frag", 4, &copy));
+    copy->flags = (copy->flags & ~STRING_DATA_ASCII) | STRING_DATA_UTF8;
+    assert(SS_OK == sd_intern_sd(interns, copy, &shared));
+    assert(shared == first);
+    assert(SS_OK == sd_release(copy));
+    assert(SS_OK == sd_release(shared));
+    assert(SS_OK == sd_release(second));
+
+    sd_intern_table_clear(interns);
+    assert(interns->count == 0);
+    assert(first->ref_count == 1);
+    assert((first->flags & STRING_INTERNED) == 0);
+    assert(SS_OK == sd_release(first));
+    assert(SS_OK == sd_intern_table_free(interns));
+
+    /**
+     * Placeholder names are interned globally, so separate templates share
+     * them and fills match by pointer. Interned static fragments are shared
+     * too. Prefixes of a name are not the name.
+     */
+    struct segmented_string *left, *right;
+    assert(SS_OK == ss_create(&left));
+    assert(SS_OK == ss_create(&right));
+    assert(SS_OK == ss_append_static_interned(left, "<td>", 4));
+    assert(SS_OK == ss_append_placeholder_uint8(left, "cell"));
+    assert(SS_OK == ss_append_static_interned(right, "<td>", 4));
+    assert(SS_OK == ss_append_placeholder_uint8(right, "cell"));
+    assert(left->type == UNFILLED_TEMPLATE_STRING);
+    assert(left->pieces[0].data.static_string == right->pieces[0].data.static_string);
+    assert(left->pieces[1].data.placeholder_data.placeholder == right->pieces[1].data.placeholder_data.placeholder);
+
+    assert(SS_OK == ss_fill_uint8(left, "cel", 1));
+    assert(left->type == UNFILLED_TEMPLATE_STRING);
+    assert(SS_OK == ss_fill_uint8(left, "cell", 12));
+    assert(left->type == FULLY_FILLED_TEMPLATE_STRING);
+    assert(SS_OK == ss_render_into(left, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "<td>12", render_written) == 0);
+    assert(SS_OK == ss_free(left));
+    assert(SS_OK == ss_free(right));
+
+    /**
+     * Appended placeholders find earlier uses of their name however many
+     * slots there are, including on a parsed string and on a clone, neither
+     * of which has appended anything yet.
+     */
+    struct segmented_string *many_slots, *many_clone;
+    assert(SS_OK == ss_parse_cstring("$p0 $p1", &many_slots));
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 40; i++) {
+            snprintf(name, sizeof(name), "p%d", i);
+            assert(SS_OK == ss_append_placeholder_uint8(many_slots, name));
+        }
+    }
+    assert(many_slots->slot_count == 40);
+    assert(many_slots->pieces[many_slots->length - 1].slot == 39);
+    assert(SS_INVALID_STRING_TYPE == ss_append_placeholder_uint16(many_slots, "p7"));
+    assert(many_slots->slot_count == 40);
+
+    assert(SS_OK == ss_clone(many_slots, &many_clone));
+    assert(many_clone->names == NULL);
+    assert(SS_OK == ss_append_placeholder_uint8(many_clone, "p1"));
+    assert(SS_OK == ss_append_placeholder_uint8(many_clone, "p40"));
+    assert(many_clone->pieces[many_clone->length - 2].slot == 1);
+    assert(many_clone->slot_count == 41);
+    assert(many_slots->slot_count == 40);
+    assert(SS_OK == ss_free(many_clone));
+    assert(SS_OK == ss_free(many_slots));
+
+    /**
+     * Build a template entirely inside an arena, growing past the initial
+     * capacity so that the pieces have to move. Everything goes away with the
+     * reset; no ss_free needed.
+     */
+    struct ss_arena *arena;
+    assert(SS_OK == ss_arena_create(0, &arena));
+
+    struct segmented_string *ss3;
+    assert(SS_OK == ss_create_initialized_arena(arena, STATIC_STRING, 1, &ss3));
+    assert(ss3->arena == arena);
+    assert(SS_OK == ss_append_static_copy_static(ss3, "a"));
+    assert(SS_OK == ss_append_placeholder_uint8(ss3, "x"));
+    assert(SS_OK == ss_append_static_copy_static(ss3, "b"));
+    assert(ss3->type == UNFILLED_TEMPLATE_STRING);
+    assert(ss3->length == 3);
+    assert(ss3->capacity == 8);
+    assert((ss3->pieces[0].data.static_string->flags & STRING_EXTERNAL_HEADER) == STRING_EXTERNAL_HEADER);
+    assert((ss3->pieces[0].data.static_string->flags & STRING_OWNS_DATA) == 0);
+
+    assert(SS_OK == ss_fill_uint8(ss3, "x", 42));
+    assert(SS_OK == ss_render_into(ss3, render_buf, sizeof(render_buf), &render_written));
+    assert(strncmp(render_buf, "a42b", render_written) == 0);
+
+    ss_arena_reset(arena);
+    assert(arena->head->used == 0);
+
+    assert(SS_OK == ss_create_arena(arena, &ss3));
+    assert(ss3->type == EMPTY_STRING);
+    assert(ss3->arena == arena);
+    assert(SS_OK == ss_arena_free(arena));
+
+    /**
+     * Render a few thousand filled clones of a frozen template on four
+     * threads, and check the result against rendering them one at a time.
+     */
+    struct segmented_string *cell;
+    assert(SS_OK == ss_create(&cell));
+    assert(SS_OK == ss_append_static_copy_static(cell, "<td>"));
+    assert(SS_OK == ss_append_placeholder_uint8(cell, "v"));
+    assert(SS_OK == ss_append_static_copy_static(cell, "</td>"));
+    assert(SS_OK == ss_freeze(cell));
+
+    size_t cell_count = 3000;
+    struct segmented_string **cells = (struct segmented_string **)malloc(sizeof(struct segmented_string *) * cell_count);
+    char *expected_buf = (char *)malloc(cell_count * 12);
+    size_t expected_length = 0;
+    for (size_t i = 0; i < cell_count; i++) {
+        assert(SS_OK == ss_clone(cell, &cells[i]));
+        assert(SS_OK == ss_fill_uint8(cells[i], "v", i % 256));
+        assert(SS_OK == ss_render_into(cells[i], expected_buf + expected_length, 12, &render_written));
+        expected_length += render_written;
+    }
+
+    size_t *cell_ends = (size_t *)malloc(sizeof(size_t) * cell_count);
+    size_t parallel_length;
+    assert(SS_BUFFER_TOO_SMALL == ss_render_parallel(cells, cell_count, 4, NULL, 0, NULL, &parallel_length));
+    assert(parallel_length == expected_length);
+
+    char *parallel_buf = (char *)malloc(parallel_length);
+    assert(SS_OK == ss_render_parallel(cells, cell_count, 4, parallel_buf, parallel_length, cell_ends, &parallel_length));
+    assert(parallel_length == expected_length);
+    assert(memcmp(parallel_buf, expected_buf, expected_length) == 0);
+    assert(cell_ends[0] == 10);
+    assert(cell_ends[cell_count - 1] == expected_length);
+
+    /**
+     * The worker threads are kept between calls, and a call that needs fewer
+     * of them than are running leaves the rest parked.
+     */
+    memset(parallel_buf, 0, parallel_length);
+    assert(SS_OK == ss_render_parallel(cells, cell_count, 2, parallel_buf, parallel_length, NULL, &parallel_length));
+    assert(memcmp(parallel_buf, expected_buf, expected_length) == 0);
+    assert(_ss_parallel_shared.started == 3);
+
+    /**
+     * One string that can't be rendered fails the whole call.
+     */
+    assert(SS_OK == ss_clone(cell, &cells[cell_count / 2]));
+    assert(SS_INVALID_STRING_TYPE == ss_render_parallel(cells, cell_count, 4, parallel_buf, parallel_length, NULL, &parallel_length));
+
+    for (size_t i = 0; i < cell_count; i++) {
+        assert(SS_OK == ss_free(cells[i]));
+    }
+    assert(SS_OK == ss_free(cell));
+    free(cells);
+    free(parallel_buf);
+
+    /**
+     * The entries of a list render back to back.
+     */
+    assert(SS_OK == ss_create(&csv));
+    assert(SS_OK == ss_append_static_copy_static(csv, "alpha,beta,,gamma"));
+    assert(SS_OK == ss_explode_by_char(csv, ',', &fields));
+    assert(SS_OK == ss_render_list_parallel(fields, 2, expected_buf, 32, cell_ends, &parallel_length));
+    assert(parallel_length == 14);
+    assert(memcmp(expected_buf, "alphabetagamma", 14) == 0);
+    assert(cell_ends[0] == 5 && cell_ends[1] == 9 && cell_ends[2] == 9 && cell_ends[3] == 14);
+    assert(SS_OK == ss_free(fields));
+    assert(SS_OK == ss_free(csv));
+    free(cell_ends);
+    free(expected_buf);
+
+    /**
+     * Borrowed pieces point at the caller's bytes rather than copying them.
+     * Literals share one frozen header per call site, which nothing ever
+     * releases.
+     */
+    char borrowed_buf[] = "abc";
+    struct segmented_string *lits;
+    assert(SS_OK == ss_create(&lits));
+    assert(SS_OK == ss_append_static_borrow(lits, borrowed_buf, 3));
+    assert(lits->type == STATIC_STRING);
+    assert(lits->pieces[0].data.static_string->data == borrowed_buf);
+    assert((lits->pieces[0].data.static_string->flags & STRING_OWNS_DATA) == 0);
+
+    for (int i = 0; i < 2; i++) {
+        assert(SS_OK == ss_append_static_literal(lits, "<br>"));
+    }
+    assert(lits->length == 3);
+    assert(lits->pieces[1].data.static_string == lits->pieces[2].data.static_string);
+    assert((lits->pieces[1].data.static_string->flags & STRING_FROZEN) == STRING_FROZEN);
+    assert(_sd_load_hash(lits->pieces[1].data.static_string) >> 63);
+    assert(sd_fragment_hash(lits->pieces[1].data.static_string) == sd_poly_hash_bytes(0, "<br>", 4));
+    assert(lits->pieces[1].length == 4);
+
+    assert(SS_OK == ss_render_into(lits, render_buf, sizeof(render_buf), &render_written));
+    assert(render_written == 11);
+    assert(strncmp(render_buf, "abc<br><br>", 11) == 0);
+    assert(SS_OK == ss_free(lits));
+    free(lits);
+
+    /**
+     * Fields exploded from a literal are views that go with their list, not
+     * frozen headers: one appended elsewhere outlives the list.
+     */
+    struct segmented_string *lit_fields, *lit_dst;
+    assert(SS_OK == ss_create(&lits));
+    assert(SS_OK == ss_append_static_literal(lits, "ab,cd"));
+    assert(SS_OK == ss_explode_by_char(lits, ',', &lit_fields));
+    assert(!sd_is_frozen(lit_fields->pieces[0].data.static_string));
+    assert((lit_fields->pieces[0].data.static_string->flags & STRING_INTERNED) == 0);
+    assert(SS_OK == ss_create(&lit_dst));
+    assert(SS_OK == ss_append_ssp(lit_dst, &lit_fields->pieces[0]));
+    assert(SS_OK == ss_free(lit_fields));
+    free(lit_fields);
+    assert(SS_OK == ss_render_into(lit_dst, render_buf, sizeof(render_buf), &render_written));
+    assert(render_written == 2 && strncmp(render_buf, "ab", 2) == 0);
+    assert(SS_OK == ss_free(lit_dst));
+    free(lit_dst);
+    assert(SS_OK == ss_free(lits));
+    free(lits);
+
+    /**
+     * Parse a template out of source text. Static runs point into the
+     * source, repeated names share a slot, `$$` is a `$` and a `$` without a
+     * name after it is just text.
+     */
+    const char *source = "Hi $name, $$5 or $5 for $name_2.$name";
+    struct segmented_string *parsed;
+    assert(SS_OK == ss_parse_cstring(source, &parsed));
+    assert(parsed->type == UNFILLED_TEMPLATE_STRING);
+    assert(parsed->length == 7);
+    assert(parsed->slot_count == 2);
+    assert(parsed->pieces[0].data.static_string->data == source);
+    assert(parsed->pieces[1].slot == parsed->pieces[6].slot);
+    assert(sd_is_equal_bytes(parsed->pieces[4].data.placeholder_data.placeholder, "name_2", 6));
+
+    assert(SS_OK == ss_fill_uint8(parsed, "name", 1));
+    assert(SS_OK == ss_fill_uint8(parsed, "name_2", 2));
+    char parse_buf[64];
+    assert(SS_OK == ss_render_into(parsed, parse_buf, sizeof(parse_buf), &render_written));
+    assert(render_written == 22);
+    assert(strncmp(parse_buf, "Hi 1, $5 or $5 for 2.1", 22) == 0);
+    assert(SS_OK == ss_free(parsed));
+    free(parsed);
+
+    assert(SS_OK == ss_parse_cstring("", &parsed));
+    assert(parsed->type == EMPTY_STRING);
+    assert(SS_OK == ss_free(parsed));
+    free(parsed);
+
+    assert(SS_OK == ss_parse_cstring("no placeholders $", &parsed));
+    assert(parsed->type == STATIC_STRING);
+    assert(parsed->length == 1);
+    assert(SS_OK == ss_free(parsed));
+    free(parsed);
+
+    /**
+     * Concatenation links whole strings in as one nested piece each. The
+     * nested strings are clones, so changing the originals afterwards doesn't
+     * change the page. Explode splits across nested boundaries.
+     */
+    struct segmented_string *page, *header, *line;
+    assert(SS_OK == ss_create(&page));
+    assert(SS_OK == ss_create(&header));
+    assert(SS_OK == ss_append_static_copy_static(header, "<h1>"));
+    assert(SS_OK == ss_append_static_copy_static(header, "Title,"));
+    assert(SS_OK == ss_create(&line));
+    assert(SS_OK == ss_append_static_copy_static(line, "n="));
+    assert(SS_OK == ss_append_placeholder_uint8(line, "n"));
+    assert(SS_INVALID_STRING_TYPE == ss_concat(page, line));
+    assert(SS_OK == ss_fill_uint8(line, "n", 42));
+
+    assert(SS_OK == ss_concat(page, header));
+    assert(page->type == STATIC_STRING);
+    assert(SS_OK == ss_concat(page, line));
+    assert(SS_OK == ss_fill_uint8(line, "n", 7));
+    assert(SS_OK == ss_concat(page, line));
+    assert(SS_OK == ss_append_static_copy_static(header, "</h1>"));
+    assert(page->length == 3);
+    assert(page->depth == 1);
+    assert(page->pieces[0].type == STRING_PIECE_TYPE_NESTED);
+
+    assert(SS_OK == ss_render_length(page, &render_written));
+    assert(render_written == 17);
+    assert(SS_OK == ss_render_into(page, render_buf, sizeof(render_buf), &render_written));
+    assert(render_written == 17);
+    assert(strncmp(render_buf, "<h1>Title,n=42n=7", 17) == 0);
+    assert(SS_BUFFER_TOO_SMALL == ss_render_into(page, render_buf, 12, &render_written));
+
+    assert(SS_OK == ss_explode_by_char(page, ',', &fields));
+    assert(fields->length == 2);
+    assert(fields->pieces[0].data.static_string->length == 9);
+    assert(strncmp(fields->pieces[1].data.static_string->data, "n=42n=7", 7) == 0);
+    assert(SS_OK == ss_free(fields));
+    free(fields);
+
+    /**
+     * Nesting the page in something else, over and over, gets flattened once
+     * it is too deep, and renders the same all the way down.
+     */
+    struct segmented_string *outer = page;
+    for (int i = 0; i < 2 * SS_CONCAT_MAX_DEPTH; i++) {
+        struct segmented_string *wrap;
+        assert(SS_OK == ss_create(&wrap));
+        assert(SS_OK == ss_append_static_copy_static(wrap, "["));
+        assert(SS_OK == ss_concat(wrap, outer));
+        assert(wrap->depth <= SS_CONCAT_MAX_DEPTH);
+        assert(SS_OK == ss_free(outer));
+        free(outer);
+        outer = wrap;
+    }
+
+    char rope_buf[64];
+    assert(SS_OK == ss_render_into(outer, rope_buf, sizeof(rope_buf), &render_written));
+    assert(render_written == SS_CONCAT_MAX_DEPTH * 2 + 17);
+    assert(strncmp(rope_buf + SS_CONCAT_MAX_DEPTH * 2, "<h1>Title,n=42n=7", 17) == 0);
+
+    assert(SS_OK == ss_free(outer));
+    assert(SS_OK == ss_free(header));
+    assert(SS_OK == ss_free(line));
+    free(outer);
+    free(header);
+    free(line);
+
+    /**
+     * Templates written to an image and loaded back render the same, with
+     * runs of static pieces merged into one. Loaded templates are frozen, so
+     * they are cloned to be filled. A damaged image is refused, and an image
+     * saved to a file can be mapped back in.
+     */
+    struct segmented_string *image_templates[2];
+    assert(SS_OK == ss_parse_cstring("Hi $name, $$5 or $5 for $name_2.$name", &image_templates[0]));
+    assert(SS_OK == ss_create(&image_templates[1]));
+    assert(SS_OK == ss_append_static_copy_static(image_templates[1], "static"));
+    assert(SS_OK == ss_append_static_copy_static(image_templates[1], " only"));
+
+    size_t image_size;
+    assert(SS_BUFFER_TOO_SMALL == ss_image_write(image_templates, 2, NULL, 0, &image_size));
+    char *image_buf = malloc(image_size);
+    assert(SS_OK == ss_image_write(image_templates, 2, image_buf, image_size, &image_size));
+
+    struct ss_image *image;
+    struct segmented_string *loaded;
+    assert(SS_OK == ss_image_load(image_buf, image_size, &image));
+    assert(SS_ERR == ss_image_template(image, 2, &loaded));
+    assert(SS_OK == ss_image_template(image, 0, &loaded));
+    assert(loaded->type == UNFILLED_TEMPLATE_STRING);
+    assert(loaded->length == 6);
+    assert(loaded->slot_count == 2);
+    assert(SS_FROZEN == ss_fill_uint8(loaded, "name", 1));
+
+    assert(SS_OK == ss_clone(loaded, &ss));
+    assert(SS_OK == ss_fill_uint8(ss, "name", 1));
+    assert(SS_OK == ss_fill_uint8(ss, "name_2", 2));
+    assert(SS_OK == ss_render_into(ss, parse_buf, sizeof(parse_buf), &render_written));
+    assert(render_written == 22);
+    assert(strncmp(parse_buf, "Hi 1, $5 or $5 for 2.1", 22) == 0);
+    assert(SS_OK == ss_free(ss));
+    free(ss);
+
+    assert(SS_OK == ss_image_template(image, 1, &loaded));
+    assert(loaded->type == STATIC_STRING);
+    assert(loaded->length == 1);
+    assert(SS_OK == ss_render_into(loaded, parse_buf, sizeof(parse_buf), &render_written));
+    assert(render_written == 11);
+    assert(strncmp(parse_buf, "static only", 11) == 0);
+    assert(_sd_load_hash(loaded->pieces[0].data.static_string) >> 63);
+    assert(sd_fragment_hash(loaded->pieces[0].data.static_string) == sd_poly_hash_bytes(0, "static only", 11));
+    ss_image_free(image);
+
+    image_buf[0] = 'X';
+    assert(SS_BAD_IMAGE == ss_image_load(image_buf, image_size, &image));
+    image_buf[0] = 'S';
+    assert(SS_BAD_IMAGE == ss_image_load(image_buf, image_size - 1, &image));
+    struct ss_image_piece *image_pieces = (struct ss_image_piece *)(
+        image_buf + sizeof(struct ss_image_header) + 2 * sizeof(struct ss_image_template)
+    );
+    image_pieces[1].type = 200;
+    assert(SS_BAD_IMAGE == ss_image_load(image_buf, image_size, &image));
+    image_pieces[1].type = STRING_PIECE_TYPE_PLACEHOLDER_UINT8;
+    image_pieces[0].length = 1000;
+    assert(SS_BAD_IMAGE == ss_image_load(image_buf, image_size, &image));
+    free(image_buf);
+
+    char image_path[] = "/tmp/ss-image-XXXXXX";
+    int image_fd = mkstemp(image_path);
+    assert(image_fd >= 0);
+    close(image_fd);
+    assert(SS_OK == ss_image_save(image_path, image_templates, 2));
+    assert(SS_OK == ss_image_map(image_path, &image));
+    assert(image->mapped);
+    assert(SS_OK == ss_image_template(image, 1, &loaded));
+    assert(SS_OK == ss_render_into(loaded, parse_buf, sizeof(parse_buf), &render_written));
+    assert(strncmp(parse_buf, "static only", 11) == 0);
+    ss_image_free(image);
+    unlink(image_path);
+
+    for (int i = 0; i < 2; i++) {
+        assert(SS_OK == ss_free(image_templates[i]));
+        free(image_templates[i]);
+    }
+
+    /**
+     * Rendering to iovecs points long static runs at their data and copies
+     * placeholders and short runs, next to each other, into one scratch
+     * iovec. Writing them to a pipe gives the same bytes as rendering.
+     */
+    char iov_long[100];
+    memset(iov_long, 'L', sizeof(iov_long));
+    assert(SS_OK == ss_create(&ss));
+    assert(SS_OK == ss_append_static_copy_static(ss, "<p>"));
+    assert(SS_OK == ss_append_placeholder_uint8(ss, "n"));
+    assert(SS_OK == ss_append_static_copy_static(ss, "</p>"));
+    assert(SS_OK == ss_append_static_borrow(ss, iov_long, sizeof(iov_long)));
+    assert(SS_OK == ss_append_static_copy_static(ss, "!"));
+    assert(SS_OK == ss_fill_uint8(ss, "n", 200));
+
+    struct iovec iov[4];
+    char iov_scratch[16];
+    size_t iov_count, iov_scratch_length;
+    assert(SS_BUFFER_TOO_SMALL == ss_render_iov(ss, iov, 1, iov_scratch, sizeof(iov_scratch), &iov_count, &iov_scratch_length));
+    assert(iov_count == 3);
+    assert(iov_scratch_length == 11);
+    assert(SS_OK == ss_render_iov(ss, iov, 4, iov_scratch, sizeof(iov_scratch), &iov_count, &iov_scratch_length));
+    assert(iov_count == 3);
+    assert(iov[0].iov_len == 10 && strncmp(iov[0].iov_base, "<p>200</p>", 10) == 0);
+    assert(iov[1].iov_base == iov_long && iov[1].iov_len == 100);
+    assert(iov[2].iov_len == 1 && iov[2].iov_base == iov_scratch + 10);
+
+    int iov_pipe[2];
+    char iov_read[128];
+    assert(pipe(iov_pipe) == 0);
+    assert(SS_OK == ss_writev(ss, iov_pipe[1]));
+    close(iov_pipe[1]);
+    assert(read(iov_pipe[0], iov_read, sizeof(iov_read)) == 111);
+    close(iov_pipe[0]);
+    assert(strncmp(iov_read, "<p>200</p>", 10) == 0);
+    assert(memcmp(iov_read + 10, iov_long, 100) == 0);
+    assert(iov_read[110] == '!');
+    assert(SS_OK == ss_free(ss));
+    free(ss);
+
+    /**
+     * Wider, signed and floating point placeholders. Integer widths are exact
+     * at every power of ten, the extremes format correctly, and doubles come
+     * out as the shortest text that reads back the same. Each slot only takes
+     * fills of its own type, and a name can't be reused with another type.
+     */
+    char number_buf[32];
+    char *number_end;
+    uint64_t power = 1;
+    for (int digits = 1; digits <= 20; digits++) {
+        uint64_t values[2] = { power - 1, power };
+        for (int v = 0; v < 2; v++) {
+            snprintf(number_buf, sizeof(number_buf), "%llu", (unsigned long long)values[v]);
+            assert(_ssp_uint64_width(values[v]) == strlen(number_buf));
+        }
+        if (digits < 20) power *= 10;
+    }
+
+    number_end = _ssp_format_uint64(number_buf, UINT64_MAX);
+    assert(strncmp(number_buf, "18446744073709551615", number_end - number_buf) == 0);
+    number_end = _ssp_format_int64(number_buf, INT64_MIN);
+    assert(strncmp(number_buf, "-9223372036854775808", number_end - number_buf) == 0);
+    assert(_ssp_int64_width(INT64_MIN) == 20);
+    assert(_ssp_int64_width(-1) == 2);
+
+    const double doubles[] = { 0.1, 1.5, -0.0, 1e21, 123456789012345.0, 1e15, 0.1 + 0.2, 5e-324, -2.5e-7, 1.0 / 3.0 };
+    const char *double_texts[] = { "0.1", "1.5", "-0", "1e+21", "123456789012345", "1e+15", "0.30000000000000004", "5e-324", "-2.5e-07", "0.3333333333333333" };
+    for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+        number_end = _ssp_format_double(number_buf, doubles[i]);
+        *number_end = '\0';
+        assert(strcmp(number_buf, double_texts[i]) == 0);
+        assert(_ssp_double_width(doubles[i]) == strlen(double_texts[i]));
+        assert(strtod(number_buf, NULL) == doubles[i]);
+    }
+
+    /**
+     * Every bit pattern reads back as itself.
+     */
+    uint64_t double_bits = 0x243f6a8885a308d3ULL;
+    for (int i = 0; i < 100000; i++) {
+        double_bits ^= double_bits << 13;
+        double_bits ^= double_bits >> 7;
+        double_bits ^= double_bits << 17;
+
+        double random_double;
+        memcpy(&random_double, &double_bits, sizeof(random_double));
+        if (random_double != random_double || random_double - random_double != 0) continue;
+
+        number_end = _ssp_format_double(number_buf, random_double);
+        assert(number_end - number_buf <= SSP_DOUBLE_MAX_WIDTH);
+        *number_end = '\0';
+        assert(strtod(number_buf, NULL) == random_double);
+    }
+
+    struct segmented_string *typed, *inner;
+    assert(SS_OK == ss_create(&inner));
+    assert(SS_OK == ss_append_static_copy_static(inner, "<b>"));
+    assert(SS_OK == ss_append_placeholder_int16(inner, "delta"));
+    assert(SS_OK == ss_append_static_copy_static(inner, "</b>"));
+    assert(SS_OK == ss_fill_int16(inner, "delta", -300));
+
+    assert(SS_OK == ss_create(&typed));
+    assert(SS_OK == ss_append_placeholder_uint64(typed, "id"));
+    assert(SS_OK == ss_append_static_copy_static(typed, " "));
+    assert(SS_OK == ss_append_placeholder_int32(typed, "n"));
+    assert(SS_OK == ss_append_static_copy_static(typed, " "));
+    assert(SS_OK == ss_append_placeholder_double(typed, "x"));
+    assert(SS_OK == ss_append_static_copy_static(typed, " "));
+    assert(SS_OK == ss_append_placeholder_string(typed, "body"));
+    assert(SS_OK == ss_append_placeholder_uint16(typed, "port"));
+    assert(SS_INVALID_STRING_TYPE == ss_append_placeholder_uint8(typed, "id"));
+    assert(typed->length == 8);
+    assert(typed->slot_count == 5);
+
+    assert(SS_INVALID_STRING_TYPE == ss_fill_uint8(typed, "id", 1));
+    assert(SS_OK == ss_fill_uint64(typed, "id", UINT64_MAX));
+    assert(SS_OK == ss_fill_int32(typed, "n", -42));
+    assert(SS_OK == ss_fill_double(typed, "x", 0.25));
+    assert(SS_ERR == ss_fill_string(typed, "body", NULL));
+    assert(SS_OK == ss_fill_string(typed, "body", inner));
+    assert(typed->type == PARTIALLY_FILLED_TEMPLATE_STRING);
+    assert(SS_OK == ss_compile(typed));
+    uint32_t port_slot;
+    assert(SS_OK == ss_slot_lookup(typed, "port", &port_slot));
+    assert(SS_INVALID_STRING_TYPE == ss_fill_slot_uint32(typed, port_slot, 80));
+    assert(SS_ERR == ss_fill_slot_string(typed, port_slot, NULL));
+    assert(SS_OK == ss_fill_slot_uint16(typed, port_slot, 65535));
+    assert(typed->type == FULLY_FILLED_TEMPLATE_STRING);
+
+    const char *typed_text = "18446744073709551615 -42 0.25 <b>-300</b>65535";
+    char typed_buf[64];
+    size_t typed_length;
+    assert(SS_OK == ss_render_length(typed, &typed_length));
+    assert(typed_length == strlen(typed_text));
+    assert(SS_BUFFER_TOO_SMALL == ss_render_into(typed, typed_buf, typed_length - 1, &render_written));
+    assert(SS_OK == ss_render_into(typed, typed_buf, sizeof(typed_buf), &render_written));
+    assert(render_written == typed_length);
+    assert(strncmp(typed_buf, typed_text, typed_length) == 0);
+
+    /**
+     * The other renderers agree.
+     */
+    assert(SS_OK == ss_create(&ss));
+    assert(SS_OK == ss_concat(ss, typed));
+    assert(SS_OK == ss_render_into(ss, typed_buf, sizeof(typed_buf), &render_written));
+    assert(strncmp(typed_buf, typed_text, typed_length) == 0);
+    assert(SS_OK == ss_free(ss));
+    free(ss);
+
+    assert(SS_BUFFER_TOO_SMALL == ss_render_iov(typed, iov, 4, iov_scratch, 0, &iov_count, &iov_scratch_length));
+    assert(iov_scratch_length == typed_length);
+    char typed_scratch[64];
+    assert(SS_OK == ss_render_iov(typed, iov, 4, typed_scratch, sizeof(typed_scratch), &iov_count, &iov_scratch_length));
+    assert(iov_count == 1);
+    assert(strncmp(typed_scratch, typed_text, typed_length) == 0);
+
+    /**
+     * Images keep placeholder types.
+     */
+    assert(SS_BUFFER_TOO_SMALL == ss_image_write(&typed, 1, NULL, 0, &image_size));
+    image_buf = malloc(image_size);
+    assert(SS_OK == ss_image_write(&typed, 1, image_buf, image_size, &image_size));
+    assert(SS_OK == ss_image_load(image_buf, image_size, &image));
+    assert(SS_OK == ss_image_template(image, 0, &loaded));
+    assert(SS_OK == ss_clone(loaded, &ss));
+    assert(SS_INVALID_STRING_TYPE == ss_fill_uint8(ss, "id", 1));
+    assert(SS_OK == ss_fill_uint64(ss, "id", UINT64_MAX));
+    assert(SS_OK == ss_fill_int32(ss, "n", -42));
+    assert(SS_OK == ss_fill_double(ss, "x", 0.25));
+    assert(SS_OK == ss_fill_string(ss, "body", inner));
+    assert(SS_OK == ss_fill_uint16(ss, "port", 65535));
+    assert(SS_OK == ss_render_into(ss, typed_buf, sizeof(typed_buf), &render_written));
+    assert(strncmp(typed_buf, typed_text, typed_length) == 0);
+    assert(SS_OK == ss_free(ss));
+    free(ss);
+    ss_image_free(image);
+    free(image_buf);
+
+    assert(SS_OK == ss_free(typed));
+    free(typed);
+    assert(SS_OK == ss_free(inner));
+    free(inner);
+
+    /**
+     * A string value that leads back to where it started is given up on
+     * rather than followed for ever, however the string is walked.
+     */
+    struct segmented_string *loop, *loop_value;
+    uint64_t loop_hash;
+    struct ss_match loop_match;
+    bool loop_found;
+    assert(SS_OK == ss_create(&loop));
+    assert(SS_OK == ss_append_static_copy_static(loop, "<"));
+    assert(SS_OK == ss_append_placeholder_string(loop, "s"));
+    assert(SS_OK == ss_append_static_copy_static(loop, ">"));
+    assert(SS_OK == ss_create(&loop_value));
+    assert(SS_OK == ss_append_static_copy_static(loop_value, "("));
+    assert(SS_OK == ss_append_placeholder_string(loop_value, "s"));
+    assert(SS_OK == ss_append_static_copy_static(loop_value, ")"));
+    assert(SS_OK == ss_fill_string(loop, "s", loop_value));
+    assert(SS_OK == ss_fill_string(loop_value, "s", loop));
+    assert(SS_ERR == ss_render_length(loop, &render_written));
+    assert(SS_ERR == ss_render_into(loop, typed_buf, sizeof(typed_buf), &render_written));
+    assert(SS_ERR == ss_hash(loop, &loop_hash));
+    assert(SS_ERR == ss_find(loop, "x", 1, &loop_match, &loop_found));
+    assert(SS_ERR == ss_equals(loop, loop, &loop_found));
+    assert(_ss_value_depth == 0);
+
+    assert(SS_OK == ss_create(&ss));
+    assert(SS_OK == ss_append_static_copy_static(ss, "end"));
+    assert(SS_OK == ss_fill_string(loop_value, "s", ss));
+    assert(SS_OK == ss_render_into(loop, typed_buf, sizeof(typed_buf), &render_written));
+    assert(strncmp(typed_buf, "<(end)>", render_written) == 0);
+    assert(SS_OK == ss_free(ss));
+    assert(SS_OK == ss_free(loop_value));
+    assert(SS_OK == ss_free(loop));
+
+    /**
+     * Cached renders match a full render however the widths change, with
+     * repeated names, nested strings and a string placeholder whose value
+     * changes behind the cache's back.
+     */
+    struct segmented_string *cached, *cached_inner, *cached_nested;
+    const char *cached_data;
+    size_t cached_length;
+    char cached_buf[256];
+
+    assert(SS_OK == ss_parse_cstring("[$x]", &cached_inner));
+    assert(SS_OK == ss_fill_uint8(cached_inner, "x", 1));
+    assert(SS_OK == ss_parse_cstring("<$a> and <$b>, $a again", &cached_nested));
+    assert(SS_OK == ss_fill_uint8(cached_nested, "a", 5));
+    assert(SS_OK == ss_fill_uint8(cached_nested, "b", 6));
+
+    assert(SS_OK == ss_parse_cstring("head $a middle $b $a ", &cached));
+    assert(SS_OK == ss_append_placeholder_int64(cached, "n"));
+    assert(SS_OK == ss_append_placeholder_string(cached, "s"));
+    assert(SS_OK == ss_concat(cached, cached_nested));
+    assert(SS_OK == ss_append_static_copy_static(cached, " tail"));
+    assert(SS_INVALID_STRING_TYPE == ss_render_cached(cached, &cached_data, &cached_length));
+
+    assert(SS_OK == ss_fill_uint8(cached, "a", 7));
+    assert(SS_OK == ss_fill_uint8(cached, "b", 200));
+    assert(SS_OK == ss_fill_int64(cached, "n", -1));
+    assert(SS_OK == ss_fill_string(cached, "s", cached_inner));
+    assert(SS_OK == ss_render_cached(cached, &cached_data, &cached_length));
+    assert(cached_length == strlen("head 7 middle 200 7 -1[1]<5> and <6>, 5 again tail"));
+    assert(memcmp(cached_data, "head 7 middle 200 7 -1[1]<5> and <6>, 5 again tail", cached_length) == 0);
+
+    uint64_t cached_state = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 2000; i++) {
+        cached_state ^= cached_state << 13;
+        cached_state ^= cached_state >> 7;
+        cached_state ^= cached_state << 17;
+
+        switch (cached_state % 4) {
+            case 0:
+                assert(SS_OK == ss_fill_uint8(cached, "a", (uint8_t)(cached_state >> 8)));
+                break;
+            case 1:
+                assert(SS_OK == ss_fill_uint8(cached, "b", (uint8_t)(cached_state >> 8)));
+                break;
+            case 2:
+                assert(SS_OK == ss_fill_int64(cached, "n", (int64_t)cached_state >> (cached_state >> 58)));
+                break;
+            case 3:
+                assert(SS_OK == ss_fill_uint8(cached_inner, "x", (uint8_t)(cached_state >> 8)));
+                break;
+        }
+
+        if (i % 3 == 0) continue;
+
+        assert(SS_OK == ss_render_cached(cached, &cached_data, &cached_length));
+        assert(SS_OK == ss_render_into(cached, cached_buf, sizeof(cached_buf), &render_written));
+        assert(cached_length == render_written);
+        assert(memcmp(cached_data, cached_buf, cached_length) == 0);
+    }
+
+    /**
+     * Appending starts again, and a string placeholder that can't be rendered
+     * fails the render without leaving anything stale behind.
+     */
+    assert(SS_OK == ss_append_static_copy_static(cached, "!"));
+    assert(SS_OK == ss_render_cached(cached, &cached_data, &cached_length));
+    assert(SS_OK == ss_render_into(cached, cached_buf, sizeof(cached_buf), &render_written));
+    assert(cached_length == render_written && cached_data[cached_length - 1] == '!');
+    assert(memcmp(cached_data, cached_buf, cached_length) == 0);
+
+    assert(SS_OK == ss_append_placeholder_uint8(cached_inner, "y"));
+    assert(SS_INVALID_STRING_TYPE == ss_render_cached(cached, &cached_data, &cached_length));
+    assert(SS_OK == ss_fill_uint8(cached_inner, "y", 9));
+    assert(SS_OK == ss_render_cached(cached, &cached_data, &cached_length));
+    assert(SS_OK == ss_render_into(cached, cached_buf, sizeof(cached_buf), &render_written));
+    assert(cached_length == render_written);
+    assert(memcmp(cached_data, cached_buf, cached_length) == 0);
+
+    assert(SS_OK == ss_freeze(cached_nested));
+    assert(SS_FROZEN == ss_render_cached(cached_nested, &cached_data, &cached_length));
+
+    /**
+     * An empty rendering is still a buffer.
+     */
+    struct segmented_string *cached_empty;
+    assert(SS_OK == ss_create(&cached_empty));
+    assert(SS_OK == ss_render_cached(cached_empty, &cached_data, &cached_length));
+    assert(cached_data != NULL && cached_length == 0);
+    assert(SS_OK == ss_append_static_copy_static(cached_empty, ""));
+    assert(SS_OK == ss_render_cached(cached_empty, &cached_data, &cached_length));
+    assert(cached_data != NULL && cached_length == 0);
+    assert(SS_OK == ss_free(cached_empty));
+    free(cached_empty);
+
+    assert(SS_OK == ss_free(cached));
+    free(cached);
+    assert(SS_OK == ss_free(cached_nested));
+    free(cached_nested);
+    assert(SS_OK == ss_free(cached_inner));
+    free(cached_inner);
+
+    /**
+     * Hashing and equality only see the rendered bytes: a long text split at
+     * every possible point, once with a placeholder standing in for "42" and
+     * once nested, hashes and compares the same as the text in one piece.
+     */
+    const char *hash_text = "The quick brown fox jumps over the lazy dog 42 times, then sleeps. Zzz.";
+    size_t hash_length = strlen(hash_text);
+    size_t hash_at = strstr(hash_text, "42") - hash_text;
+    struct segmented_string *hash_whole, *hash_split, *hash_nested;
+    uint64_t whole_hash, split_hash;
+    bool equal;
+
+    assert(SS_OK == ss_create(&hash_whole));
+    assert(SS_OK == ss_append_static_copy(hash_whole, hash_text, hash_length));
+    assert(SS_OK == ss_hash(hash_whole, &whole_hash));
+    assert(whole_hash == ss_hash_bytes(hash_text, hash_length));
+    assert(_sd_load_hash(hash_whole->pieces[0].data.static_string) >> 63);
+    assert(SS_OK == ss_hash(hash_whole, &split_hash));
+    assert(split_hash == whole_hash);
+
+    for (size_t cut = 0; cut <= hash_length; cut++) {
+        assert(SS_OK == ss_create(&hash_split));
+        assert(SS_OK == ss_append_static_copy(hash_split, hash_text, cut));
+        assert(SS_OK == ss_append_static_copy(hash_split, hash_text + cut, hash_length - cut));
+        assert(SS_OK == ss_hash(hash_split, &split_hash));
+        assert(split_hash == whole_hash);
+        assert(SS_OK == ss_equals(hash_whole, hash_split, &equal) && equal);
+        assert(SS_OK == ss_equals(hash_split, hash_whole, &equal) && equal);
+
+        assert(SS_OK == ss_create(&hash_nested));
+        assert(SS_OK == ss_append_static_borrow(hash_nested, hash_text, cut < hash_at ? cut : hash_at));
+        if (cut < hash_at) {
+            assert(SS_OK == ss_append_static_borrow(hash_nested, hash_text + cut, hash_at - cut));
+        }
+        assert(SS_OK == ss_append_placeholder_uint8(hash_nested, "n"));
+        assert(SS_OK == ss_fill_uint8(hash_nested, "n", 42));
+        assert(SS_OK == ss_concat(hash_nested, hash_split));
+        assert(SS_OK == ss_hash(hash_nested, &split_hash));
+        assert(split_hash != whole_hash);
+        assert(SS_OK == ss_equals(hash_nested, hash_whole, &equal) && !equal);
+
+        assert(SS_OK == ss_free(hash_split));
+        free(hash_split);
+        assert(SS_OK == ss_create(&hash_split));
+        assert(SS_OK == ss_append_static_borrow(hash_split, hash_text + hash_at + 2, hash_length - hash_at - 2));
+        assert(SS_OK == ss_free(hash_nested));
+        free(hash_nested);
+
+        assert(SS_OK == ss_create(&hash_nested));
+        assert(SS_OK == ss_append_static_borrow(hash_nested, hash_text, cut < hash_at ? cut : hash_at));
+        if (cut < hash_at) {
+            assert(SS_OK == ss_append_static_borrow(hash_nested, hash_text + cut, hash_at - cut));
+        }
+        assert(SS_OK == ss_append_placeholder_uint8(hash_nested, "n"));
+        assert(SS_OK == ss_fill_uint8(hash_nested, "n", 42));
+        assert(SS_OK == ss_concat(hash_nested, hash_split));
+        assert(SS_OK == ss_hash(hash_nested, &split_hash));
+        assert(split_hash == whole_hash);
+        assert(SS_OK == ss_equals(hash_nested, hash_whole, &equal) && equal);
+        assert(SS_OK == ss_equals(hash_whole, hash_nested, &equal) && equal);
+
+        assert(SS_OK == ss_fill_uint8(hash_nested, "n", 43));
+        assert(SS_OK == ss_hash(hash_nested, &split_hash));
+        assert(split_hash != whole_hash);
+        assert(SS_OK == ss_equals(hash_whole, hash_nested, &equal) && !equal);
+
+        assert(SS_OK == ss_free(hash_nested));
+        free(hash_nested);
+        assert(SS_OK == ss_free(hash_split));
+        free(hash_split);
+    }
+
+    /**
+     * Leading zero bytes count, different lengths are never equal, frozen
+     * strings hash the same, and unfilled templates can't be hashed.
+     */
+    assert(ss_hash_bytes("\0a", 2) != ss_hash_bytes("a", 1));
+    assert(ss_hash_bytes("", 0) != ss_hash_bytes("\0", 1));
+
+    assert(SS_OK == ss_create(&hash_split));
+    assert(SS_OK == ss_append_static_copy(hash_split, hash_text, hash_length - 1));
+    assert(SS_OK == ss_equals(hash_whole, hash_split, &equal) && !equal);
+    assert(SS_OK == ss_free(hash_split));
+    free(hash_split);
+
+    assert(SS_OK == ss_create(&hash_split));
+    assert(SS_OK == ss_append_static_copy(hash_split, hash_text, hash_length));
+    assert(SS_OK == ss_freeze(hash_split));
+    assert(SS_OK == ss_hash(hash_split, &split_hash));
+    assert(split_hash == whole_hash);
+    assert(SS_OK == ss_clone(hash_split, &hash_nested));
+    assert(SS_OK == ss_hash(hash_nested, &split_hash));
+    assert(split_hash == whole_hash);
+    assert(SS_OK == ss_free(hash_nested));
+    free(hash_nested);
+
+    assert(SS_OK == ss_create(&hash_nested));
+    assert(SS_OK == ss_append_placeholder_uint8(hash_nested, "n"));
+    assert(SS_INVALID_STRING_TYPE == ss_hash(hash_nested, &split_hash));
+    assert(SS_INVALID_STRING_TYPE == ss_equals(hash_nested, hash_whole, &equal));
+    assert(SS_OK == ss_free(hash_nested));
+    free(hash_nested);
+
+    assert(SS_OK == ss_free(hash_whole));
+    free(hash_whole);
+
+    /**
+     * ss_find_bytes agrees with a naive search at every alignment, so every
+     * vector width and tail is covered.
+     */
+    char find_text[200];
+    for (size_t i = 0; i < sizeof(find_text); i++) find_text[i] = "ab"[(i * 7 + i / 5) % 3 == 0];
+    for (size_t length = 0; length <= sizeof(find_text); length += 7) {
+        for (size_t needle_length = 1; needle_length <= 9; needle_length++) {
+            for (size_t at = 0; at + needle_length <= sizeof(find_text); at += 13) {
+                size_t expected = length;
+                for (size_t i = 0; i + needle_length <= length; i++) {
+                    if (memcmp(find_text + i, find_text + at, needle_length) == 0) {
+                        expected = i;
+                        break;
+                    }
+                }
+                assert(ss_find_bytes(find_text, length, find_text + at, needle_length) == expected);
+            }
+        }
+    }
+    assert(ss_find_bytes("abc", 3, "", 0) == 0);
+    assert(ss_find_bytes("abc", 3, "abcd", 4) == 3);
+
+    /**
+     * Searching a segmented string finds what searching its rendering does,
+     * matches straddling pieces included, with the right piece and offset.
+     * The strings are random runs of a, b and placeholders (rendering as
+     * digits), partly nested.
+     */
+    uint64_t find_state = 0x2545f4914f6cdd1dULL;
+    struct ss_match find_matches[256];
+    size_t find_piece_starts[64];
+    char find_flat[1024];
+
+    for (int round = 0; round < 300; round++) {
+        struct segmented_string *find_ss, *find_inner;
+        assert(SS_OK == ss_create(&find_ss));
+        assert(SS_OK == ss_create(&find_inner));
+
+        for (int part = 0; part < 2; part++) {
+            struct segmented_string *target = part == 0 ? find_inner : find_ss;
+            int pieces = 1 + (int)(find_state % 12);
+
+            for (int i = 0; i < pieces; i++) {
+                find_state ^= find_state << 13;
+                find_state ^= find_state >> 7;
+                find_state ^= find_state << 17;
+
+                if (find_state % 4 == 0) {
+                    char name[16];
+                    snprintf(name, sizeof(name), "p%d", i);
+                    assert(SS_OK == ss_append_placeholder_uint8(target, name));
+                    assert(SS_OK == ss_fill_uint8(target, name, (uint8_t)(find_state >> 8) % 12));
+                } else if (i == 0 && round % 2 == 1) {
+                    /**
+                     * Long enough to be searched where it lies.
+                     */
+                    char run[320];
+                    size_t run_length = 256 + (find_state >> 8) % 64;
+                    uint64_t run_state = find_state;
+                    for (size_t j = 0; j < run_length; j++) {
+                        run_state ^= run_state << 13;
+                        run_state ^= run_state >> 7;
+                        run_state ^= run_state << 17;
+                        run[j] = "ab1"[run_state % 3];
+                    }
+                    assert(SS_OK == ss_append_static_copy(target, run, run_length));
+                } else {
+                    char run[12];
+                    size_t run_length = (find_state >> 8) % sizeof(run);
+                    for (size_t j = 0; j < run_length; j++) run[j] = "ab1"[(find_state >> (16 + j * 2)) % 3];
+                    assert(SS_OK == ss_append_static_copy(target, run, run_length));
+                }
+
+                if (part == 1 && i == pieces / 2 && find_inner->length > 0) {
+                    assert(SS_OK == ss_concat(target, find_inner));
+                }
+            }
+        }
+
+        size_t flat_length = 0;
+        for (uint32_t i = 0; i < find_ss->length; i++) {
+            size_t piece_length;
+            assert(SS_OK == ssp_render_length(&find_ss->pieces[i], find_ss->values, &piece_length));
+            find_piece_starts[i] = flat_length;
+            flat_length += piece_length;
+        }
+        assert(SS_OK == ss_render_into(find_ss, find_flat, sizeof(find_flat), &flat_length));
+
+        for (size_t needle_length = 1; needle_length <= 6; needle_length++) {
+            const char *needle = needle_length <= 3 ? (const char *)"ab1" + 3 - needle_length : (const char *)"b1ab1a";
+
+            size_t expected = 0;
+            size_t count;
+            SS_RESULT res = ss_find_all(find_ss, needle, needle_length, find_matches, 256, &count);
+            assert(res == SS_OK);
+
+            for (size_t i = 0; i + needle_length <= flat_length; i++) {
+                if (memcmp(find_flat + i, needle, needle_length) != 0) continue;
+
+                assert(expected < count);
+                assert(find_matches[expected].position == i);
+                assert(find_piece_starts[find_matches[expected].piece] + find_matches[expected].offset == i);
+                assert(find_matches[expected].piece + 1 == find_ss->length
+                    || find_piece_starts[find_matches[expected].piece + 1] > i);
+                expected++;
+                i += needle_length - 1;
+            }
+            assert(count == expected);
+
+            struct ss_match first;
+            bool found;
+            assert(SS_OK == ss_find(find_ss, needle, needle_length, &first, &found));
+            assert(found == (count > 0));
+            if (found) {
+                assert(first.position == find_matches[0].position);
+                assert(first.piece == find_matches[0].piece);
+                assert(first.offset == find_matches[0].offset);
+            }
+
+            if (count > 1) {
+                assert(SS_BUFFER_TOO_SMALL == ss_find_all(find_ss, needle, needle_length, find_matches, 1, &count));
+                assert(count == expected);
+            }
+        }
+
+        /**
+         * Needles longer than the stack buffer, and than a span searched where
+         * it lies, straddling at least one piece.
+         */
+        for (size_t needle_length = 75; needle_length <= 300; needle_length += 225) {
+            if (flat_length < needle_length + 5) continue;
+
+            size_t count;
+            assert(SS_OK == ss_find_all(find_ss, find_flat + 5, needle_length, find_matches, 256, &count));
+            assert(count >= 1);
+            assert(find_matches[0].position <= 5);
+            assert(memcmp(find_flat + find_matches[0].position, find_flat + 5, needle_length) == 0);
+        }
+
+        assert(SS_OK == ss_free(find_ss));
+        free(find_ss);
+        assert(SS_OK == ss_free(find_inner));
+        free(find_inner);
+    }
+
+    bool find_found;
+    struct ss_match find_match;
+    assert(SS_OK == ss_create(&ss));
+    assert(SS_ERR == ss_find(ss, "", 0, &find_match, &find_found));
+    assert(SS_OK == ss_find(ss, "x", 1, &find_match, &find_found) && !find_found);
+    assert(SS_OK == ss_append_placeholder_uint8(ss, "n"));
+    assert(SS_INVALID_STRING_TYPE == ss_find(ss, "x", 1, &find_match, &find_found));
+    assert(SS_OK == ss_free(ss));
+    free(ss);
+
+    /**
+     * Compacting merges static runs and the nested strings in them but keeps
+     * placeholders, which can still be filled. Baking the values in leaves
+     * one static piece. Neither changes what the string renders to.
+     */
+    char compact_before[64], compact_after[64];
+    size_t compact_before_length, compact_after_length;
+
+    struct segmented_string *compact_inner, *compact_ss, *compact_clone;
+    assert(SS_OK == ss_create(&compact_inner));
+    assert(SS_OK == ss_append_static_copy_static(compact_inner, "["));
+    assert(SS_OK == ss_append_placeholder_uint8(compact_inner, "k"));
+    assert(SS_OK == ss_append_static_copy_static(compact_inner, "]"));
+    assert(SS_OK == ss_fill_uint8(compact_inner, "k", 9));
+
+    assert(SS_OK == ss_create(&compact_ss));
+    assert(SS_OK == ss_append_static_copy_static(compact_ss, "a"));
+    assert(SS_OK == ss_append_static_copy(compact_ss, "", 0));
+    assert(SS_OK == ss_append_static_literal(compact_ss, "bc"));
+    assert(SS_OK == ss_append_placeholder_uint16(compact_ss, "x"));
+    assert(SS_OK == ss_append_static_copy_static(compact_ss, "d"));
+    assert(SS_OK == ss_concat(compact_ss, compact_inner));
+    assert(SS_OK == ss_append_static_borrow(compact_ss, "e", 1));
+    assert(SS_OK == ss_append_placeholder_string(compact_ss, "s"));
+    assert(SS_OK == ss_append_static_copy_static(compact_ss, "f"));
+    assert(SS_OK == ss_append_placeholder_uint16(compact_ss, "x"));
+    assert(SS_OK == ss_fill_uint16(compact_ss, "x", 300));
+    assert(SS_OK == ss_fill_string(compact_ss, "s", compact_inner));
+    assert(compact_ss->length == 10);
+    assert(compact_ss->depth == 1);
+    assert(SS_OK == ss_compile(compact_ss));
+
+    assert(SS_OK == ss_clone(compact_ss, &compact_clone));
+    assert(SS_OK == ss_render_into(compact_ss, compact_before, sizeof(compact_before), &compact_before_length));
+    assert(compact_before_length == 18);
+    assert(memcmp(compact_before, "abc300d[9]e[9]f300", compact_before_length) == 0);
+
+    assert(SS_OK == ss_compact(compact_ss));
+    assert(compact_ss->length == 6);
+    assert(compact_ss->depth == 0);
+    assert(compact_ss->type == FULLY_FILLED_TEMPLATE_STRING);
+    assert(compact_ss->pieces[0].length == 3);
+    assert(compact_ss->pieces[2].length == 5);
+    assert(compact_ss->pieces[3].type == STRING_PIECE_TYPE_PLACEHOLDER_STRING);
+    assert(SS_OK == ss_render_into(compact_ss, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(compact_after_length == compact_before_length);
+    assert(memcmp(compact_after, compact_before, compact_after_length) == 0);
+
+    /**
+     * The clone still has the pieces they shared. Both can still be filled,
+     * by name through the compiled index, and the string placeholder still
+     * follows its value.
+     */
+    assert(compact_clone->length == 10);
+    assert(SS_OK == ss_render_into(compact_clone, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(memcmp(compact_after, compact_before, compact_after_length) == 0);
+
+    assert(SS_OK == ss_fill_uint16(compact_ss, "x", 7));
+    assert(SS_OK == ss_fill_uint8(compact_inner, "k", 42));
+    assert(SS_OK == ss_render_into(compact_ss, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(compact_after_length == 15);
+    assert(memcmp(compact_after, "abc7d[9]e[42]f7", compact_after_length) == 0);
+
+    assert(SS_OK == ss_compact(compact_ss));
+    assert(compact_ss->length == 6);
+
+    assert(SS_OK == ss_compact_values(compact_ss));
+    assert(compact_ss->type == STATIC_STRING);
+    assert(compact_ss->length == 1);
+    assert(compact_ss->slot_count == 0);
+    assert(SS_OK == ss_render_into(compact_ss, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(memcmp(compact_after, "abc7d[9]e[42]f7", compact_after_length) == 0);
+    assert(SS_INVALID_STRING_TYPE == ss_fill_uint16(compact_ss, "x", 1));
+    assert(SS_OK == ss_free(compact_ss));
+    free(compact_ss);
+
+    /**
+     * Only a fully filled template can have its values baked in.
+     */
+    assert(SS_OK == ss_create(&compact_ss));
+    assert(SS_OK == ss_append_placeholder_uint8(compact_ss, "y"));
+    assert(SS_INVALID_STRING_TYPE == ss_compact_values(compact_ss));
+    assert(SS_OK == ss_compact(compact_ss));
+    assert(compact_ss->length == 1);
+    assert(SS_OK == ss_free(compact_ss));
+    free(compact_ss);
+
+    assert(SS_OK == ss_free(compact_clone));
+    free(compact_clone);
+    assert(SS_OK == ss_free(compact_inner));
+    free(compact_inner);
+
+    /**
+     * Pieces that render to nothing go; a static string of nothing but them
+     * is empty afterwards.
+     */
+    assert(SS_OK == ss_create(&compact_ss));
+    assert(SS_OK == ss_append_static_copy(compact_ss, "", 0));
+    assert(SS_OK == ss_append_static_copy(compact_ss, "", 0));
+    assert(SS_OK == ss_compact(compact_ss));
+    assert(compact_ss->type == EMPTY_STRING);
+    assert(compact_ss->length == 0);
+    assert(SS_OK == ss_append_static_copy_static(compact_ss, "g"));
+    assert(compact_ss->type == STATIC_STRING);
+    assert(SS_OK == ss_free(compact_ss));
+    free(compact_ss);
+
+    /**
+     * In an arena, the new pieces come out of the arena too.
+     */
+    assert(SS_OK == ss_arena_create(0, &arena));
+    assert(SS_OK == ss_create_arena(arena, &compact_ss));
+    for (int i = 0; i < 20; i++) {
+        assert(SS_OK == ss_append_static_copy_static(compact_ss, i % 2 == 0 ? "ab" : "c"));
+    }
+    assert(SS_OK == ss_compact(compact_ss));
+    assert(compact_ss->length == 1);
+    assert(compact_ss->pieces[0].length == 30);
+    assert((compact_ss->pieces[0].data.static_string->flags & STRING_EXTERNAL_HEADER) == STRING_EXTERNAL_HEADER);
+    assert(SS_OK == ss_render_into(compact_ss, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(memcmp(compact_after, "abcabcabcabcabcabcabcabcabcabc", compact_after_length) == 0);
+    assert(SS_OK == ss_arena_free(arena));
+
+    /**
+     * The automatic policy only takes on strings of many short pieces, and
+     * not frozen ones, lists or templates with holes.
+     */
+    bool compacted;
+    assert(SS_OK == ss_create(&compact_ss));
+    for (int i = 0; i < SS_COMPACT_MIN_PIECES - 1; i++) {
+        assert(SS_OK == ss_append_static_copy_static(compact_ss, "h"));
+    }
+    assert(SS_OK == ss_compact_auto(compact_ss, &compacted) && !compacted);
+    assert(SS_OK == ss_append_placeholder_int8(compact_ss, "z"));
+    assert(SS_OK == ss_compact_auto(compact_ss, &compacted) && !compacted);
+    assert(SS_OK == ss_fill_int8(compact_ss, "z", -5));
+    assert(SS_OK == ss_compact_auto(compact_ss, &compacted) && compacted);
+    assert(compact_ss->type == STATIC_STRING);
+    assert(compact_ss->length == 1);
+    assert(SS_OK == ss_render_into(compact_ss, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(compact_after_length == 9 && memcmp(compact_after, "hhhhhhh-5", 9) == 0);
+    assert(SS_OK == ss_free(compact_ss));
+    free(compact_ss);
+
+    char compact_long[SS_COMPACT_MAX_AVERAGE];
+    memset(compact_long, 'l', sizeof(compact_long));
+    assert(SS_OK == ss_create(&compact_ss));
+    for (int i = 0; i < SS_COMPACT_MIN_PIECES; i++) {
+        assert(SS_OK == ss_append_static_copy(compact_ss, compact_long, sizeof(compact_long)));
+    }
+    assert(SS_OK == ss_compact_auto(compact_ss, &compacted) && !compacted);
+    assert(SS_OK == ss_freeze(compact_ss));
+    assert(SS_FROZEN == ss_compact(compact_ss));
+    assert(SS_FROZEN == ss_compact_auto(compact_ss, &compacted));
+
+    /**
+     * A clone of a frozen string has pieces of its own afterwards, and the
+     * frozen string keeps its.
+     */
+    assert(SS_OK == ss_clone(compact_ss, &compact_clone));
+    assert(compact_clone->borrowed);
+    assert(SS_OK == ss_compact(compact_clone));
+    assert(!compact_clone->borrowed);
+    assert(compact_clone->length == 1);
+    assert(compact_clone->pieces[0].length == SS_COMPACT_MIN_PIECES * SS_COMPACT_MAX_AVERAGE);
+    assert(compact_ss->length == SS_COMPACT_MIN_PIECES);
+    assert(SS_OK == ss_free(compact_clone));
+    free(compact_clone);
+
+    /**
+     * Nor does compacting or appending to one touch the reference counts of
+     * the frozen template's slot index, and neither do clones of it.
+     */
+    struct segmented_string *compact_template, *compact_copy;
+    assert(SS_OK == ss_parse_cstring("<a>$x<b>$y<c>", &compact_template));
+    assert(SS_OK == ss_append_static_copy_static(compact_template, "<d>"));
+    assert(SS_OK == ss_compile(compact_template));
+    assert(SS_OK == ss_freeze(compact_template));
+    uint32_t compact_refs = compact_template->slots->ref_count;
+
+    assert(SS_OK == ss_clone(compact_template, &compact_clone));
+    assert(SS_OK == ss_compact(compact_clone));
+    assert(!compact_clone->borrowed && compact_clone->slots == compact_template->slots);
+    assert(SS_OK == ss_clone(compact_clone, &compact_copy));
+    assert(SS_OK == ss_fill_slot_uint8(compact_copy, 0, 1));
+    assert(SS_OK == ss_fill_slot_uint8(compact_copy, 1, 2));
+    assert(SS_OK == ss_render_into(compact_copy, compact_after, sizeof(compact_after), &compact_after_length));
+    assert(compact_after_length == 14 && memcmp(compact_after, "<a>1<b>2<c><d>", 14) == 0);
+    assert(SS_OK == ss_free(compact_copy));
+    free(compact_copy);
+    assert(SS_OK == ss_free(compact_clone));
+    free(compact_clone);
+
+    assert(SS_OK == ss_clone(compact_template, &compact_clone));
+    assert(SS_OK == ss_append_static_copy_static(compact_clone, "<e>"));
+    assert(!compact_clone->borrowed);
+    assert(SS_OK == ss_free(compact_clone));
+    free(compact_clone);
+    assert(compact_template->slots->ref_count == compact_refs);
+
+    assert(SS_OK == ss_create(&csv));
+    assert(SS_OK == ss_append_static_copy_static(csv, "a,b"));
+    assert(SS_OK == ss_explode_by_char(csv, ',', &fields));
+    assert(SS_INVALID_STRING_TYPE == ss_compact(fields));
+    assert(SS_OK == ss_compact_auto(fields, &compacted) && !compacted);
+    assert(SS_OK == ss_free(fields));
+    free(fields);
+    assert(SS_OK == ss_free(csv));
+    free(csv);
+
+#ifdef SS_ENABLE_STATS
+    /**
+     * A view made with sd_create_from gives its header back like any other
+     * string_data. Clones and piece array growth are counted.
+     */
+    struct ss_stats stats;
+    ss_stats_reset();
+
+    struct string_data *whole, *part;
+    assert(SS_OK == sd_create_copy("hello world", 11, &whole));
+    assert(SS_OK == sd_create_from(whole, 6, 11, &part));
+    assert(SS_OK == sd_release(part));
+    assert(SS_OK == sd_release(whole));
+
+    ss_stats_snapshot(&stats);
+    assert(stats.sd_creates == 2);
+    assert(stats.sd_releases == 2);
+    assert(stats.sd_frees == 2);
+    assert(stats.mallocs == 2);
+    assert(stats.frees == 2);
+
+    ss_stats_reset();
+    assert(SS_OK == ss_create(&ss));
+    for (int i = 0; i < 9; i++) {
+        assert(SS_OK == ss_append_static_copy_static(ss, "x"));
+    }
+    assert(SS_OK == ss_clone(ss, &ss2));
+    ss_stats_snapshot(&stats);
+    assert(stats.piece_growths == 2);
+    assert(stats.ss_clones == 1);
+    assert(stats.ssp_clones == 0);
+    assert(stats.sd_retains == 0);
+
+    assert(SS_OK == ss_free(ss2));
+    assert(SS_OK == ss_free(ss));
+    ss_stats_snapshot(&stats);
+    assert(stats.sd_frees == 9);
+
+    /**
+     * Literals don't create any string_data at all.
+     */
+    ss_stats_reset();
+    assert(SS_OK == ss_create(&ss));
+    assert(SS_OK == ss_append_static_literal(ss, "literal"));
+    assert(SS_OK == ss_free(ss));
+    ss_stats_snapshot(&stats);
+    assert(stats.sd_creates == 0);
+    assert(stats.sd_frees == 0);
+#endif
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "common.h"
+#include "segmented_string.h"
+#include "find.h"
+#include "hash.h"
+#include "parse.h"
+#include "fixed_template.hpp"
+
+#include <assert.h>
+
+using row = ss::fixed_template<"<td>$name</td><td>$age</td><td>$name</td>">;
+using escapes = ss::fixed_template<"$$ is $1 of $$$price, $ or $$x">;
+using text = ss::fixed_template<"no placeholders">;
+using empty = ss::fixed_template<"">;
+
+/**
+ * Everything about a template is known while compiling.
+ */
+static_assert(row::piece_count == 7);
+static_assert(row::slot_count == 2);
+static_assert(row::static_length == 27);
+static_assert(row::max_length == 27 + 9);
+static_assert(row::slot("name") == 0);
+static_assert(row::slot("age") == 1);
+
+/**
+ * Text either side of a `$$` is one piece, and a `$` that doesn't start a
+ * name is just text.
+ */
+static_assert(escapes::piece_count == 3);
+static_assert(escapes::slot_count == 1);
+static_assert(escapes::static_length == sizeof("$ is $1 of $, $ or $x") - 1);
+static_assert(escapes::slot("price") == 0);
+
+static_assert(text::piece_count == 1);
+static_assert(text::slot_count == 0);
+static_assert(text::static_length == 15);
+static_assert(empty::piece_count == 0);
+static_assert(empty::max_length == 0);
+
+/**
+ * Renders `ss` with both `render_into`s and checks they agree with `expected`.
+ */
+template <typename Template>
+void check_render(struct segmented_string *ss, const char *expected) {
+    char fixed[256], generic[256];
+    size_t fixed_written, generic_written;
+
+    assert(SS_OK == Template::render_into(ss, fixed, sizeof(fixed), &fixed_written));
+    assert(SS_OK == ss_render_into(ss, generic, sizeof(generic), &generic_written));
+    assert(fixed_written == strlen(expected));
+    assert(generic_written == fixed_written);
+    assert(memcmp(fixed, expected, fixed_written) == 0);
+    assert(memcmp(generic, expected, generic_written) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    /**
+     * The prototype is a frozen template, there before main is.
+     */
+    struct segmented_string *prototype = row::prototype();
+    assert(prototype->type == UNFILLED_TEMPLATE_STRING);
+    assert(prototype->frozen);
+    assert(prototype->length == row::piece_count);
+    assert(prototype->slot_count == row::slot_count);
+    assert(prototype->unfilled_slots == 2);
+    assert(SS_FROZEN == ss_append_static_copy_static(prototype, "nope"));
+    assert(SS_FROZEN == ss_fill_slot_uint8(prototype, 0, 1));
+
+    /**
+     * Its headers come with their fragment hashes already cached.
+     */
+    struct string_data *head = prototype->pieces[0].data.static_string;
+    assert(_sd_load_hash(head) >> 63);
+    assert(sd_fragment_hash(head) == sd_poly_hash_bytes(0, "<td>", 4));
+
+    /**
+     * Instances are clones of it, filled by slot.
+     */
+    struct segmented_string *ss;
+    assert(SS_OK == row::create(&ss));
+    assert(ss->type == UNFILLED_TEMPLATE_STRING);
+    assert(ss->pieces == prototype->pieces);
+
+    char buf[256];
+    size_t written;
+    assert(SS_INVALID_STRING_TYPE == row::render_into(ss, buf, sizeof(buf), &written));
+
+    assert(SS_OK == row::fill<"name">(ss, 7));
+    assert(ss->type == PARTIALLY_FILLED_TEMPLATE_STRING);
+    assert(SS_OK == row::fill<"age">(ss, 255));
+    assert(ss->type == FULLY_FILLED_TEMPLATE_STRING);
+    check_render<row>(ss, "<td>7</td><td>255</td><td>7</td>");
+
+    /**
+     * Filling by name at run time finds the same slots.
+     */
+    assert(SS_OK == ss_fill_uint8(ss, "age", 0));
+    check_render<row>(ss, "<td>7</td><td>0</td><td>7</td>");
+
+    /**
+     * It is the same string `ss_parse` makes, as far as anything can tell.
+     */
+    struct segmented_string *parsed;
+    assert(SS_OK == ss_parse_cstring("<td>$name</td><td>$age</td><td>$name</td>", &parsed));
+    assert(parsed->slot_count == row::slot_count);
+    assert(SS_OK == ss_fill_uint8(parsed, "name", 7));
+    assert(SS_OK == ss_fill_uint8(parsed, "age", 0));
+
+    bool equal;
+    assert(SS_OK == ss_equals(ss, parsed, &equal));
+    assert(equal);
+
+    uint64_t a, b;
+    assert(SS_OK == ss_hash(ss, &a));
+    assert(SS_OK == ss_hash(parsed, &b));
+    assert(a == b);
+
+    struct ss_match match;
+    bool found;
+    assert(SS_OK == ss_find(ss, "</td><td>0", 10, &match, &found));
+    assert(found);
+    assert(match.position == 5);
+    assert(SS_OK == ss_free(parsed));
+
+    /**
+     * Too small a buffer is caught whether or not the rendering would fit
+     * `max_length`.
+     */
+    assert(SS_OK == row::render_into(ss, buf, 27 + 3, &written));
+    assert(written == 27 + 3);
+    assert(SS_BUFFER_TOO_SMALL == row::render_into(ss, buf, 27 + 2, &written));
+
+    /**
+     * Clones are independent of one another.
+     */
+    struct segmented_string *other;
+    assert(SS_OK == row::create(&other));
+    assert(SS_OK == row::fill<"name">(other, 100));
+    assert(SS_OK == row::fill<"age">(other, 99));
+    check_render<row>(other, "<td>100</td><td>99</td><td>100</td>");
+    check_render<row>(ss, "<td>7</td><td>0</td><td>7</td>");
+    assert(prototype->unfilled_slots == 2);
+
+    /**
+     * Once a clone has pieces of its own it is rendered like any other string.
+     */
+    assert(SS_OK == ss_append_static_copy_static(other, "</tr>"));
+    assert(other->pieces != prototype->pieces);
+    check_render<row>(other, "<td>100</td><td>99</td><td>100</td></tr>");
+    assert(SS_OK == ss_free(other));
+    assert(SS_OK == ss_free(ss));
+
+    assert(SS_OK == escapes::create(&ss));
+    assert(SS_OK == escapes::fill<"price">(ss, 12));
+    check_render<escapes>(ss, "$ is $1 of $12, $ or $x");
+    assert(SS_OK == ss_free(ss));
+
+    assert(text::prototype()->type == STATIC_STRING);
+    assert(SS_OK == text::create(&ss));
+    check_render<text>(ss, "no placeholders");
+    assert(SS_OK == ss_free(ss));
+
+    assert(empty::prototype()->type == EMPTY_STRING);
+    assert(SS_OK == empty::create(&ss));
+    check_render<empty>(ss, "");
+    assert(SS_OK == ss_free(ss));
+
+    return 0;
+}
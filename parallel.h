@@ -0,0 +1,347 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Items are handed out to workers in blocks of this many. Big enough that the
+ * atomic claim is noise next to rendering the block, small enough that the
+ * last few blocks still spread over every worker.
+ */
+#define SS_PARALLEL_GRAIN 256
+#define SS_PARALLEL_MAX_THREADS 64
+
+typedef SS_RESULT (*_ss_parallel_item_fn)(void *ctx, size_t index);
+
+/**
+ * The part of the items a worker starts out with. `next` only ever moves
+ * forward, by atomic fetch-and-add, both for the owner and for anyone stealing
+ * from it, so claiming a block never takes a lock. Each range gets its own
+ * cache line so that workers claiming from their own range don't contend.
+ */
+struct _ss_parallel_range {
+    SS_ALIGNAS(64) size_t next;
+    size_t end;
+};
+
+struct _ss_parallel_pool {
+    _ss_parallel_item_fn fn;
+    void *ctx;
+    unsigned thread_count;
+    struct _ss_parallel_range ranges[SS_PARALLEL_MAX_THREADS];
+
+    /**
+     * The first error any worker hit, SS_OK otherwise. Everyone stops at the
+     * end of their current block once it is set.
+     */
+    SS_RESULT result;
+};
+
+struct _ss_parallel_worker {
+    struct _ss_parallel_pool *pool;
+    unsigned id;
+};
+
+/**
+ * How many workers to use when the caller doesn't say: one per online CPU.
+ */
+unsigned ss_parallel_thread_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    if (cpus > SS_PARALLEL_MAX_THREADS) return SS_PARALLEL_MAX_THREADS;
+    return (unsigned)cpus;
+}
+
+bool _ss_parallel_claim(struct _ss_parallel_range *range, size_t *start, size_t *end) {
+    if (__atomic_load_n(&range->next, __ATOMIC_RELAXED) >= range->end) return false;
+
+    size_t claimed = __atomic_fetch_add(&range->next, SS_PARALLEL_GRAIN, __ATOMIC_RELAXED);
+    if (claimed >= range->end) return false;
+
+    *start = claimed;
+    *end = range->end - claimed < SS_PARALLEL_GRAIN ? range->end : claimed + SS_PARALLEL_GRAIN;
+    return true;
+}
+
+/**
+ * A worker drains its own range first, then goes round the other workers'
+ * ranges taking blocks from them until there is nothing left anywhere.
+ */
+void *_ss_parallel_work(void *arg) {
+    struct _ss_parallel_worker *worker = (struct _ss_parallel_worker *)arg;
+    struct _ss_parallel_pool *pool = worker->pool;
+
+    for (unsigned k = 0; k < pool->thread_count; k++) {
+        struct _ss_parallel_range *range = &pool->ranges[(worker->id + k) % pool->thread_count];
+        size_t start, end;
+
+        while (_ss_parallel_claim(range, &start, &end)) {
+            if (__atomic_load_n(&pool->result, __ATOMIC_RELAXED) != SS_OK) return NULL;
+
+            for (size_t i = start; i < end; i++) {
+                SS_RESULT res = pool->fn(pool->ctx, i);
+                if (res != SS_OK) {
+                    SS_RESULT expected = SS_OK;
+                    __atomic_compare_exchange_n(&pool->result, &expected, res, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * The worker threads are started the first time a job needs them and then
+ * kept for the rest of the process, parked on `wake` between jobs, so a job
+ * costs a broadcast and a wait rather than creating and joining threads. A
+ * parallel render runs two jobs back to back, and with fresh threads for each
+ * the thread start-up alone was most of the time taken by anything short of
+ * tens of thousands of items.
+ *
+ * One job runs at a time: `job` is held by whoever is running one, and
+ * everything else here is guarded by `lock`. Worker `id` (from 1, the caller
+ * being 0) joins a job if the job has a range for it.
+ */
+struct _ss_parallel_threads {
+    pthread_mutex_t job;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned started;
+    uint64_t generation;
+    struct _ss_parallel_pool *pool;
+    unsigned busy;
+};
+
+struct _ss_parallel_threads _ss_parallel_shared = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    0,
+    0,
+    NULL,
+    0
+};
+
+void *_ss_parallel_thread(void *arg) {
+    struct _ss_parallel_threads *threads = &_ss_parallel_shared;
+    struct _ss_parallel_worker worker;
+    uint64_t seen = 0;
+
+    worker.id = (unsigned)(uintptr_t)arg;
+
+    pthread_mutex_lock(&threads->lock);
+    while (true) {
+        while (threads->generation == seen) pthread_cond_wait(&threads->wake, &threads->lock);
+        seen = threads->generation;
+        worker.pool = threads->pool;
+
+        /**
+         * Too late for a job that didn't need us, or not needed by this one.
+         */
+        if (worker.pool == NULL || worker.id >= worker.pool->thread_count) continue;
+        pthread_mutex_unlock(&threads->lock);
+
+        _ss_parallel_work(&worker);
+
+        pthread_mutex_lock(&threads->lock);
+        if (--threads->busy == 0) pthread_cond_signal(&threads->done);
+    }
+
+    return NULL;
+}
+
+/**
+ * Calls `fn(ctx, i)` for every `i` below `count`, spread over `thread_count`
+ * threads (0 for `ss_parallel_thread_count()`), the calling thread being one
+ * of them. Returns once every call has been made, or with the first error.
+ *
+ * If some threads can't be started, the ones that are running steal their
+ * share, so that is not an error.
+ */
+SS_RESULT _ss_parallel_for(size_t count, unsigned thread_count, _ss_parallel_item_fn fn, void *ctx) {
+    struct _ss_parallel_threads *threads = &_ss_parallel_shared;
+
+    if (thread_count == 0) thread_count = ss_parallel_thread_count();
+    if (thread_count > SS_PARALLEL_MAX_THREADS) thread_count = SS_PARALLEL_MAX_THREADS;
+
+    size_t blocks = (count + SS_PARALLEL_GRAIN - 1) / SS_PARALLEL_GRAIN;
+    if (blocks < thread_count) thread_count = blocks == 0 ? 1 : blocks;
+
+    struct _ss_parallel_pool pool;
+
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.thread_count = thread_count;
+    pool.result = SS_OK;
+
+    /**
+     * Split on block boundaries, so that only the very last block is short.
+     */
+    size_t per_thread = (blocks + thread_count - 1) / thread_count * SS_PARALLEL_GRAIN;
+    for (unsigned t = 0; t < thread_count; t++) {
+        size_t start = per_thread * t;
+        pool.ranges[t].next = start < count ? start : count;
+        pool.ranges[t].end = start + per_thread < count ? start + per_thread : count;
+    }
+
+    struct _ss_parallel_worker caller = { &pool, 0 };
+    if (thread_count == 1) {
+        _ss_parallel_work(&caller);
+        return pool.result;
+    }
+
+    pthread_mutex_lock(&threads->job);
+    pthread_mutex_lock(&threads->lock);
+
+    while (threads->started + 1 < thread_count) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, _ss_parallel_thread, (void *)(uintptr_t)(threads->started + 1)) != 0) break;
+        pthread_detach(thread);
+        threads->started++;
+    }
+
+    threads->pool = &pool;
+    threads->busy = threads->started + 1 < thread_count ? threads->started : thread_count - 1;
+    threads->generation++;
+    pthread_cond_broadcast(&threads->wake);
+    pthread_mutex_unlock(&threads->lock);
+
+    _ss_parallel_work(&caller);
+
+    pthread_mutex_lock(&threads->lock);
+    while (threads->busy > 0) pthread_cond_wait(&threads->done, &threads->lock);
+    threads->pool = NULL;
+    pthread_mutex_unlock(&threads->lock);
+    pthread_mutex_unlock(&threads->job);
+
+    return pool.result;
+}
+
+/**
+ * Shared by the per item callbacks of both parallel renderers. Exactly one of
+ * `strings` and `list` is set.
+ */
+struct _ss_render_parallel_ctx {
+    struct segmented_string *const *strings;
+    struct segmented_string *list;
+    char *buf;
+    size_t *ends;
+};
+
+SS_RESULT _ss_render_parallel_length(void *arg, size_t index) {
+    struct _ss_render_parallel_ctx *ctx = (struct _ss_render_parallel_ctx *)arg;
+
+    if (ctx->list != NULL) {
+        return ssp_render_length(&ctx->list->pieces[index], ctx->list->values, &ctx->ends[index]);
+    }
+    return ss_render_length(ctx->strings[index], &ctx->ends[index]);
+}
+
+SS_RESULT _ss_render_parallel_write(void *arg, size_t index) {
+    struct _ss_render_parallel_ctx *ctx = (struct _ss_render_parallel_ctx *)arg;
+    size_t start = index == 0 ? 0 : ctx->ends[index - 1];
+
+    if (ctx->list != NULL) {
+        char *end;
+        return ssp_render_into(&ctx->list->pieces[index], ctx->list->values, ctx->buf + start, &end);
+    }
+
+    size_t written;
+    return ss_render_into(ctx->strings[index], ctx->buf + start, ctx->ends[index] - start, &written);
+}
+
+/**
+ * The engine behind both parallel renderers: work out every item's length in
+ * parallel, turn the lengths into end offsets with a prefix sum, and then
+ * render every item in parallel straight into its own part of `buf`. Nothing
+ * is shared on the write path except the atomic block cursors.
+ */
+SS_RESULT _ss_render_parallel(
+    struct _ss_render_parallel_ctx *ctx,
+    size_t count,
+    unsigned thread_count,
+    size_t capacity,
+    size_t *ends,
+    size_t *written
+) {
+    ctx->ends = ends != NULL ? ends : (size_t *)SS_MALLOC(sizeof(size_t) * (count == 0 ? 1 : count));
+    if (ctx->ends == NULL) return SS_ALLOC_ERROR;
+
+    SS_RESULT res = _ss_parallel_for(count, thread_count, _ss_render_parallel_length, ctx);
+
+    if (res == SS_OK) {
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            total += ctx->ends[i];
+            ctx->ends[i] = total;
+        }
+
+        *written = total;
+        if (total > capacity) res = SS_BUFFER_TOO_SMALL;
+    }
+
+    if (res == SS_OK) {
+        res = _ss_parallel_for(count, thread_count, _ss_render_parallel_write, ctx);
+    }
+
+    if (ends == NULL) SS_FREE(ctx->ends);
+    return res;
+}
+
+/**
+ * Renders `count` strings back to back into `buf` using `thread_count` threads
+ * (0 for one per CPU). This is the multi-core version of calling
+ * `ss_render_into` on each string in turn, for bulk jobs with millions of
+ * rows.
+ *
+ * `ends` and `*written` work the same as in `ss_render_batch_uint8`: if `ends`
+ * is not NULL it receives the end offset of every string, and `*written` is
+ * set to the total size even when SS_BUFFER_TOO_SMALL is returned.
+ *
+ * The strings are only read, so they may share pieces (clones of one template,
+ * say) and may be frozen. None of them may be modified during the call.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_render_parallel(
+    struct segmented_string *const *strings,
+    size_t count,
+    unsigned thread_count,
+    char *buf,
+    size_t capacity,
+    size_t *ends,
+    size_t *written
+) {
+    struct _ss_render_parallel_ctx ctx = { strings, NULL, buf, NULL };
+    return _ss_render_parallel(&ctx, count, thread_count, capacity, ends, written);
+}
+
+/**
+ * Same as `ss_render_parallel`, for the entries of a list: every piece of
+ * `list` is rendered back to back, with `ends` receiving the end of each.
+ *
+ * Valid String Types: STRING_LIST
+ */
+SS_RESULT ss_render_list_parallel(
+    struct segmented_string *list,
+    unsigned thread_count,
+    char *buf,
+    size_t capacity,
+    size_t *ends,
+    size_t *written
+) {
+    if (list->type != STRING_LIST) return SS_INVALID_STRING_TYPE;
+
+    struct _ss_render_parallel_ctx ctx = { NULL, list, buf, NULL };
+    return _ss_render_parallel(&ctx, list->length, thread_count, capacity, ends, written);
+}
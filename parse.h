@@ -0,0 +1,192 @@
+#pragma once
+
+#include "common.h"
+#include "segmented_string.h"
+#include "simd.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Placeholder names are identifiers: a letter or underscore, then any number
+ * of letters, digits and underscores.
+ */
+bool _ss_parse_is_name_char(char c, bool first) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') return true;
+    return !first && c >= '0' && c <= '9';
+}
+
+/**
+ * Static runs borrow the source; empty ones between two placeholders are
+ * skipped.
+ */
+SS_RESULT _ss_parse_static(struct segmented_string *ss, const char *data, size_t length) {
+    if (length == 0) return SS_OK;
+    return ss_append_static_borrow(ss, data, length);
+}
+
+/**
+ * Which slot each name seen so far got. Names are interned, so they are
+ * keyed by pointer. Open addressed, and never more than half full.
+ */
+struct _ss_parse_name {
+    struct string_data *name;
+    uint32_t slot;
+};
+
+#define SS_PARSE_STACK_NAMES 32
+
+struct _ss_parse_names {
+    struct _ss_parse_name *buckets;
+    size_t mask;
+};
+
+/**
+ * Appends the placeholder `name[0, length)`. Its slot comes from `names`
+ * rather than from `_ss_assign_slot`: every name here is interned, so a
+ * pointer is all the key we need, and the table is sized once up front.
+ */
+SS_RESULT _ss_parse_placeholder(struct segmented_string *ss, struct _ss_parse_names *names, const char *name, size_t length) {
+    _ss_increment_pieces(ss);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
+
+    struct segmented_string_piece *ssp = &ss->pieces[ss->length - 1];
+    SS_RESULT res = ssp_init_placeholder_uint8(ssp, name, length);
+    if (res != SS_OK) return res;
+
+    struct string_data *interned = ssp->data.placeholder_data.placeholder;
+    size_t bucket = ((uintptr_t)interned >> 4) * 0x9e3779b97f4a7c15ULL >> 32 & names->mask;
+
+    while (names->buckets[bucket].name != NULL) {
+        if (names->buckets[bucket].name == interned) {
+            ssp->slot = names->buckets[bucket].slot;
+            return SS_OK;
+        }
+        bucket = (bucket + 1) & names->mask;
+    }
+
+    res = _ss_new_slot(ss, ssp);
+    if (res != SS_OK) return res;
+
+    names->buckets[bucket].name = interned;
+    names->buckets[bucket].slot = ssp->slot;
+    return SS_OK;
+}
+
+/**
+ * Builds a template out of source text like `Hello $name, you are $age`, in
+ * one pass over the text.
+ *
+ * - `$` followed by a name (see `_ss_parse_is_name_char`) is a uint8
+ *   placeholder. The name ends at the first character that can't be part of
+ *   one, so `$a.$b` is two placeholders with a `.` between them.
+ * - `$$` is a literal `$`.
+ * - A `$` that is followed by neither is kept as it is, so `$5` is just text.
+ *
+ * The `$` signs are found with the SIMD scans in simd.h: one pass counts them,
+ * which bounds the number of pieces so that the pieces array is allocated
+ * exactly once, and a second pass jumps from one to the next. Text between
+ * them is never looked at byte by byte. Static runs are borrowed pieces that
+ * point into `source` (see `ss_append_static_borrow`), so `source` has to
+ * outlive the template and everything made from it. Placeholder names are
+ * interned like any others. Only the names are copied, and only the first
+ * time each is seen anywhere. Working out which placeholders share a slot
+ * takes a small hash table keyed on the interned names, so parsing stays
+ * linear however many placeholders there are.
+ *
+ * Call `ss_compile` on the result before filling it by name in a hot loop.
+ *
+ * Return String Type: UNFILLED_TEMPLATE_STRING if there are placeholders,
+ *                     STATIC_STRING if there is only text, EMPTY_STRING for
+ *                     empty source.
+ */
+SS_RESULT ss_parse(const char *source, size_t length, struct segmented_string **out) {
+    if (length > UINT32_MAX) return SS_ERR;
+
+    /**
+     * Every `$` adds at most a placeholder and the static run after it.
+     */
+    size_t sigils = ss_count_char(source, length, '$');
+    SS_RESULT res = ss_create_initialized(EMPTY_STRING, sigils * 2 + 1, out);
+    if (res != SS_OK) return res;
+
+    /**
+     * There are at most as many names as `$` signs.
+     */
+    struct _ss_parse_name stack_names[SS_PARSE_STACK_NAMES];
+    struct _ss_parse_names names;
+    size_t bucket_count = 1;
+    while (bucket_count < sigils * 2) bucket_count *= 2;
+
+    names.mask = bucket_count - 1;
+    names.buckets = bucket_count <= SS_PARSE_STACK_NAMES
+        ? stack_names
+        : (struct _ss_parse_name *)SS_MALLOC(sizeof(struct _ss_parse_name) * bucket_count);
+    if (names.buckets == NULL) {
+        ss_free(*out);
+        SS_FREE(*out);
+        *out = NULL;
+        return SS_ALLOC_ERROR;
+    }
+    memset(names.buckets, 0, sizeof(struct _ss_parse_name) * bucket_count);
+
+    size_t run = 0;
+    size_t cursor = 0;
+
+    while (true) {
+        size_t sigil = cursor + ss_find_char(source + cursor, length - cursor, '$');
+        if (sigil == length) break;
+
+        size_t name = sigil + 1;
+
+        if (name < length && source[name] == '$') {
+            /**
+             * The run so far, up to and including the first `$`, is one
+             * piece; the second `$` is dropped.
+             */
+            res = _ss_parse_static(*out, source + run, name - run);
+            if (res != SS_OK) break;
+
+            run = cursor = name + 1;
+            continue;
+        }
+
+        size_t end = name;
+        while (end < length && _ss_parse_is_name_char(source[end], end == name)) end++;
+
+        if (end == name) {
+            cursor = name;
+            continue;
+        }
+
+        res = _ss_parse_static(*out, source + run, sigil - run);
+        if (res != SS_OK) break;
+
+        res = _ss_parse_placeholder(*out, &names, source + name, end - name);
+        if (res != SS_OK) break;
+
+        run = cursor = end;
+    }
+
+    if (res == SS_OK) {
+        res = _ss_parse_static(*out, source + run, length - run);
+    }
+
+    if (names.buckets != stack_names) SS_FREE(names.buckets);
+
+    if (res != SS_OK) {
+        ss_free(*out);
+        SS_FREE(*out);
+        *out = NULL;
+    }
+    return res;
+}
+
+/**
+ * Same as `ss_parse`, for NULL-terminated source.
+ */
+SS_RESULT ss_parse_cstring(const char *source, struct segmented_string **out) {
+    return ss_parse(source, strlen(source), out);
+}
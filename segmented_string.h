@@ -2,7 +2,9 @@
 
 #include "common.h"
 #include "segmented_string_piece.h"
+#include "simd.h"
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +18,92 @@ typedef enum {
     EMPTY_STRING
 } StringType;
 
+/**
+ * One distinct placeholder name in a compiled template.
+ */
+struct ss_slot {
+    uint64_t hash;
+    struct string_data *name;
+};
+
+/**
+ * The name -> slot index built by `ss_compile`. It is immutable once built
+ * and shared (by reference count) between a template and all of its clones,
+ * so a slot id looked up once is good for every clone. Once `frozen` is set
+ * (see `ss_freeze`) the reference count is never touched again.
+ *
+ * Everything lives in the one allocation that this header starts: the slots,
+ * then the open addressed hash buckets (slot + 1, 0 for empty).
+ */
+struct ss_slot_table {
+    struct ss_arena *arena;
+    uint32_t ref_count;
+    uint32_t slot_count;
+    uint32_t bucket_mask;
+    bool frozen;
+
+    struct ss_slot *slots;
+    uint32_t *buckets;
+};
+
+/**
+ * A block of string_data headers allocated in one go, for operations that
+ * produce many borrowed views at once (see `ss_explode_by_char`). The headers
+ * are marked STRING_EXTERNAL_HEADER; the block is shared by reference count
+ * between a string and its clones and freed with the last of them, unless
+ * it has been frozen like a slot table.
+ */
+struct ss_view_block {
+    uint32_t ref_count;
+    uint32_t count;
+    bool frozen;
+    struct string_data views[];
+};
+
+/**
+ * Where one placeholder landed in a cached rendering: `pieces[piece]` was
+ * rendered as `data[offset, offset + length)`. Nested pieces that have string
+ * placeholders somewhere inside them get a span too (see
+ * `ss_render_cached`).
+ */
+struct ss_render_span {
+    size_t offset;
+    size_t length;
+    uint32_t piece;
+};
+
+/**
+ * The flattened rendering kept by `ss_render_cached`, with a span for every
+ * placeholder and a bit per slot saying which have been filled since. It is
+ * always on the heap, even for strings in an arena, as it grows in place.
+ *
+ * `valid` is cleared by anything that changes our pieces, and the next render
+ * starts again from scratch. `volatile_spans` says whether any span is for a
+ * borrowed string, whose contents can change without us being told.
+ */
+struct ss_render_cache {
+    char *data;
+    size_t length;
+    size_t capacity;
+
+    struct ss_render_span *spans;
+    uint32_t span_count;
+    uint32_t span_capacity;
+
+    uint64_t *dirty;
+    uint32_t dirty_words;
+
+    bool valid;
+    bool any_dirty;
+    bool volatile_spans;
+
+    /**
+     * The plan `ss_render_batch_uint8` made from our pieces, NULL if there
+     * isn't one yet. It is thrown away whenever the pieces change.
+     */
+    struct ss_batch_plan *batch;
+};
+
 /**
  * A segmented string is meant to be the main string type for my eventual
  * language. It makes no real effort to be super compatible with c-style
@@ -40,21 +128,375 @@ struct segmented_string {
      * Length is the amount we're currently using. Capacity is the amount we
      * have allocated space for. We generally start at 8 and go up by powers of
      * two. This should be seen as an implementation detail.
-     *
-     * As of now, we max out at 255 pieces. That may change in the future.
      */
-    uint8_t length;
-    uint8_t capacity;
+    uint32_t length;
+    uint32_t capacity;
     struct segmented_string_piece *pieces;
+
+    /**
+     * `pieces` is copy-on-write between a string and its clones. NULL means
+     * the array is ours alone; otherwise it points at a count, shared by every
+     * string using the array, of how many of them there are. The first of them
+     * to change its pieces takes a private copy (see `_ss_unshare_pieces`).
+     */
+    uint32_t *pieces_ref_count;
+
+    /**
+     * If this string was created in an arena, everything it allocates from
+     * here on (pieces, copies of static data, placeholder names) comes out of
+     * that arena too. NULL means the regular heap.
+     */
+    struct ss_arena *arena;
+
+    /**
+     * Every distinct placeholder name gets a slot when it is first appended.
+     * The value for a slot is `values[slot]`, and which slots have been filled
+     * is tracked one bit per slot in `filled`, so `unfilled_slots` tells us our
+     * type without rescanning. `slot_types` is the placeholder type of every
+     * piece using the slot, which is what a fill has to match. These are the
+     * only parts of a template that differ between clones, and they share one
+     * allocation: the bit words first, then the values, then the types (see
+     * `_ss_slot_state_size`).
+     */
+    uint32_t slot_count;
+    uint32_t slot_capacity;
+    uint32_t unfilled_slots;
+    uint64_t *filled;
+    union ss_value *values;
+    uint8_t *slot_types;
+
+    /**
+     * The name -> slot hash index built by `ss_compile`, NULL otherwise.
+     */
+    struct ss_slot_table *slots;
+
+    /**
+     * The same kind of index, kept up to date by `_ss_assign_slot` while
+     * placeholders are appended, with room for `names->slot_count` slots.
+     * Unlike `slots` it is ours alone: clones start without one. NULL until
+     * a placeholder is appended.
+     */
+    struct ss_slot_table *names;
+
+    /**
+     * Headers for pieces that are views into some other string, if we have
+     * any. NULL otherwise.
+     */
+    struct ss_view_block *views;
+
+    /**
+     * What `ss_render_cached` rendered last time, NULL if it has never been
+     * called. It belongs to this string alone; clones start without one.
+     */
+    struct ss_render_cache *cache;
+
+    /**
+     * `frozen` is set by `ss_freeze`: this string can no longer change, and
+     * can be cloned from any number of threads at once.
+     *
+     * `borrowed` is set on clones of a frozen string. Such a clone uses the
+     * frozen string's pieces, slot index and views without holding references
+     * to any of them, which is what lets cloning a frozen template write to
+     * nothing but the clone. The frozen string has to outlive its clones.
+     */
+    bool frozen;
+    bool borrowed;
+
+    /**
+     * How deeply nested pieces go below us: 0 if we have none, otherwise one
+     * more than the deepest string we have nested (see `ss_concat`).
+     */
+    uint8_t depth;
+};
+
+/**
+ * Strings nested deeper than this are flattened by `ss_concat` instead of
+ * being linked in, which keeps rendering's recursion shallow.
+ */
+#define SS_CONCAT_MAX_DEPTH 8
+
+/**
+ * What a nested piece points at: a clone of the string that was concatenated,
+ * shared by reference count between every pieces array that holds the piece.
+ * Nothing ever changes the string once it is in here.
+ */
+struct ss_nested {
+    uint32_t ref_count;
+    struct segmented_string ss;
 };
 
+/**
+ * Sets up every field of a freshly allocated header other than the pieces.
+ */
+void _ss_init(struct segmented_string *ss, StringType type, struct ss_arena *arena) {
+    ss->type = type;
+    ss->pieces_ref_count = NULL;
+    ss->arena = arena;
+    ss->slot_count = 0;
+    ss->slot_capacity = 0;
+    ss->unfilled_slots = 0;
+    ss->filled = NULL;
+    ss->values = NULL;
+    ss->slot_types = NULL;
+    ss->slots = NULL;
+    ss->names = NULL;
+    ss->views = NULL;
+    ss->cache = NULL;
+    ss->frozen = false;
+    ss->borrowed = false;
+    ss->depth = 0;
+}
+
+/**
+ * Allocates from our arena if we have one, and from the heap otherwise.
+ */
+void *_ss_alloc(struct segmented_string *ss, size_t size) {
+    if (ss->arena != NULL) return ss_arena_alloc(ss->arena, size);
+    return SS_MALLOC(size);
+}
+
+/**
+ * The `frozen` flag of a slot table or view block. Like `sd_is_frozen`, it is
+ * read and set atomically in SS_THREAD_SAFE builds, as strings sharing the
+ * block may be cloned or freed on other threads while it is frozen.
+ */
+bool _ss_block_is_frozen(bool *frozen) {
+#ifdef SS_THREAD_SAFE
+    return __atomic_load_n(frozen, __ATOMIC_ACQUIRE);
+#else
+    return *frozen;
+#endif
+}
+
+void _ss_block_freeze(bool *frozen) {
+#ifdef SS_THREAD_SAFE
+    __atomic_store_n(frozen, true, __ATOMIC_RELEASE);
+#else
+    *frozen = true;
+#endif
+}
+
+/**
+ * Takes a reference to this string's slot table and view block, if it has
+ * them and they aren't frozen.
+ */
+void _ss_retain_blocks(struct segmented_string *ss) {
+    if (ss->slots != NULL && !_ss_block_is_frozen(&ss->slots->frozen)) SS_REF_INC(ss->slots->ref_count);
+    if (ss->views != NULL && !_ss_block_is_frozen(&ss->views->frozen)) SS_REF_INC(ss->views->ref_count);
+}
+
+/**
+ * Gives up this string's reference to its slot table, if it has one. Called
+ * whenever the table would no longer describe our slots.
+ */
+void _ss_drop_slots(struct segmented_string *ss) {
+    if (ss->slots == NULL) return;
+
+    if (!ss->borrowed && !_ss_block_is_frozen(&ss->slots->frozen)
+            && SS_REF_DEC(ss->slots->ref_count) == 0 && ss->slots->arena == NULL) {
+        SS_FREE(ss->slots);
+    }
+
+    ss->slots = NULL;
+}
+
+/**
+ * Allocates an index for `slot_count` slots, with none of them added yet,
+ * from `arena` if that isn't NULL.
+ */
+SS_RESULT _ss_slot_table_create(struct ss_arena *arena, uint32_t slot_count, struct ss_slot_table **table) {
+    /**
+     * Keep the buckets at most half full.
+     */
+    uint32_t bucket_count = 1;
+    while (bucket_count < slot_count * 2) bucket_count *= 2;
+
+    size_t size = sizeof(struct ss_slot_table)
+        + sizeof(struct ss_slot) * slot_count
+        + sizeof(uint32_t) * bucket_count;
+
+    *table = (struct ss_slot_table *)(arena != NULL ? ss_arena_alloc(arena, size) : SS_MALLOC(size));
+    if (*table == NULL) return SS_ALLOC_ERROR;
+
+    (*table)->arena = arena;
+    (*table)->ref_count = 1;
+    (*table)->slot_count = slot_count;
+    (*table)->bucket_mask = bucket_count - 1;
+    (*table)->frozen = false;
+    (*table)->slots = (struct ss_slot *)(*table + 1);
+    (*table)->buckets = (uint32_t *)((*table)->slots + slot_count);
+    memset((*table)->buckets, 0, sizeof(uint32_t) * bucket_count);
+
+    return SS_OK;
+}
+
+/**
+ * Names `slot`. Every slot has to be added exactly once.
+ */
+void _ss_slot_table_add(struct ss_slot_table *table, uint32_t slot, struct string_data *name) {
+    uint64_t hash = sd_hash(name);
+    uint32_t bucket = hash & table->bucket_mask;
+    while (table->buckets[bucket] != 0) bucket = (bucket + 1) & table->bucket_mask;
+
+    table->slots[slot].hash = hash;
+    table->slots[slot].name = name;
+    table->buckets[bucket] = slot + 1;
+}
+
+/**
+ * The slot `name` has in `table`, plus one, or 0 if it isn't there.
+ */
+uint32_t _ss_slot_table_find(struct ss_slot_table *table, struct string_data *name) {
+    uint64_t hash = sd_hash(name);
+    uint32_t bucket = hash & table->bucket_mask;
+
+    while (table->buckets[bucket] != 0) {
+        struct ss_slot *candidate = &table->slots[table->buckets[bucket] - 1];
+        if (candidate->hash == hash && (candidate->name == name || sd_is_equal_bytes(candidate->name, name->data, sd_length(name)))) {
+            return table->buckets[bucket];
+        }
+
+        bucket = (bucket + 1) & table->bucket_mask;
+    }
+
+    return 0;
+}
+
+/**
+ * Throws away the index `_ss_assign_slot` keeps, if we have one.
+ */
+void _ss_drop_names(struct segmented_string *ss) {
+    if (ss->names == NULL) return;
+
+    if (ss->arena == NULL) SS_FREE(ss->names);
+    ss->names = NULL;
+}
+
+/**
+ * Throws away our cached rendering, if we have one.
+ */
+void _ss_drop_cache(struct segmented_string *ss) {
+    if (ss->cache == NULL) return;
+
+    SS_FREE(ss->cache->data);
+    SS_FREE(ss->cache->spans);
+    SS_FREE(ss->cache->dirty);
+    SS_FREE(ss->cache->batch);
+    SS_FREE(ss->cache);
+    ss->cache = NULL;
+}
+
+/**
+ * Marks everything we have cached about our pieces as out of date. Called
+ * whenever they change.
+ */
+void _ss_pieces_changed(struct segmented_string *ss) {
+    if (ss->cache == NULL) return;
+
+    ss->cache->valid = false;
+    SS_FREE(ss->cache->batch);
+    ss->cache->batch = NULL;
+}
+
+/**
+ * Gives back our references to every piece's data, then the heap array
+ * holding them.
+ */
+SS_RESULT _ss_release_pieces(struct segmented_string_piece *pieces, uint32_t length, bool heap) {
+    for (uint32_t i = 0; i < length; i++) {
+        SS_RESULT res = ssp_free(&pieces[i]);
+        if (res != SS_OK) return res;
+    }
+
+    if (heap) SS_FREE(pieces);
+    return SS_OK;
+}
+
+/**
+ * Makes sure that `pieces` is ours alone before we change it. If the array is
+ * shared with a clone, or borrowed from a frozen string, we take our own copy
+ * of it, with our own references to every piece's data.
+ */
+SS_RESULT _ss_unshare_pieces(struct segmented_string *ss) {
+    if (ss->pieces_ref_count == NULL && !ss->borrowed) return SS_OK;
+
+    if (ss->pieces_ref_count != NULL && *ss->pieces_ref_count == 1) {
+        /**
+         * Everyone else has let go already.
+         */
+        SS_FREE(ss->pieces_ref_count);
+        ss->pieces_ref_count = NULL;
+        return SS_OK;
+    }
+
+    struct segmented_string_piece *pieces = (struct segmented_string_piece *)SS_MALLOC(
+        sizeof(struct segmented_string_piece) * ss->capacity
+    );
+    if (pieces == NULL) return SS_ALLOC_ERROR;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        ssp_clone(&pieces[i], &ss->pieces[i]);
+    }
+
+    if (ss->borrowed) {
+        /**
+         * From here on we hold real references, like any other string. The
+         * frozen string's slot table and views stay borrowed: they are
+         * frozen with it, and it outlives us.
+         */
+        _ss_retain_blocks(ss);
+        ss->borrowed = false;
+    } else if (SS_REF_DEC(*ss->pieces_ref_count) == 0) {
+        /**
+         * The other owners were released while we were copying.
+         */
+        _ss_release_pieces(ss->pieces, ss->length, true);
+        SS_FREE(ss->pieces_ref_count);
+    }
+
+    ss->pieces_ref_count = NULL;
+    ss->pieces = pieces;
+
+    return SS_OK;
+}
+
+/**
+ * Releases the pieces of this segmented string. Strings that live in an arena
+ * do not need this at all -- resetting the arena is enough -- unless they have
+ * borrowed heap pieces through `ss_append_ssp`, in which case this gives those
+ * references back without touching the arena.
+ */
 SS_RESULT ss_free(struct segmented_string *ss) {
-    for (uint8_t i = 0; i < ss->length; i++) {
-        SS_RESULT res = ssp_free(&ss->pieces[i]);
+    if (ss->borrowed) {
+        /**
+         * Nothing but our slot state is ours.
+         */
+    } else if (ss->pieces_ref_count != NULL && SS_REF_DEC(*ss->pieces_ref_count) > 0) {
+        /**
+         * A clone is still using the pieces, and will release them.
+         */
+    } else {
+        SS_RESULT res = _ss_release_pieces(ss->pieces, ss->length, ss->arena == NULL);
         if (res != SS_OK) return res;
+
+        SS_FREE(ss->pieces_ref_count);
+    }
+    ss->pieces_ref_count = NULL;
+
+    _ss_drop_slots(ss);
+    _ss_drop_names(ss);
+    _ss_drop_cache(ss);
+
+    if (ss->views != NULL) {
+        if (!ss->borrowed && !_ss_block_is_frozen(&ss->views->frozen) && SS_REF_DEC(ss->views->ref_count) == 0) {
+            SS_FREE(ss->views);
+        }
+        ss->views = NULL;
     }
 
-    free(ss->pieces);
+    if (ss->arena == NULL) {
+        SS_FREE(ss->filled);
+    }
     return SS_OK;
 }
 
@@ -66,18 +508,43 @@ SS_RESULT ss_free(struct segmented_string *ss) {
  * Return String Type: Same as was input.
  */
 void _ss_increment_pieces(struct segmented_string *ss) {
+    if (_ss_unshare_pieces(ss) != SS_OK) {
+        ss->pieces = NULL;
+        return;
+    }
+
+    _ss_pieces_changed(ss);
+
     ss->length++;
     if (ss->length > ss->capacity) {
+        uint32_t old_capacity = ss->capacity;
+        SS_STAT(piece_growths, 1);
+
         if (ss->capacity < 8) {
             ss->capacity = 8;
         } else {
             ss->capacity *= 2;
         }
 
-        ss->pieces = (struct segmented_string_piece *)realloc(
-            ss->pieces,
-            sizeof(struct segmented_string_piece) * ss->capacity
-        );
+        if (ss->arena != NULL) {
+            /**
+             * Arenas can't grow an allocation in place, so we take a fresh
+             * one and leave the old array behind until the arena is reset.
+             */
+            struct segmented_string_piece *pieces = (struct segmented_string_piece *)ss_arena_alloc(
+                ss->arena,
+                sizeof(struct segmented_string_piece) * ss->capacity
+            );
+            if (pieces != NULL && old_capacity > 0) {
+                memcpy(pieces, ss->pieces, sizeof(struct segmented_string_piece) * old_capacity);
+            }
+            ss->pieces = pieces;
+        } else {
+            ss->pieces = (struct segmented_string_piece *)SS_REALLOC(
+                ss->pieces,
+                sizeof(struct segmented_string_piece) * ss->capacity
+            );
+        }
     }
 }
 
@@ -91,15 +558,15 @@ void _ss_increment_pieces(struct segmented_string *ss) {
  * Return String Type: Whatever was passed in.
  */
 SS_RESULT ss_create_initialized(StringType type, int prealloc_amount, struct segmented_string **ss) {
-    *ss = (struct segmented_string *)malloc(
+    *ss = (struct segmented_string *)SS_MALLOC(
         sizeof(struct segmented_string)
     );
     if (*ss == NULL) return SS_ALLOC_ERROR;
 
-    (*ss)->type = type;
+    _ss_init(*ss, type, NULL);
     (*ss)->capacity = prealloc_amount;
     (*ss)->length = 0;
-    (*ss)->pieces = (struct segmented_string_piece *)malloc(
+    (*ss)->pieces = (struct segmented_string_piece *)SS_MALLOC(
         sizeof(struct segmented_string_piece) * prealloc_amount
     );
     if ((*ss)->pieces == NULL) return SS_ALLOC_ERROR;
@@ -107,6 +574,28 @@ SS_RESULT ss_create_initialized(StringType type, int prealloc_amount, struct seg
     return SS_OK;
 }
 
+/**
+ * Same as `ss_create_initialized`, but the header, the pieces and everything
+ * appended later come out of `arena`. Such a string is done with when the
+ * arena is reset; there is no need to `ss_free` it.
+ *
+ * Return String Type: Whatever was passed in.
+ */
+SS_RESULT ss_create_initialized_arena(struct ss_arena *arena, StringType type, int prealloc_amount, struct segmented_string **ss) {
+    *ss = (struct segmented_string *)ss_arena_alloc(
+        arena,
+        sizeof(struct segmented_string) + sizeof(struct segmented_string_piece) * prealloc_amount
+    );
+    if (*ss == NULL) return SS_ALLOC_ERROR;
+
+    _ss_init(*ss, type, arena);
+    (*ss)->capacity = prealloc_amount;
+    (*ss)->length = 0;
+    (*ss)->pieces = (struct segmented_string_piece *)(*ss + 1);
+
+    return SS_OK;
+}
+
 /**
  * Create an entirely uninitialized segmented string. This is likely not what
  * you want to do, as it is inefficient. In practice you should know the size
@@ -115,7 +604,7 @@ SS_RESULT ss_create_initialized(StringType type, int prealloc_amount, struct seg
  * Return String Type: EMPTY_STRING
  */
 SS_RESULT ss_create(struct segmented_string **ss) {
-    *ss = (struct segmented_string *)malloc(
+    *ss = (struct segmented_string *)SS_MALLOC(
         sizeof(struct segmented_string)
     );
     if (*ss == NULL) return SS_ALLOC_ERROR;
@@ -128,7 +617,27 @@ SS_RESULT ss_create(struct segmented_string **ss) {
      * If EMPTY_STRING were equivalent to zero, I could also just zero the
      * entire structure!
      */
-    (*ss)->type = EMPTY_STRING;
+    _ss_init(*ss, EMPTY_STRING, NULL);
+    (*ss)->length = 0;
+    (*ss)->capacity = 0;
+    (*ss)->pieces = NULL;
+
+    return SS_OK;
+}
+
+/**
+ * Same as `ss_create`, but in `arena`.
+ *
+ * Return String Type: EMPTY_STRING
+ */
+SS_RESULT ss_create_arena(struct ss_arena *arena, struct segmented_string **ss) {
+    *ss = (struct segmented_string *)ss_arena_alloc(
+        arena,
+        sizeof(struct segmented_string)
+    );
+    if (*ss == NULL) return SS_ALLOC_ERROR;
+
+    _ss_init(*ss, EMPTY_STRING, arena);
     (*ss)->length = 0;
     (*ss)->capacity = 0;
     (*ss)->pieces = NULL;
@@ -145,6 +654,7 @@ SS_RESULT ss_create(struct segmented_string **ss) {
  *                     EMPTY_STRING, turns into STATIC_STRING.
  */
 SS_RESULT ss_append_static_copy(struct segmented_string *ss, const char *value, int length) {
+    if (ss->frozen) return SS_FROZEN;
     switch(ss->type) {
         case UNFILLED_TEMPLATE_STRING:
         case PARTIALLY_FILLED_TEMPLATE_STRING:
@@ -163,112 +673,678 @@ SS_RESULT ss_append_static_copy(struct segmented_string *ss, const char *value,
     }
 
     _ss_increment_pieces(ss);
-    ssp_init_static_copy(&ss->pieces[ss->length - 1], value, length);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
 
-    return SS_OK;
+    if (ss->arena != NULL) {
+        return ssp_init_static_copy_arena(ss->arena, &ss->pieces[ss->length - 1], value, length);
+    }
+    return ssp_init_static_copy(&ss->pieces[ss->length - 1], value, length);
 }
 
 /**
- * Same as `ss_append_static_copy`, but take a NULL-terminated string rather
- * than a length.
+ * Same as `ss_append_static_copy`, but for fragments that are created over and
+ * over: the data is interned, so every string that appends the same bytes
+ * shares one copy of them instead of allocating its own.
+ *
+ * Input String Type: ANY
+ * Output String Type: Same as `ss_append_static_copy`.
  */
-SS_RESULT ss_append_static_copy_static(struct segmented_string *ss, const char *value) {
-    return ss_append_static_copy(ss, value, strlen(value));
+SS_RESULT ss_append_static_interned(struct segmented_string *ss, const char *value, uint32_t length) {
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->type == EMPTY_STRING) {
+        ss->type = STATIC_STRING;
+    }
+
+    _ss_increment_pieces(ss);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
+
+    return ssp_init_static_interned(&ss->pieces[ss->length - 1], value, length);
 }
 
 /**
- * Takes a segmented_string_piece and appends it to this segmented_string.
+ * Same as `ss_append_static_copy`, but without the copy: the piece points
+ * straight at `value`, and only its header is allocated.
+ *
+ * The bytes stay the caller's. They must not change or go away for as long as
+ * this string, any clone of it, any string it has been concatenated into, or
+ * any list exploded from any of those is still around. That is easy for
+ * string literals (see `ss_append_static_literal`) and buffers that live for
+ * the whole program, such as a loaded template file, and easy to get wrong for
+ * anything else.
+ *
+ * Input String Type: ANY
+ * Output String Type: Same as `ss_append_static_copy`.
  */
-SS_RESULT ss_append_ssp(struct segmented_string *ss, struct segmented_string_piece *ssp) {
-    _ss_increment_pieces(ss);
-
-    switch (ssp->type) {
-        case STRING_PIECE_TYPE_STATIC:
-            {
-                ss->pieces[ss->length - 1].type = STRING_PIECE_TYPE_STATIC;
-                ss->pieces[ss->length - 1].data.static_string = ssp->data.static_string;
-                ss->pieces[ss->length - 1].data.static_string->ref_count++;
+SS_RESULT ss_append_static_borrow(struct segmented_string *ss, const char *value, uint32_t length) {
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->type == EMPTY_STRING) {
+        ss->type = STATIC_STRING;
+    }
 
-                switch (ss->type) {
-                    case EMPTY_STRING:
-                        {
-                            ss->type = STATIC_STRING;
-                        }
-                        break;
-                }
-            }
-            return SS_OK;
-        case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
-            {
-                // TODO: This should be able to alter our own type.
-                ss->pieces[ss->length - 1].type = STRING_PIECE_TYPE_PLACEHOLDER_UINT8;
-                ss->pieces[ss->length - 1].data.uint8_data.placeholder = ssp->data.uint8_data.placeholder;
-                ss->pieces[ss->length - 1].data.uint8_data.value = ssp->data.uint8_data.value;
+    _ss_increment_pieces(ss);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
 
-                switch (ss->type) {
-                    case EMPTY_STRING:
-                        {
-                            ss->type = UNFILLED_TEMPLATE_STRING;
-                        }
-                        break;
-                    case FULLY_FILLED_TEMPLATE_STRING:
-                        {
-                            ss->type = PARTIALLY_FILLED_TEMPLATE_STRING;
-                        }
-                        break;
-                    case STATIC_STRING:
-                        {
-                            ss->type = UNFILLED_TEMPLATE_STRING;
-                        }
-                        break;
-                }
-            }
-            return SS_OK;
-        default:
-            return SS_INVALID_STRING_TYPE;
+    if (ss->arena != NULL) {
+        return ssp_init_static_borrow_arena(ss->arena, &ss->pieces[ss->length - 1], value, length);
     }
+    return ssp_init_static_borrow(&ss->pieces[ss->length - 1], value, length);
 }
 
 /**
- * One of our library methods. Similar to `explode` in PHP.
- *
- * Given a segmented_string and a char, turns things into a STRING_LIST split
- * by that character.
- *
- * TODO: This doesn't work entirely correctly.
- *       It doesn't do what you want if this was already a split string
- *           (possibly as the result of a template substitution)
+ * Appends `sd` as a static piece, taking a reference to it.
  */
-SS_RESULT ss_explode_by_char(struct segmented_string *ss, char c, struct segmented_string *out) {
-    switch (ss->type) {
-        case UNFILLED_TEMPLATE_STRING:
-        case PARTIALLY_FILLED_TEMPLATE_STRING:
-        case STRING_LIST:
+SS_RESULT _ss_append_static_sd(struct segmented_string *ss, struct string_data *sd) {
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->type == EMPTY_STRING) {
+        ss->type = STATIC_STRING;
+    }
+
+    _ss_increment_pieces(ss);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
+
+    struct segmented_string_piece *ssp = &ss->pieces[ss->length - 1];
+    ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->data.static_string = sd;
+    ssp->length = sd_length(sd);
+    sd_retain(sd);
+
+    return SS_OK;
+}
+
+/**
+ * Freezes a literal's header the first time its line runs, caching its
+ * fragment hash first the way `ss_freeze` does, then appends it. Threads
+ * racing through the first run all store the same hash and the same flag.
+ */
+SS_RESULT _ss_append_static_literal_sd(struct segmented_string *ss, struct string_data *sd) {
+    if (!sd_is_frozen(sd)) {
+        _sd_store_hash(sd, sd_poly_hash_bytes(0, sd->data, sd->length) | 1ULL << 63);
+        sd_freeze(sd);
+    }
+    return _ss_append_static_sd(ss, sd);
+}
+
+/**
+ * Appends a string literal with no copy and no allocation beyond the pieces
+ * array. The length is known at compile time, and each place this is used
+ * gets one string_data header of its own, in static storage, that is marked
+ * STRING_FROZEN (with its hash cached) before it is first used: a literal
+ * already lives for the rest of the process, so the header is never
+ * reference counted or freed, and every string appended to from that line
+ * shares it.
+ *
+ * `literal` has to be an actual string literal; anything else fails to
+ * compile. For other memory that outlives the string, use
+ * `ss_append_static_borrow`.
+ *
+ * The header is declared inside a statement expression, a GNU extension.
+ * Other compilers get `ss_append_static_borrow` instead, which still doesn't
+ * copy the literal but allocates a header every time.
+ *
+ * Input String Type: ANY
+ * Output String Type: Same as `ss_append_static_copy`.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define ss_append_static_literal(ss, literal) \
+    ({ \
+        static struct string_data _ss_literal_sd = { \
+            .data = (char *)("" literal ""), \
+            .length = sizeof(literal) - 1, \
+            .ref_count = 1, \
+            .flags = STRING_DATA_ASCII | STRING_EXTERNAL_HEADER, \
+            .inline_data = { 0 } \
+        }; \
+        _ss_append_static_literal_sd((ss), &_ss_literal_sd); \
+    })
+#else
+#define ss_append_static_literal(ss, literal) \
+    ss_append_static_borrow((ss), ("" literal ""), sizeof(literal) - 1)
+#endif
+
+/**
+ * Same as `ss_append_static_copy`, but take a NULL-terminated string rather
+ * than a length.
+ */
+SS_RESULT ss_append_static_copy_static(struct segmented_string *ss, const char *value) {
+    return ss_append_static_copy(ss, value, strlen(value));
+}
+
+/**
+ * Works out our type from how many of our slots are still unfilled.
+ */
+void _ss_update_template_type(struct segmented_string *ss) {
+    if (ss->unfilled_slots == 0) {
+        ss->type = FULLY_FILLED_TEMPLATE_STRING;
+    } else if (ss->unfilled_slots == ss->slot_count) {
+        ss->type = UNFILLED_TEMPLATE_STRING;
+    } else {
+        ss->type = PARTIALLY_FILLED_TEMPLATE_STRING;
+    }
+}
+
+/**
+ * Bytes in the one allocation holding the slot state for `capacity` slots.
+ */
+size_t _ss_slot_state_size(uint32_t capacity) {
+    size_t words = (capacity + 63) / 64;
+    return sizeof(uint64_t) * words + sizeof(union ss_value) * capacity + capacity;
+}
+
+/**
+ * Points our slot state at `block`, laid out for `capacity` slots.
+ */
+void _ss_slot_state_bind(struct segmented_string *ss, void *block, uint32_t capacity) {
+    size_t words = (capacity + 63) / 64;
+
+    ss->filled = (uint64_t *)block;
+    ss->values = (union ss_value *)(ss->filled + words);
+    ss->slot_types = (uint8_t *)(ss->values + capacity);
+}
+
+/**
+ * Gives the placeholder `ssp`, whose name we don't have yet, a new, unfilled
+ * slot.
+ */
+SS_RESULT _ss_new_slot(struct segmented_string *ss, struct segmented_string_piece *ssp) {
+    if (ss->slot_count == ss->slot_capacity) {
+        uint32_t capacity = ss->slot_capacity < 8 ? 8 : ss->slot_capacity * 2;
+
+        void *block = _ss_alloc(ss, _ss_slot_state_size(capacity));
+        if (block == NULL) return SS_ALLOC_ERROR;
+
+        uint64_t *old_filled = ss->filled;
+        union ss_value *old_values = ss->values;
+        uint8_t *old_types = ss->slot_types;
+        _ss_slot_state_bind(ss, block, capacity);
+
+        memset(ss->filled, 0, sizeof(uint64_t) * ((capacity + 63) / 64));
+        if (ss->slot_count > 0) {
+            memcpy(ss->filled, old_filled, sizeof(uint64_t) * ((ss->slot_count + 63) / 64));
+            memcpy(ss->values, old_values, sizeof(union ss_value) * ss->slot_count);
+            memcpy(ss->slot_types, old_types, ss->slot_count);
+        }
+
+        if (ss->arena == NULL) SS_FREE(old_filled);
+        ss->slot_capacity = capacity;
+    }
+
+    /**
+     * The compiled index doesn't know the new name.
+     */
+    _ss_drop_slots(ss);
+
+    ssp->slot = ss->slot_count;
+    ss->values[ss->slot_count].u = 0;
+    ss->slot_types[ss->slot_count] = (uint8_t)ssp->type;
+    ss->slot_count++;
+    ss->unfilled_slots++;
+
+    if (ss->names != NULL && ssp->slot < ss->names->slot_count) {
+        _ss_slot_table_add(ss->names, ssp->slot, ssp->data.placeholder_data.placeholder);
+    } else {
+        _ss_drop_names(ss);
+    }
+
+    _ss_update_template_type(ss);
+    return SS_OK;
+}
+
+/**
+ * Makes sure `ss->names` knows every slot we have and has room for one more.
+ * It is built from the pieces the first time, then grown by doubling, so
+ * each append only looks at its own name. `ss->pieces[ss->length - 1]` is
+ * the placeholder being appended and isn't looked at.
+ */
+SS_RESULT _ss_reserve_names(struct segmented_string *ss) {
+    if (ss->names != NULL && ss->slot_count < ss->names->slot_count) return SS_OK;
+
+    uint32_t capacity = ss->slot_count < 4 ? 8 : ss->slot_count * 2;
+    struct ss_slot_table *names;
+    SS_RESULT res = _ss_slot_table_create(ss->arena, capacity, &names);
+    if (res != SS_OK) return res;
+
+    if (ss->names != NULL) {
+        for (uint32_t slot = 0; slot < ss->slot_count; slot++) {
+            _ss_slot_table_add(names, slot, ss->names->slots[slot].name);
+        }
+    } else {
+        /**
+         * Slot ids were handed out in order of first appearance, as in
+         * `ss_compile`.
+         */
+        uint32_t named = 0;
+        for (uint32_t i = 0; i + 1 < ss->length && named < ss->slot_count; i++) {
+            struct segmented_string_piece *ssp = &ss->pieces[i];
+            if (!ssp_is_template(ssp) || ssp->slot != named) continue;
+
+            _ss_slot_table_add(names, named, ssp->data.placeholder_data.placeholder);
+            named++;
+        }
+    }
+
+    _ss_drop_names(ss);
+    ss->names = names;
+    return SS_OK;
+}
+
+/**
+ * Gives the placeholder `ssp`, which has just been appended to `ss`, its slot:
+ * the slot of an earlier placeholder with the same name, or a new, unfilled
+ * one. Our type follows from that. Earlier names are found in `ss->names`
+ * rather than by looking at every earlier piece, so building a template one
+ * append at a time stays linear.
+ *
+ * A name can only be used with one placeholder type. If the earlier
+ * placeholder has a different type, `ssp` is taken off again and this
+ * returns SS_INVALID_STRING_TYPE.
+ */
+SS_RESULT _ss_assign_slot(struct segmented_string *ss, struct segmented_string_piece *ssp) {
+    SS_RESULT res = _ss_reserve_names(ss);
+    if (res != SS_OK) {
+        ssp_free(ssp);
+        ss->length--;
+        return res;
+    }
+
+    uint32_t found = _ss_slot_table_find(ss->names, ssp->data.placeholder_data.placeholder);
+    if (found != 0) {
+        if (ss->slot_types[found - 1] != ssp->type) {
+            ssp_free(ssp);
+            ss->length--;
             return SS_INVALID_STRING_TYPE;
-        
-        case EMPTY_STRING:
-            // A split empty string is still an empty string.
-            break;
-        
-        case FULLY_FILLED_TEMPLATE_STRING:
-        case STATIC_STRING:
+        }
+
+        ssp->slot = found - 1;
+        _ss_update_template_type(ss);
+        return SS_OK;
+    }
+
+    return _ss_new_slot(ss, ssp);
+}
+
+/**
+ * Takes a segmented_string_piece and appends it to this segmented_string.
+ */
+SS_RESULT ss_append_ssp(struct segmented_string *ss, struct segmented_string_piece *ssp) {
+    if (ss->frozen) return SS_FROZEN;
+    _ss_increment_pieces(ss);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
+
+    switch (ssp->type) {
+        case STRING_PIECE_TYPE_STATIC:
             {
-                SS_RESULT res = ss_create(&out);
-                if (res != SS_OK) return res;
+                struct string_data *sd = ssp->data.static_string;
+
+                if ((sd->flags & (STRING_EXTERNAL_HEADER | STRING_FROZEN)) == STRING_EXTERNAL_HEADER) {
+                    /**
+                     * The header lives in memory that somebody else frees
+                     * (an arena, or the view block of a list from
+                     * `ss_explode_by_char`), whatever its reference count
+                     * says, so we take a header of our own for the same
+                     * bytes. The bytes themselves still have to outlive us.
+                     */
+                    struct string_data *own;
+                    SS_RESULT res = ss->arena != NULL
+                        ? sd_create_borrow_arena(ss->arena, sd->data, sd_length(sd), &own)
+                        : sd_create_borrow(sd->data, sd_length(sd), &own);
+                    if (res != SS_OK) {
+                        ss->length--;
+                        return res;
+                    }
+
+                    uint8_t encoding = STRING_DATA_ASCII | STRING_DATA_UTF8;
+                    own->flags = (own->flags & ~encoding) | (sd->flags & encoding);
+                    sd = own;
+                } else {
+                    sd_retain(sd);
+                }
 
-                out->type = STRING_LIST;
+                ss->pieces[ss->length - 1].type = STRING_PIECE_TYPE_STATIC;
+                ss->pieces[ss->length - 1].data.static_string = sd;
+                ss->pieces[ss->length - 1].length = ssp->length;
+
+                switch (ss->type) {
+                    case EMPTY_STRING:
+                        {
+                            ss->type = STATIC_STRING;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            return SS_OK;
+        case STRING_PIECE_TYPE_NESTED:
+            {
+                ss->pieces[ss->length - 1] = *ssp;
+                _ss_nested_retain(ssp->data.nested);
 
-                for (uint8_t i = 0; i < ss->length; i++) {
-                    ssp_explode_by_char(&ss->pieces[i], out, c);
+                if (ss->depth < ssp->data.nested->ss.depth + 1) {
+                    ss->depth = ssp->data.nested->ss.depth + 1;
                 }
+                if (ss->type == EMPTY_STRING) ss->type = STATIC_STRING;
+            }
+            return SS_OK;
+        default:
+            {
+                if (!ssp_is_template(ssp)) return SS_INVALID_STRING_TYPE;
+
+                /**
+                 * The piece keeps its name and type but not its slot, which
+                 * belonged to whatever string it came from. It arrives
+                 * unfilled.
+                 */
+                ss->pieces[ss->length - 1].type = ssp->type;
+                ss->pieces[ss->length - 1].data.placeholder_data.placeholder = ssp->data.placeholder_data.placeholder;
+                sd_retain(ss->pieces[ss->length - 1].data.placeholder_data.placeholder);
 
-                return SS_OK;
+                return _ss_assign_slot(ss, &ss->pieces[ss->length - 1]);
             }
+    }
+}
+
+/**
+ * Adds `sd` to the end of a list that we know has room for it, taking over
+ * the caller's reference.
+ */
+void _ss_list_push(struct segmented_string *list, struct string_data *sd) {
+    struct segmented_string_piece *ssp = &list->pieces[list->length];
+    ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->data.static_string = sd;
+    ssp->length = sd_length(sd);
+    list->length++;
+}
+
+/**
+ * Called by `ss_for_each_span` with each run of bytes in turn. `source` is the
+ * string_data the bytes live in when they are a static piece's data, and NULL
+ * when they were formatted into a scratch buffer that is only good until the
+ * callback returns.
+ */
+typedef SS_RESULT (*ss_span_fn)(void *ctx, const char *data, size_t length, struct string_data *source);
+
+/**
+ * Walks the bytes this string renders to, in order, one piece's worth at a
+ * time, without rendering them anywhere. Nested pieces are walked into, so
+ * the callback only ever sees static data and formatted placeholders, and
+ * how the string happens to be segmented doesn't matter to it. A callback
+ * that returns anything but SS_OK stops the walk, and that is what is
+ * returned.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_for_each_span(struct segmented_string *ss, ss_span_fn fn, void *ctx) {
+    switch (ss->type) {
+        case FULLY_FILLED_TEMPLATE_STRING:
+        case STATIC_STRING:
+        case EMPTY_STRING:
+            break;
+        default:
+            return SS_INVALID_STRING_TYPE;
+    }
+
+    char scratch[SSP_SCRATCH_SIZE];
+    const char *data;
+    size_t length;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+        SS_RESULT res;
+
+        if (ssp->type == STRING_PIECE_TYPE_NESTED) {
+            res = ss_for_each_span(&ssp->data.nested->ss, fn, ctx);
+        } else if (ssp->type == STRING_PIECE_TYPE_PLACEHOLDER_STRING) {
+            res = _ss_value_enter();
+            if (res != SS_OK) return res;
+
+            res = ss_for_each_span(ss->values[ssp->slot].s, fn, ctx);
+            _ss_value_leave();
+        } else {
+            res = ssp_bytes(ssp, ss->values, scratch, &data, &length);
+            if (res != SS_OK) return res;
+
+            res = fn(ctx, data, length, ssp->type == STRING_PIECE_TYPE_STATIC ? ssp->data.static_string : NULL);
+        }
+        if (res != SS_OK) return res;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Buffer that collects the bytes of a field that spans more than one piece.
+ */
+struct _ss_explode_pending {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+SS_RESULT _ss_explode_pending_append(struct _ss_explode_pending *pending, const char *data, size_t length) {
+    if (pending->length + length > pending->capacity) {
+        size_t capacity = pending->capacity < 64 ? 64 : pending->capacity;
+        while (capacity < pending->length + length) capacity *= 2;
+
+        char *grown = (char *)SS_REALLOC(pending->data, capacity);
+        if (grown == NULL) return SS_ALLOC_ERROR;
+
+        pending->data = grown;
+        pending->capacity = capacity;
+    }
+
+    memcpy(pending->data + pending->length, data, length);
+    pending->length += length;
+
+    return SS_OK;
+}
+
+/**
+ * Emits `data[start, end)` as the next field. If the whole field came from a
+ * single static piece it becomes a view into that piece's string_data, using
+ * the next header in `views`. Otherwise it finishes off whatever is pending
+ * and becomes an owned copy.
+ */
+SS_RESULT _ss_explode_emit(
+    struct segmented_string *list,
+    struct _ss_explode_pending *pending,
+    struct string_data *source,
+    const char *data,
+    size_t start,
+    size_t end
+) {
+    if (pending->length == 0 && source != NULL) {
+        struct string_data *view = &list->views->views[list->views->count];
+        list->views->count++;
+
+        /**
+         * The view is only as permanent as the list: it is neither frozen nor
+         * interned, whatever its source is.
+         */
+        uint8_t dropped = STRING_OWNS_DATA | STRING_CSTRING | STRING_INLINE_DATA | STRING_FROZEN | STRING_INTERNED;
+        view->flags = (source->flags & ~dropped) | STRING_EXTERNAL_HEADER;
+        view->ref_count = 1;
+        view->length = end - start;
+        view->data = source->data + start;
+        _sd_clear_hash(view);
+
+        _ss_list_push(list, view);
+        return SS_OK;
+    }
+
+    SS_RESULT res = _ss_explode_pending_append(pending, data + start, end - start);
+    if (res != SS_OK) return res;
+
+    struct string_data *copy;
+    res = sd_create_copy(pending->data, pending->length, &copy);
+    if (res != SS_OK) return res;
+
+    pending->length = 0;
+    _ss_list_push(list, copy);
+    return SS_OK;
+}
+
+/**
+ * The state of an explode as the spans go by.
+ *
+ * The bytes after the last delimiter in a static span, `tail` from
+ * `tail_start` on, are held back rather than copied straight into `pending`:
+ * if no more bytes follow them, they are the whole last field, and can still
+ * be a view.
+ */
+struct _ss_explode_state {
+    struct segmented_string *list;
+    char c;
+    size_t field_count;
+    size_t view_count;
+
+    struct _ss_explode_pending pending;
+    struct string_data *tail;
+    size_t tail_start;
+};
+
+SS_RESULT _ss_explode_count_span(void *arg, const char *data, size_t length, struct string_data *source) {
+    struct _ss_explode_state *state = (struct _ss_explode_state *)arg;
+
+    size_t delimiters = ss_count_char(data, length, state->c);
+    state->field_count += delimiters;
+    if (source != NULL) state->view_count += delimiters + 1;
+
+    return SS_OK;
+}
+
+/**
+ * Moves the held back tail into `pending`: more bytes are on the way.
+ */
+SS_RESULT _ss_explode_flush_tail(struct _ss_explode_state *state) {
+    if (state->tail == NULL) return SS_OK;
+
+    SS_RESULT res = _ss_explode_pending_append(
+        &state->pending,
+        state->tail->data + state->tail_start,
+        sd_length(state->tail) - state->tail_start
+    );
+    state->tail = NULL;
+    return res;
+}
+
+SS_RESULT _ss_explode_span(void *arg, const char *data, size_t length, struct string_data *source) {
+    struct _ss_explode_state *state = (struct _ss_explode_state *)arg;
+    SS_RESULT res = _ss_explode_flush_tail(state);
+    if (res != SS_OK) return res;
+
+    size_t start = 0;
+    while (true) {
+        size_t hit = start + ss_find_char(data + start, length - start, state->c);
+        if (hit == length) break;
+
+        res = _ss_explode_emit(state->list, &state->pending, source, data, start, hit);
+        if (res != SS_OK) return res;
+
+        start = hit + 1;
+    }
+
+    /**
+     * Whatever is left after the last delimiter is either the final field
+     * or the start of one that carries on into the next span. Formatted
+     * bytes don't outlive this call, so only static ones can wait.
+     */
+    if (source == NULL) {
+        return _ss_explode_pending_append(&state->pending, data + start, length - start);
+    }
+
+    state->tail = source;
+    state->tail_start = start;
+    return SS_OK;
+}
+
+/**
+ * One of our library methods. Similar to `explode` in PHP.
+ *
+ * Given a segmented_string and a char, creates a new STRING_LIST in `*out`
+ * split by that character. `a,,b` gives three fields, the middle one empty.
+ *
+ * Delimiters are found with SIMD scans (see simd.h). A first pass counts them
+ * so that the list's pieces and all of the view headers are each allocated
+ * exactly once. Fields that fall entirely inside one static piece are views
+ * into that piece's data: no copy and no allocation of their own. Fields that
+ * cross a piece boundary, or that include a filled placeholder, have to be
+ * stitched together and become owned copies. Both passes go through
+ * `ss_for_each_span`, so nested pieces split like any others.
+ *
+ * The views borrow from `ss`, which therefore has to outlive the list. This is
+ * the same contract as `sd_create_from`.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ * Return String Type: STRING_LIST (EMPTY_STRING for EMPTY_STRING)
+ */
+SS_RESULT ss_explode_by_char(struct segmented_string *ss, char c, struct segmented_string **out) {
+    switch (ss->type) {
+        case UNFILLED_TEMPLATE_STRING:
+        case PARTIALLY_FILLED_TEMPLATE_STRING:
+        case STRING_LIST:
+            return SS_INVALID_STRING_TYPE;
+
+        case EMPTY_STRING:
+            // A split empty string is still an empty string.
+            return ss_create(out);
+
+        case FULLY_FILLED_TEMPLATE_STRING:
+        case STATIC_STRING:
+            break;
+
         default:
             return SS_INVALID_STRING_TYPE;
     }
 
-    return SS_ERR;
+    /**
+     * Every delimiter adds a field. Only fields inside static pieces can be
+     * views, so that bounds how many headers we need.
+     */
+    struct _ss_explode_state state;
+    memset(&state, 0, sizeof(state));
+    state.c = c;
+    state.field_count = 1;
+
+    SS_RESULT res = ss_for_each_span(ss, _ss_explode_count_span, &state);
+    if (res != SS_OK) return res;
+    if (state.field_count > UINT32_MAX) return SS_ERR;
+
+    res = ss_create_initialized(STRING_LIST, state.field_count, out);
+    if (res != SS_OK) return res;
+    state.list = *out;
+
+    (*out)->views = (struct ss_view_block *)SS_MALLOC(
+        sizeof(struct ss_view_block) + sizeof(struct string_data) * state.view_count
+    );
+    if ((*out)->views == NULL) {
+        res = SS_ALLOC_ERROR;
+    } else {
+        (*out)->views->ref_count = 1;
+        (*out)->views->count = 0;
+        (*out)->views->frozen = false;
+
+        res = ss_for_each_span(ss, _ss_explode_span, &state);
+    }
+
+    if (res == SS_OK) {
+        if (state.tail != NULL) {
+            res = _ss_explode_emit(*out, &state.pending, state.tail, state.tail->data, state.tail_start, sd_length(state.tail));
+        } else {
+            res = _ss_explode_emit(*out, &state.pending, NULL, "", 0, 0);
+        }
+    }
+
+    SS_FREE(state.pending.data);
+
+    if (res != SS_OK) {
+        /**
+         * Whatever fields we got to are let go with the list.
+         */
+        ss_free(*out);
+        SS_FREE(*out);
+        *out = NULL;
+    }
+    return res;
 }
 
 /**
@@ -283,16 +1359,16 @@ SS_RESULT ss_print(struct segmented_string *ss) {
         case UNFILLED_TEMPLATE_STRING:
             {
                 printf("unfilled_template_string:");
-                for (uint8_t i = 0; i < ss->length; i++) {
-                    ssp_print(&ss->pieces[i]);
+                for (uint32_t i = 0; i < ss->length; i++) {
+                    ssp_print(&ss->pieces[i], ss->values);
                 }
             }
             break;
         case PARTIALLY_FILLED_TEMPLATE_STRING:
             {
                 printf("partially_filled_template_string:");
-                for (uint8_t i = 0; i < ss->length; i++) {
-                    ssp_print(&ss->pieces[i]);
+                for (uint32_t i = 0; i < ss->length; i++) {
+                    ssp_print(&ss->pieces[i], ss->values);
                 }
             }
             break;
@@ -306,25 +1382,25 @@ SS_RESULT ss_print(struct segmented_string *ss) {
                  * metadata.
                  */
                 printf("fully_filled_template_string:");
-                for (uint8_t i = 0; i < ss->length; i++) {
-                    ssp_print(&ss->pieces[i]);
+                for (uint32_t i = 0; i < ss->length; i++) {
+                    ssp_print(&ss->pieces[i], ss->values);
                 }
             }
             break;
         case STATIC_STRING:
             {
                 printf("static_string:");
-                for (uint8_t i = 0; i < ss->length; i++) {
-                    ssp_print(&ss->pieces[i]);
+                for (uint32_t i = 0; i < ss->length; i++) {
+                    ssp_print(&ss->pieces[i], ss->values);
                 }
             }
             break;
         case STRING_LIST:
             {
                 printf("string_list:");
-                for (uint8_t i = 0; i < ss->length; i++) {
+                for (uint32_t i = 0; i < ss->length; i++) {
                     printf("\n\t");
-                    ssp_print(&ss->pieces[i]);
+                    ssp_print(&ss->pieces[i], ss->values);
                 }
                 printf("\n");
             }
@@ -344,65 +1420,864 @@ SS_RESULT ss_print(struct segmented_string *ss) {
     return SS_OK;
 }
 
-SS_RESULT ss_fill_uint8(struct segmented_string *ss, const char *placeholder, uint8_t value) {
+/**
+ * Helper for the render functions. Only strings where every piece has a value
+ * can be rendered; a template with holes in it has no meaningful output.
+ */
+bool _ss_is_renderable(struct segmented_string *ss) {
     switch (ss->type) {
-        case PARTIALLY_FILLED_TEMPLATE_STRING:
-        case UNFILLED_TEMPLATE_STRING:
-            break;
+        case FULLY_FILLED_TEMPLATE_STRING:
+        case STATIC_STRING:
+        case EMPTY_STRING:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Works out exactly how many bytes `ss_render_into` will write. Static pieces
+ * contribute their length, placeholders the width of their formatted value.
+ * No terminating NULL is included.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_render_length(struct segmented_string *ss, size_t *length) {
+    if (!_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+
+    size_t total = 0;
+    for (uint32_t i = 0; i < ss->length; i++) {
+        size_t piece_length;
+        SS_RESULT res = ssp_render_length(&ss->pieces[i], ss->values, &piece_length);
+        if (res != SS_OK) return res;
+
+        total += piece_length;
+    }
+
+    *length = total;
+    return SS_OK;
+}
+
+/**
+ * Renders this segmented string into a caller supplied buffer in a single
+ * linear pass. This is the fast alternative to `ss_print`: there is no stdio
+ * involved, static pieces are copied with `memcpy` and placeholders are
+ * formatted inline.
+ *
+ * The usual pattern is `ss_render_length`, allocate, `ss_render_into`. If
+ * `capacity` turns out to be too small, SS_BUFFER_TOO_SMALL is returned and
+ * the contents of `buf` are unspecified. No terminating NULL is written.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_render_into(struct segmented_string *ss, char *buf, size_t capacity, size_t *written) {
+    if (!_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+
+    char *cursor = buf;
+    char *end = buf + capacity;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        /**
+         * The piece types are handled right here rather than through
+         * ssp_render_length and ssp_render_into: everything static pieces and
+         * placeholders need is in the piece or the slot values, and the per
+         * piece calls were most of the cost for short pieces. Nested strings
+         * check their own room as they go.
+         */
+        switch (ssp->type) {
+            case STRING_PIECE_TYPE_STATIC:
+                {
+                    if (ssp->length > (size_t)(end - cursor)) return SS_BUFFER_TOO_SMALL;
+                    memcpy(cursor, ssp->data.static_string->data, ssp->length);
+                    cursor += ssp->length;
+                }
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
+                {
+                    uint8_t value = (uint8_t)ss->values[ssp->slot].u;
+                    if (_ssp_uint8_width(value) > (size_t)(end - cursor)) return SS_BUFFER_TOO_SMALL;
+                    cursor = _ssp_format_uint8(cursor, value);
+                }
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_UINT16:
+            case STRING_PIECE_TYPE_PLACEHOLDER_UINT32:
+            case STRING_PIECE_TYPE_PLACEHOLDER_UINT64:
+                {
+                    uint64_t value = ss->values[ssp->slot].u;
+                    if (_ssp_uint64_width(value) > (size_t)(end - cursor)) return SS_BUFFER_TOO_SMALL;
+                    cursor = _ssp_format_uint64(cursor, value);
+                }
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_INT8:
+            case STRING_PIECE_TYPE_PLACEHOLDER_INT16:
+            case STRING_PIECE_TYPE_PLACEHOLDER_INT32:
+            case STRING_PIECE_TYPE_PLACEHOLDER_INT64:
+                {
+                    int64_t value = ss->values[ssp->slot].i;
+                    if (_ssp_int64_width(value) > (size_t)(end - cursor)) return SS_BUFFER_TOO_SMALL;
+                    cursor = _ssp_format_int64(cursor, value);
+                }
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE:
+                {
+                    /**
+                     * Working out a double's width means formatting it, so
+                     * it is formatted once, to the side.
+                     */
+                    char scratch[SSP_DOUBLE_MAX_WIDTH];
+                    size_t length = _ssp_format_double(scratch, ss->values[ssp->slot].d) - scratch;
+                    if (length > (size_t)(end - cursor)) return SS_BUFFER_TOO_SMALL;
+                    memcpy(cursor, scratch, length);
+                    cursor += length;
+                }
+                break;
+            case STRING_PIECE_TYPE_PLACEHOLDER_STRING:
+                {
+                    SS_RESULT res = _ss_value_enter();
+                    if (res != SS_OK) return res;
+
+                    size_t inner_written;
+                    res = ss_render_into(ss->values[ssp->slot].s, cursor, end - cursor, &inner_written);
+                    _ss_value_leave();
+                    if (res != SS_OK) return res;
+                    cursor += inner_written;
+                }
+                break;
+            case STRING_PIECE_TYPE_NESTED:
+                {
+                    size_t inner_written;
+                    SS_RESULT res = ss_render_into(&ssp->data.nested->ss, cursor, end - cursor, &inner_written);
+                    if (res != SS_OK) return res;
+                    cursor += inner_written;
+                }
+                break;
+            default:
+                return SS_INVALID_STRING_TYPE;
+        }
+    }
+
+    *written = cursor - buf;
+    return SS_OK;
+}
+
+/**
+ * Whether a string placeholder appears anywhere in this string, nested
+ * strings included: the only thing that can change what a nested string
+ * renders to.
+ */
+bool _ss_has_string_placeholders(struct segmented_string *ss) {
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        if (ssp->type == STRING_PIECE_TYPE_PLACEHOLDER_STRING) return true;
+        if (ssp->type == STRING_PIECE_TYPE_NESTED && _ss_has_string_placeholders(&ssp->data.nested->ss)) return true;
+    }
+
+    return false;
+}
+
+/**
+ * Makes sure the cache can hold `length` bytes, keeping what is there. The
+ * buffer is allocated even for an empty rendering, so `ss_render_cached`
+ * never hands out a NULL `*data` and nothing is ever copied to NULL.
+ */
+SS_RESULT _ss_cache_reserve(struct ss_render_cache *cache, size_t length) {
+    if (length <= cache->capacity && cache->data != NULL) return SS_OK;
+
+    size_t capacity = cache->capacity < 64 ? 64 : cache->capacity;
+    while (capacity < length) capacity *= 2;
+
+    char *data = (char *)SS_REALLOC(cache->data, capacity);
+    if (data == NULL) return SS_ALLOC_ERROR;
+
+    cache->data = data;
+    cache->capacity = capacity;
+    return SS_OK;
+}
+
+/**
+ * Renders the whole string into the cache, noting where every span lands.
+ */
+SS_RESULT _ss_cache_rebuild(struct segmented_string *ss, struct ss_render_cache *cache) {
+    size_t length;
+    SS_RESULT res = ss_render_length(ss, &length);
+    if (res != SS_OK) return res;
+
+    res = _ss_cache_reserve(cache, length);
+    if (res != SS_OK) return res;
+
+    if (ss->length > cache->span_capacity) {
+        struct ss_render_span *spans = (struct ss_render_span *)SS_REALLOC(
+            cache->spans,
+            sizeof(struct ss_render_span) * ss->length
+        );
+        if (spans == NULL) return SS_ALLOC_ERROR;
+
+        cache->spans = spans;
+        cache->span_capacity = ss->length;
+    }
+
+    uint32_t words = (ss->slot_count + 63) / 64;
+    if (words > cache->dirty_words) {
+        uint64_t *dirty = (uint64_t *)SS_REALLOC(cache->dirty, sizeof(uint64_t) * words);
+        if (dirty == NULL) return SS_ALLOC_ERROR;
+
+        cache->dirty = dirty;
+        cache->dirty_words = words;
+    }
+    if (words > 0) memset(cache->dirty, 0, sizeof(uint64_t) * words);
+
+    cache->span_count = 0;
+    cache->volatile_spans = false;
+    char *cursor = cache->data;
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        bool span = _ssp_is_placeholder_type(ssp->type);
+        if (ssp->type == STRING_PIECE_TYPE_PLACEHOLDER_STRING) {
+            cache->volatile_spans = true;
+        } else if (ssp->type == STRING_PIECE_TYPE_NESTED && _ss_has_string_placeholders(&ssp->data.nested->ss)) {
+            cache->volatile_spans = true;
+            span = true;
+        }
+
+        char *end;
+        res = ssp_render_into(ssp, ss->values, cursor, &end);
+        if (res != SS_OK) return res;
+
+        if (span) {
+            struct ss_render_span *s = &cache->spans[cache->span_count++];
+            s->offset = cursor - cache->data;
+            s->length = end - cursor;
+            s->piece = i;
+        }
+
+        cursor = end;
+    }
+
+    cache->length = cursor - cache->data;
+    cache->any_dirty = false;
+    cache->valid = true;
+    return SS_OK;
+}
+
+/**
+ * Re-renders the spans that may have changed since the last render, walking
+ * the spans in order. A span that keeps its width is overwritten in place.
+ * One that changes width first moves everything after it along with a
+ * single `memmove`, and the offsets of the later spans are corrected as the
+ * walk reaches them.
+ */
+SS_RESULT _ss_cache_patch(struct segmented_string *ss, struct ss_render_cache *cache) {
+    char scratch[SSP_SCRATCH_SIZE];
+    ptrdiff_t shift = 0;
+
+    for (uint32_t i = 0; i < cache->span_count; i++) {
+        struct ss_render_span *s = &cache->spans[i];
+        struct segmented_string_piece *ssp = &ss->pieces[s->piece];
+        s->offset += shift;
+
+        struct segmented_string *inner = NULL;
+        size_t length;
+
+        if (ssp->type == STRING_PIECE_TYPE_NESTED || ssp->type == STRING_PIECE_TYPE_PLACEHOLDER_STRING) {
+            inner = ssp->type == STRING_PIECE_TYPE_NESTED ? &ssp->data.nested->ss : ss->values[ssp->slot].s;
+
+            SS_RESULT res = ss_render_length(inner, &length);
+            if (res != SS_OK) return res;
+        } else if ((cache->dirty[ssp->slot / 64] >> (ssp->slot % 64)) & 1) {
+            length = _ssp_format_value(ssp->type, ss->values[ssp->slot], scratch) - scratch;
+        } else {
+            continue;
+        }
+
+        if (length != s->length) {
+            size_t tail = s->offset + s->length;
+            size_t new_length = cache->length - s->length + length;
+
+            SS_RESULT res = _ss_cache_reserve(cache, new_length);
+            if (res != SS_OK) return res;
+
+            memmove(cache->data + s->offset + length, cache->data + tail, cache->length - tail);
+            shift += (ptrdiff_t)length - (ptrdiff_t)s->length;
+            cache->length = new_length;
+            s->length = length;
+        }
+
+        if (inner != NULL) {
+            size_t written;
+            SS_RESULT res = ss_render_into(inner, cache->data + s->offset, length, &written);
+            if (res != SS_OK) return res;
+        } else {
+            memcpy(cache->data + s->offset, scratch, length);
+        }
+    }
+
+    memset(cache->dirty, 0, sizeof(uint64_t) * cache->dirty_words);
+    cache->any_dirty = false;
+    return SS_OK;
+}
+
+/**
+ * Renders this segmented string into a buffer that it keeps, and keeps it
+ * up to date from one render to the next instead of starting again.
+ * `*data` points at the rendering and `*length` is its length, with no
+ * terminating NULL. The buffer belongs to the string and is good until the
+ * string next changes, is rendered again, or is freed.
+ *
+ * The first call renders everything and notes where each placeholder
+ * landed. Filling a slot after that marks the slot dirty (filling it with
+ * the value it already has doesn't), and the next call only formats the
+ * placeholders of dirty slots, writing them over their old text when the
+ * width is unchanged and moving the rest of the rendering along when it
+ * isn't. A mostly static document costs O(placeholders + changed bytes) to
+ * re-render rather than O(total bytes). Appending anything throws the
+ * cached rendering away, and the next call starts again.
+ *
+ * We can't tell when a borrowed string placeholder's value changes, so
+ * string placeholders, and nested strings with one inside, are re-rendered
+ * every time.
+ *
+ * The cache lives on the heap whether or not the string is in an arena,
+ * and needs `ss_free`. Frozen strings return SS_FROZEN: they may be
+ * rendered from many threads at once, and this writes to the string.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ */
+SS_RESULT ss_render_cached(struct segmented_string *ss, const char **data, size_t *length) {
+    if (ss->frozen) return SS_FROZEN;
+    if (!_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+
+    if (ss->cache == NULL) {
+        ss->cache = (struct ss_render_cache *)SS_CALLOC(1, sizeof(struct ss_render_cache));
+        if (ss->cache == NULL) return SS_ALLOC_ERROR;
+    }
+
+    struct ss_render_cache *cache = ss->cache;
+    SS_RESULT res = SS_OK;
+
+    if (!cache->valid) {
+        res = _ss_cache_rebuild(ss, cache);
+    } else if (cache->any_dirty || cache->volatile_spans) {
+        res = _ss_cache_patch(ss, cache);
+    }
+
+    if (res != SS_OK) {
+        /**
+         * Whatever state the rendering was left in, start again next time.
+         */
+        cache->valid = false;
+        return res;
+    }
+
+    *data = cache->data;
+    *length = cache->length;
+    return SS_OK;
+}
+
+bool _ss_slot_is_filled(struct segmented_string *ss, uint32_t slot) {
+    return (ss->filled[slot / 64] >> (slot % 64)) & 1;
+}
+
+/**
+ * Builds the name -> slot hash index for this template, so that
+ * `ss_slot_lookup` and `ss_fill_uint8` find a slot without comparing the name
+ * against every placeholder.
+ *
+ * Compiling is a one time cost per template. Clones share the index, so slot
+ * ids can be cached by the caller and reused on every clone. Appending a
+ * placeholder with a new name throws the index away (static appends, and
+ * placeholders reusing a name, keep it).
+ *
+ * Valid String Types: UNFILLED_TEMPLATE_STRING, PARTIALLY_FILLED_TEMPLATE_STRING,
+ *                     FULLY_FILLED_TEMPLATE_STRING
+ */
+SS_RESULT ss_compile(struct segmented_string *ss) {
+    if (ss->frozen) return SS_FROZEN;
+    switch (ss->type) {
+        case UNFILLED_TEMPLATE_STRING:
+        case PARTIALLY_FILLED_TEMPLATE_STRING:
+        case FULLY_FILLED_TEMPLATE_STRING:
+            break;
         default:
             return SS_INVALID_STRING_TYPE;
     }
 
-    bool has_unfilled = false;
+    _ss_drop_slots(ss);
 
-    for (uint8_t i = 0; i < ss->length; i++) {
-        if (ssp_is_template(&ss->pieces[i])) {
-            if (ssp_is_template_uint8(&ss->pieces[i], placeholder)) {
-                ssp_fill_uint8(&ss->pieces[i], value);
-            } else {
-                has_unfilled = true;
-            }
+    struct ss_slot_table *table;
+    SS_RESULT res = _ss_slot_table_create(ss->arena, ss->slot_count, &table);
+    if (res != SS_OK) return res;
+
+    /**
+     * Slot ids were handed out in order of first appearance, so the first
+     * placeholder we see for a slot we haven't named yet is its name.
+     */
+    uint32_t named = 0;
+    for (uint32_t i = 0; i < ss->length && named < ss->slot_count; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+        if (!ssp_is_template(ssp) || ssp->slot != named) continue;
+
+        _ss_slot_table_add(table, named, ssp->data.placeholder_data.placeholder);
+        named++;
+    }
+
+    ss->slots = table;
+    return SS_OK;
+}
+
+/**
+ * Resolves a placeholder name to its slot id. The id stays valid for this
+ * template and all of its clones for as long as the slot table is kept.
+ */
+SS_RESULT ss_slot_lookup(struct segmented_string *ss, const char *placeholder, uint32_t *slot) {
+    if (ss->slots == NULL) return SS_NOT_COMPILED;
+
+    struct ss_slot_table *table = ss->slots;
+    size_t length = strlen(placeholder);
+    uint64_t hash = sd_hash_bytes(placeholder, length);
+    uint32_t bucket = hash & table->bucket_mask;
+
+    while (table->buckets[bucket] != 0) {
+        struct ss_slot *candidate = &table->slots[table->buckets[bucket] - 1];
+        if (candidate->hash == hash && sd_is_equal_bytes(candidate->name, placeholder, length)) {
+            *slot = table->buckets[bucket] - 1;
+            return SS_OK;
         }
+
+        bucket = (bucket + 1) & table->bucket_mask;
     }
 
-    if (has_unfilled) {
-        ss->type = PARTIALLY_FILLED_TEMPLATE_STRING;
+    return SS_UNKNOWN_PLACEHOLDER;
+}
+
+/**
+ * Fills every placeholder belonging to `slot`. This is the O(1) fill: one
+ * store into our slot values, no names compared and no pieces touched, which
+ * is also why filling never has to unshare pieces from a clone. Filling an
+ * already filled slot just overwrites the value. `type` has to be the type
+ * of the slot's placeholders.
+ */
+SS_RESULT _ss_fill_slot(struct segmented_string *ss, uint32_t slot, enum StringPieceType type, union ss_value value) {
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->slot_count == 0) return SS_INVALID_STRING_TYPE;
+    if (slot >= ss->slot_count) return SS_UNKNOWN_PLACEHOLDER;
+    if (ss->slot_types[slot] != type) return SS_INVALID_STRING_TYPE;
+
+    /**
+     * A valid cache means every slot has a value already, to compare with.
+     */
+    if (ss->cache != NULL && ss->cache->valid && ss->values[slot].u != value.u) {
+        ss->cache->dirty[slot / 64] |= (uint64_t)1 << (slot % 64);
+        ss->cache->any_dirty = true;
+    }
+
+    ss->values[slot] = value;
+
+    if (!_ss_slot_is_filled(ss, slot)) {
+        ss->filled[slot / 64] |= (uint64_t)1 << (slot % 64);
+        ss->unfilled_slots--;
+    }
+
+    _ss_update_template_type(ss);
+    return SS_OK;
+}
+
+/**
+ * Fills every placeholder called `placeholder`. If the string has been
+ * compiled, the slot is found with a hash lookup; callers in a hot loop should
+ * do the lookup once themselves and fill by slot. Otherwise we check the name
+ * against our placeholders until we find one (by pointer, for interned
+ * names). Filling a name we don't have is not an error; filling one with a
+ * value of the wrong type is SS_INVALID_STRING_TYPE.
+ */
+SS_RESULT _ss_fill(struct segmented_string *ss, const char *placeholder, enum StringPieceType type, union ss_value value) {
+    switch (ss->type) {
+        case UNFILLED_TEMPLATE_STRING:
+        case PARTIALLY_FILLED_TEMPLATE_STRING:
+        case FULLY_FILLED_TEMPLATE_STRING:
+            break;
+        default:
+            return SS_INVALID_STRING_TYPE;
+    }
+
+    if (ss->slots != NULL) {
+        uint32_t slot;
+        SS_RESULT res = ss_slot_lookup(ss, placeholder, &slot);
+
+        if (res == SS_UNKNOWN_PLACEHOLDER) return SS_OK;
+        if (res != SS_OK) return res;
+
+        return _ss_fill_slot(ss, slot, type, value);
+    }
+
+    /**
+     * If the name has been interned, so have the placeholders that use it, and
+     * we can match them by pointer.
+     */
+    struct string_data *name = sd_intern_shared_find(placeholder, strlen(placeholder));
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        bool matches = name != NULL
+            ? ssp_is_template_named_sd(&ss->pieces[i], name)
+            : ssp_is_template_named(&ss->pieces[i], placeholder);
+
+        if (matches) {
+            return _ss_fill_slot(ss, ss->pieces[i].slot, type, value);
+        }
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Fills the slot `slot`, whose placeholders are uint8 placeholders (see
+ * `_ss_fill_slot`).
+ *
+ * Valid String Types: UNFILLED_TEMPLATE_STRING, PARTIALLY_FILLED_TEMPLATE_STRING,
+ *                     FULLY_FILLED_TEMPLATE_STRING
+ * Output String Type: PARTIALLY_FILLED_TEMPLATE_STRING or FULLY_FILLED_TEMPLATE_STRING
+ */
+SS_RESULT ss_fill_slot_uint8(struct segmented_string *ss, uint32_t slot, uint8_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_UINT8, v);
+}
+
+/**
+ * Fills every uint8 placeholder called `placeholder` (see `_ss_fill`).
+ */
+SS_RESULT ss_fill_uint8(struct segmented_string *ss, const char *placeholder, uint8_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_UINT8, v);
+}
+
+/**
+ * The same pair for each of the other placeholder types. Each fills only
+ * placeholders of its own type.
+ */
+SS_RESULT ss_fill_slot_uint16(struct segmented_string *ss, uint32_t slot, uint16_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_UINT16, v);
+}
+
+SS_RESULT ss_fill_uint16(struct segmented_string *ss, const char *placeholder, uint16_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_UINT16, v);
+}
+
+SS_RESULT ss_fill_slot_uint32(struct segmented_string *ss, uint32_t slot, uint32_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_UINT32, v);
+}
+
+SS_RESULT ss_fill_uint32(struct segmented_string *ss, const char *placeholder, uint32_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_UINT32, v);
+}
+
+SS_RESULT ss_fill_slot_uint64(struct segmented_string *ss, uint32_t slot, uint64_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_UINT64, v);
+}
+
+SS_RESULT ss_fill_uint64(struct segmented_string *ss, const char *placeholder, uint64_t value) {
+    union ss_value v = { .u = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_UINT64, v);
+}
+
+SS_RESULT ss_fill_slot_int8(struct segmented_string *ss, uint32_t slot, int8_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_INT8, v);
+}
+
+SS_RESULT ss_fill_int8(struct segmented_string *ss, const char *placeholder, int8_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_INT8, v);
+}
+
+SS_RESULT ss_fill_slot_int16(struct segmented_string *ss, uint32_t slot, int16_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_INT16, v);
+}
+
+SS_RESULT ss_fill_int16(struct segmented_string *ss, const char *placeholder, int16_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_INT16, v);
+}
+
+SS_RESULT ss_fill_slot_int32(struct segmented_string *ss, uint32_t slot, int32_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_INT32, v);
+}
+
+SS_RESULT ss_fill_int32(struct segmented_string *ss, const char *placeholder, int32_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_INT32, v);
+}
+
+SS_RESULT ss_fill_slot_int64(struct segmented_string *ss, uint32_t slot, int64_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_INT64, v);
+}
+
+SS_RESULT ss_fill_int64(struct segmented_string *ss, const char *placeholder, int64_t value) {
+    union ss_value v = { .i = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_INT64, v);
+}
+
+SS_RESULT ss_fill_slot_double(struct segmented_string *ss, uint32_t slot, double value) {
+    union ss_value v = { .d = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE, v);
+}
+
+SS_RESULT ss_fill_double(struct segmented_string *ss, const char *placeholder, double value) {
+    union ss_value v = { .d = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE, v);
+}
+
+/**
+ * String placeholders are filled with another segmented string, which is
+ * rendered in their place. It is not copied: it has to stay alive, and
+ * renderable, until we are no longer rendered, and it must not contain us.
+ * If it does, or values go more than SS_VALUE_MAX_DEPTH deep, rendering us
+ * returns SS_ERR (see `_ss_value_enter`). Clones of us use the same string.
+ * To take a copy instead, render it and fill with the text, or `ss_concat`
+ * it. A NULL `value` is SS_ERR, and leaves the slot as it was.
+ */
+SS_RESULT ss_fill_slot_string(struct segmented_string *ss, uint32_t slot, struct segmented_string *value) {
+    if (value == NULL) return SS_ERR;
+
+    union ss_value v = { .s = value };
+    return _ss_fill_slot(ss, slot, STRING_PIECE_TYPE_PLACEHOLDER_STRING, v);
+}
+
+SS_RESULT ss_fill_string(struct segmented_string *ss, const char *placeholder, struct segmented_string *value) {
+    if (value == NULL) return SS_ERR;
+
+    union ss_value v = { .s = value };
+    return _ss_fill(ss, placeholder, STRING_PIECE_TYPE_PLACEHOLDER_STRING, v);
+}
+
+/**
+ * Copies our slot state into a fresh allocation for `out`.
+ */
+SS_RESULT _ss_copy_slot_state(struct segmented_string *out, struct segmented_string *in) {
+    out->slot_count = in->slot_count;
+    out->slot_capacity = in->slot_count;
+    out->unfilled_slots = in->unfilled_slots;
+    if (in->slot_count == 0) return SS_OK;
+
+    void *block = _ss_alloc(out, _ss_slot_state_size(in->slot_count));
+    if (block == NULL) return SS_ALLOC_ERROR;
+    _ss_slot_state_bind(out, block, in->slot_count);
+
+    memcpy(out->filled, in->filled, sizeof(uint64_t) * ((in->slot_count + 63) / 64));
+    memcpy(out->values, in->values, sizeof(union ss_value) * in->slot_count);
+    memcpy(out->slot_types, in->slot_types, in->slot_count);
+
+    return SS_OK;
+}
+
+/**
+ * Everything `ss_clone` does apart from allocating the header.
+ */
+SS_RESULT _ss_clone_into(struct segmented_string *in, struct segmented_string *out) {
+    SS_STAT(ss_clones, 1);
+
+    _ss_init(out, in->type, NULL);
+    out->length = in->length;
+    out->capacity = in->capacity;
+    out->depth = in->depth;
+
+    if (in->frozen || in->borrowed) {
+        /**
+         * Nothing about `in` is written to: not even a reference count.
+         */
+        out->pieces = in->pieces;
+        out->slots = in->slots;
+        out->views = in->views;
+        out->borrowed = true;
+
+        return _ss_copy_slot_state(out, in);
+    }
+
+    /**
+     * This is the one step that can fail on its own, so it goes before
+     * anything is shared and there is nothing to take back from `in`.
+     */
+    SS_RESULT res = _ss_copy_slot_state(out, in);
+    if (res != SS_OK) return res;
+
+    if (in->length == 0) {
+        out->capacity = 0;
+        out->pieces = NULL;
+    } else if (in->arena != NULL) {
+        out->pieces = (struct segmented_string_piece *)SS_MALLOC(
+            sizeof(struct segmented_string_piece) * out->capacity
+        );
+        if (out->pieces == NULL) {
+            SS_FREE(out->filled);
+            return SS_ALLOC_ERROR;
+        }
+
+        for (uint32_t i = 0; i < out->length; i++) {
+            ssp_clone(&(out->pieces[i]), &in->pieces[i]);
+        }
     } else {
-        ss->type = FULLY_FILLED_TEMPLATE_STRING;
+        if (in->pieces_ref_count == NULL) {
+            uint32_t *ref_count = (uint32_t *)SS_MALLOC(sizeof(uint32_t));
+            if (ref_count == NULL) {
+                SS_FREE(out->filled);
+                return SS_ALLOC_ERROR;
+            }
+
+            *ref_count = 1;
+            in->pieces_ref_count = ref_count;
+        }
+
+        SS_REF_INC(*in->pieces_ref_count);
+        out->pieces = in->pieces;
+        out->pieces_ref_count = in->pieces_ref_count;
     }
 
+    out->slots = in->slots;
+    out->views = in->views;
+    _ss_retain_blocks(out);
+
     return SS_OK;
 }
 
 /**
- * Clones a segmented string into a brand new copy. Currently it is exactly the
- * same except the segmented string pieces are also cloned, so their memory
- * addresses are different, but their contents should be the same.
+ * Clones a segmented string. The clone is copy-on-write: it shares the pieces
+ * array with `in`, and the only thing actually copied is the slot values,
+ * which is all that filling changes. Whichever of the two strings appends to
+ * its pieces first takes a private copy of them at that point. The slot index
+ * and views are shared by reference count as usual.
  *
- * TODO: I could probably save some space/time if I integrated some sort of COW
- *       semantics here. Right now I'm agressively copying data away.
+ * The clone always lives on the heap. The pieces array of an arena string is
+ * copied rather than shared, as a heap clone can't reference count or free
+ * an array in the arena. The copied pieces still point at the arena's
+ * headers and bytes, so the clone is invalid after a reset like anything
+ * else pointing into the arena (see `struct ss_arena`). Clones of a frozen
+ * string borrow instead (see `ss_freeze`).
  */
 SS_RESULT ss_clone(struct segmented_string *in, struct segmented_string **out) {
-    *out = (struct segmented_string *)malloc(
+    *out = (struct segmented_string *)SS_MALLOC(
         sizeof(struct segmented_string)
     );
     if (*out == NULL) return SS_ALLOC_ERROR;
 
-    (*out)->type   = in->type;
-    (*out)->length = in->length;
-    (*out)->capacity = in->capacity;
-    (*out)->pieces = (struct segmented_string_piece *)malloc(
-        sizeof(struct segmented_string_piece) * (*out)->capacity
-    );
-    if ((*out)->pieces == NULL) return SS_ALLOC_ERROR;
+    SS_RESULT res = _ss_clone_into(in, *out);
+    if (res != SS_OK) {
+        SS_FREE(*out);
+        *out = NULL;
+    }
+    return res;
+}
+
+/**
+ * Makes this string immutable so that it can be shared between threads: a
+ * template is built and compiled once, frozen, and then cloned and rendered on
+ * every core.
+ *
+ * Every string_data we use is marked STRING_FROZEN, our slot index and views
+ * are marked frozen, and every string nested in us is frozen too, which takes
+ * them out of reference counting for good; it lives for the rest of the
+ * process, and so does any string_data it shares with other strings (interned
+ * names, for instance). Cloning a frozen string writes nothing to it, so any
+ * number of threads can clone it at once with no synchronization at all, as
+ * long as it outlives every clone. The clones are ordinary strings owned by
+ * the thread that made them, and appending to or compacting one doesn't write
+ * to the frozen string either.
+ *
+ * Freezing is for good, and it reaches past us: string_data and nested
+ * strings we share with strings that are not frozen are frozen as well, and
+ * are never freed, even once every string using them has been. Freeze a
+ * template built for the purpose rather than one whose parts are still in use
+ * elsewhere. In SS_THREAD_SAFE builds the other strings may be retaining
+ * and releasing those parts on other threads while we freeze them; the flags
+ * are set atomically (see `sd_freeze`).
+ *
+ * Static data has its fragment hash cached on the way (see `ss_hash`), as
+ * nothing can write it into a frozen string_data later; that makes freezing
+ * O(bytes) rather than O(pieces).
+ *
+ * Appending, filling, compiling and `ss_render_cached` on a frozen string
+ * return SS_FROZEN.
+ *
+ * Valid String Types: All
+ */
+SS_RESULT ss_freeze(struct segmented_string *ss) {
+    if (ss->frozen) return SS_OK;
 
-    for (uint8_t i = 0; i < (*out)->length; i++) {
-        ssp_clone(&((*out)->pieces[i]), &in->pieces[i]);
+    if (ss->pieces_ref_count != NULL) {
+        SS_RESULT res = _ss_unshare_pieces(ss);
+        if (res != SS_OK) return res;
+    }
+
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+
+        if (ssp->type == STRING_PIECE_TYPE_NESTED) {
+            SS_RESULT res = ss_freeze(&ssp->data.nested->ss);
+            if (res != SS_OK) return res;
+        } else if (ssp_is_template(ssp)) {
+            sd_freeze(ssp->data.placeholder_data.placeholder);
+        } else {
+            /**
+             * Last chance to cache the fragment hash (see `sd_fragment_hash`).
+             */
+            if (!sd_is_frozen(ssp->data.static_string)) sd_fragment_hash(ssp->data.static_string);
+            sd_freeze(ssp->data.static_string);
+        }
     }
 
+    if (ss->slots != NULL) _ss_block_freeze(&ss->slots->frozen);
+    if (ss->views != NULL) _ss_block_freeze(&ss->views->frozen);
+
+    _ss_drop_names(ss);
+#ifdef SS_THREAD_SAFE
+    __atomic_store_n(&ss->frozen, true, __ATOMIC_RELEASE);
+#else
+    ss->frozen = true;
+#endif
     return SS_OK;
 }
 
+/**
+ * Appends a placeholder of `type` called `placeholder[0, length)`. A name
+ * that is already in use with another type is SS_INVALID_STRING_TYPE.
+ */
+SS_RESULT _ss_append_placeholder(struct segmented_string *ss, enum StringPieceType type, const char *placeholder, uint32_t length) {
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->type == STRING_LIST) return SS_INVALID_STRING_TYPE;
+
+    _ss_increment_pieces(ss);
+    if (ss->pieces == NULL) return SS_ALLOC_ERROR;
+
+    struct segmented_string_piece *ssp = &ss->pieces[ss->length - 1];
+    SS_RESULT res;
+    if (ss->arena != NULL) {
+        res = ssp_init_placeholder_arena(ss->arena, ssp, type, placeholder, length);
+    } else {
+        res = ssp_init_placeholder(ssp, type, placeholder, length);
+    }
+    if (res != SS_OK) return res;
+
+    return _ss_assign_slot(ss, ssp);
+}
+
+/**
+ * Same as `ss_append_placeholder_uint8`, with the name given as `length` bytes
+ * that need not be NULL terminated.
+ */
+SS_RESULT ss_append_placeholder_uint8_bytes(struct segmented_string *ss, const char *placeholder, uint32_t length) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_UINT8, placeholder, length);
+}
+
 /**
  * Append a placeholder for a unit8 onto this list. This may change the "type"
  * of the segmented string.
@@ -411,36 +2286,495 @@ SS_RESULT ss_clone(struct segmented_string *in, struct segmented_string **out) {
  * Input String Transformation: STATIC_STRING | EMPTy_STRING -> UNFILLED_TEMPLATE_STRING
  */
 SS_RESULT ss_append_placeholder_uint8(struct segmented_string *ss, const char *placeholder) {
-    switch(ss->type) {
-        case UNFILLED_TEMPLATE_STRING:
-        case PARTIALLY_FILLED_TEMPLATE_STRING:
-            {
+    return ss_append_placeholder_uint8_bytes(ss, placeholder, strlen(placeholder));
+}
 
-            }
-            break;
+/**
+ * The same for the other placeholder types. Integers render in decimal,
+ * doubles as the shortest text that reads back as the same double (see
+ * `_ssp_format_double`), and strings as whatever string they are filled with
+ * (see `ss_fill_string`).
+ */
+SS_RESULT ss_append_placeholder_uint16(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_UINT16, placeholder, strlen(placeholder));
+}
 
-        case FULLY_FILLED_TEMPLATE_STRING:
-            {
-                ss->type = PARTIALLY_FILLED_TEMPLATE_STRING;
-            }
-            break;
+SS_RESULT ss_append_placeholder_uint32(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_UINT32, placeholder, strlen(placeholder));
+}
 
-        case STATIC_STRING:
-        case EMPTY_STRING:
-            {
-                ss->type = UNFILLED_TEMPLATE_STRING;
-            }
-            break;
+SS_RESULT ss_append_placeholder_uint64(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_UINT64, placeholder, strlen(placeholder));
+}
 
-        case STRING_LIST:
-            {
-                return SS_INVALID_STRING_TYPE;
+SS_RESULT ss_append_placeholder_int8(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_INT8, placeholder, strlen(placeholder));
+}
+
+SS_RESULT ss_append_placeholder_int16(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_INT16, placeholder, strlen(placeholder));
+}
+
+SS_RESULT ss_append_placeholder_int32(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_INT32, placeholder, strlen(placeholder));
+}
+
+SS_RESULT ss_append_placeholder_int64(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_INT64, placeholder, strlen(placeholder));
+}
+
+SS_RESULT ss_append_placeholder_double(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE, placeholder, strlen(placeholder));
+}
+
+SS_RESULT ss_append_placeholder_string(struct segmented_string *ss, const char *placeholder) {
+    return _ss_append_placeholder(ss, STRING_PIECE_TYPE_PLACEHOLDER_STRING, placeholder, strlen(placeholder));
+}
+
+/**
+ * A nested string can be frozen by one holder while others are still
+ * retaining and releasing it (see `ss_freeze`), hence the atomic load.
+ */
+bool _ss_nested_is_frozen(struct ss_nested *nested) {
+#ifdef SS_THREAD_SAFE
+    return __atomic_load_n(&nested->ss.frozen, __ATOMIC_ACQUIRE);
+#else
+    return nested->ss.frozen;
+#endif
+}
+
+void _ss_nested_retain(struct ss_nested *nested) {
+    if (_ss_nested_is_frozen(nested)) return;
+    SS_REF_INC(nested->ref_count);
+}
+
+SS_RESULT _ss_nested_release(struct ss_nested *nested) {
+    if (_ss_nested_is_frozen(nested)) return SS_OK;
+    if (SS_REF_DEC(nested->ref_count) > 0) return SS_OK;
+
+    SS_RESULT res = ss_free(&nested->ss);
+    SS_FREE(nested);
+    return res;
+}
+
+SS_RESULT _ss_string_print(struct segmented_string *ss) {
+    for (uint32_t i = 0; i < ss->length; i++) {
+        SS_RESULT res = ssp_print(&ss->pieces[i], ss->values);
+        if (res != SS_OK) return res;
+    }
+    return SS_OK;
+}
+
+SS_RESULT _ss_string_render_length(struct segmented_string *ss, size_t *length) {
+    return ss_render_length(ss, length);
+}
+
+/**
+ * `ssp_render_into` has no capacity to check against: its caller has already
+ * made room for `ssp_render_length` bytes.
+ */
+SS_RESULT _ss_string_render_into(struct segmented_string *ss, char *buf, char **end) {
+    size_t length;
+    SS_RESULT res = ss_render_length(ss, &length);
+    if (res != SS_OK) return res;
+
+    size_t written;
+    res = ss_render_into(ss, buf, length, &written);
+    if (res != SS_OK) return res;
+
+    *end = buf + written;
+    return SS_OK;
+}
+
+SS_RESULT _ss_nested_print(struct ss_nested *nested) {
+    return _ss_string_print(&nested->ss);
+}
+
+SS_RESULT _ss_nested_render_length(struct ss_nested *nested, size_t *length) {
+    return _ss_string_render_length(&nested->ss, length);
+}
+
+SS_RESULT _ss_nested_render_into(struct ss_nested *nested, char *buf, char **end) {
+    return _ss_string_render_into(&nested->ss, buf, end);
+}
+
+/**
+ * Renders `b` and appends the result to `a` as a single static piece. This is
+ * how `ss_concat` rebalances: a string that is already nested too deeply is
+ * flattened into a leaf rather than linked in.
+ */
+SS_RESULT _ss_concat_flattened(struct segmented_string *a, struct segmented_string *b) {
+    size_t length;
+    SS_RESULT res = ss_render_length(b, &length);
+    if (res != SS_OK) return res;
+    if (length > INT32_MAX) return SS_ERR;
+
+    char *data = (char *)SS_MALLOC(length == 0 ? 1 : length);
+    if (data == NULL) return SS_ALLOC_ERROR;
+
+    size_t written;
+    res = ss_render_into(b, data, length, &written);
+    if (res == SS_OK) res = ss_append_static_copy(a, data, written);
+
+    SS_FREE(data);
+    return res;
+}
+
+/**
+ * Appends all of `b` to `a` in constant time, however many pieces `b` has:
+ * `a` gets one nested piece holding a copy-on-write clone of `b`, so `b`'s
+ * pieces are shared rather than copied, and `b` can go on being changed or
+ * freed without affecting `a`. Rendering walks into the nested piece as it
+ * goes; nothing is flattened up front. `b` is cloned as it is now, so later
+ * fills of `b` don't show up in `a`.
+ *
+ * This is a shallow rope. Concatenating onto the same string over and over
+ * keeps it one level deep. Nesting strings that are themselves nested adds a
+ * level each time, and once `b` would take `a` past SS_CONCAT_MAX_DEPTH, `b`
+ * is rendered into a single static piece instead, which is the one case that
+ * costs O(length of b).
+ *
+ * Like `ss_append_ssp`, a string in an arena that has had anything
+ * concatenated onto it needs `ss_free` to give the nested strings back.
+ *
+ * Valid String Types (a): All but STRING_LIST
+ * Valid String Types (b): FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ * Output String Type: Same as `a`, unless `a` was EMPTY_STRING, in which case
+ *                     STATIC_STRING.
+ */
+SS_RESULT ss_concat(struct segmented_string *a, struct segmented_string *b) {
+    if (a->frozen) return SS_FROZEN;
+    if (a->type == STRING_LIST) return SS_INVALID_STRING_TYPE;
+    if (!_ss_is_renderable(b)) return SS_INVALID_STRING_TYPE;
+
+    if (b->length == 0) return SS_OK;
+
+    /**
+     * A single static piece is cheaper to share directly than to nest.
+     */
+    if (b->length == 1 && b->pieces[0].type == STRING_PIECE_TYPE_STATIC) {
+        return ss_append_ssp(a, &b->pieces[0]);
+    }
+
+    if (b->depth >= SS_CONCAT_MAX_DEPTH) {
+        return _ss_concat_flattened(a, b);
+    }
+
+    struct segmented_string_piece ssp;
+    ssp.type = STRING_PIECE_TYPE_NESTED;
+    ssp.length = 0;
+    ssp.data.nested = (struct ss_nested *)SS_MALLOC(sizeof(struct ss_nested));
+    if (ssp.data.nested == NULL) return SS_ALLOC_ERROR;
+
+    ssp.data.nested->ref_count = 1;
+    SS_RESULT res = _ss_clone_into(b, &ssp.data.nested->ss);
+    if (res != SS_OK) {
+        SS_FREE(ssp.data.nested);
+        return res;
+    }
+
+    res = ss_append_ssp(a, &ssp);
+
+    /**
+     * `a` has its own reference now.
+     */
+    _ss_nested_release(ssp.data.nested);
+    return res;
+}
+
+/**
+ * Pieces `ss_compact` can merge with their neighbours: static data, nested
+ * strings that can't change under us (a string placeholder anywhere inside
+ * one can), and with `values`, every placeholder.
+ */
+bool _ss_compact_mergeable(struct segmented_string_piece *ssp, bool values) {
+    switch (ssp->type) {
+        case STRING_PIECE_TYPE_STATIC:
+            return true;
+        case STRING_PIECE_TYPE_NESTED:
+            return values || !_ss_has_string_placeholders(&ssp->data.nested->ss);
+        default:
+            return values;
+    }
+}
+
+/**
+ * The run of pieces starting at `start` that `ss_compact` turns into one
+ * piece: it ends at `*end` and renders to `*length` bytes. `*keep` says the
+ * run is a single piece that stays as it is. Otherwise the run becomes one
+ * new static piece, or nothing at all if it renders to nothing.
+ */
+SS_RESULT _ss_compact_run(struct segmented_string *ss, uint32_t start, bool values, uint32_t *end, size_t *length, bool *keep) {
+    *end = start + 1;
+    *length = 0;
+    *keep = true;
+    if (!_ss_compact_mergeable(&ss->pieces[start], values)) return SS_OK;
+
+    uint32_t i = start;
+    while (i < ss->length && _ss_compact_mergeable(&ss->pieces[i], values)) {
+        size_t piece_length;
+        SS_RESULT res = ssp_render_length(&ss->pieces[i], ss->values, &piece_length);
+        if (res != SS_OK) return res;
+
+        *length += piece_length;
+        i++;
+    }
+    if (*length > UINT32_MAX) return SS_ERR;
+
+    *end = i;
+    *keep = i == start + 1 && ss->pieces[start].type == STRING_PIECE_TYPE_STATIC && *length > 0;
+    return SS_OK;
+}
+
+/**
+ * Gives back what merged runs `_ss_compact` made, up to `made` pieces into
+ * `pieces`, when it can't finish.
+ */
+void _ss_compact_unwind(struct segmented_string *ss, struct segmented_string_piece *pieces, uint32_t made, bool values) {
+    uint32_t end;
+    size_t length;
+    bool keep;
+
+    bool shared = ss->pieces_ref_count != NULL || ss->borrowed;
+
+    for (uint32_t i = 0, k = 0; k < made; i = end) {
+        _ss_compact_run(ss, i, values, &end, &length, &keep);
+        if (keep && !shared) {
+            k++;
+        } else if (keep || length > 0) {
+            ssp_free(&pieces[k++]);
+        }
+    }
+}
+
+SS_RESULT _ss_compact(struct segmented_string *ss, bool values) {
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->type == STRING_LIST) return SS_INVALID_STRING_TYPE;
+    if (values && !_ss_is_renderable(ss)) return SS_INVALID_STRING_TYPE;
+
+    uint32_t end;
+    size_t length;
+    bool keep;
+
+    /**
+     * Nothing is changed until everything that can fail has worked: first
+     * how many pieces there will be and how long the longest new one is.
+     */
+    uint32_t count = 0;
+    size_t longest = 0;
+    bool changed = false;
+    for (uint32_t i = 0; i < ss->length; i = end) {
+        SS_RESULT res = _ss_compact_run(ss, i, values, &end, &length, &keep);
+        if (res != SS_OK) return res;
+
+        if (!keep) changed = true;
+        if (keep || length > 0) count++;
+        if (!keep && length > longest) longest = length;
+    }
+    if (!changed && !values) return SS_OK;
+
+    if (ss->pieces_ref_count != NULL && *ss->pieces_ref_count == 1) {
+        SS_FREE(ss->pieces_ref_count);
+        ss->pieces_ref_count = NULL;
+    }
+
+    /**
+     * Pieces shared with clones aren't unshared first, as most of them would
+     * only be given back again: the ones we keep get references of their own.
+     */
+    bool shared = ss->pieces_ref_count != NULL || ss->borrowed;
+    SS_RESULT res = SS_OK;
+
+    struct segmented_string_piece *pieces = NULL;
+    if (count > 0) {
+        pieces = (struct segmented_string_piece *)_ss_alloc(ss, sizeof(struct segmented_string_piece) * count);
+        if (pieces == NULL) return SS_ALLOC_ERROR;
+    }
+
+    char *scratch = NULL;
+    if (longest > 0) {
+        scratch = (char *)SS_MALLOC(longest);
+        if (scratch == NULL) {
+            if (ss->arena == NULL) SS_FREE(pieces);
+            return SS_ALLOC_ERROR;
+        }
+    }
+
+    /**
+     * Then the new pieces, each run rendered to the side and copied into a
+     * string_data of its own.
+     */
+    uint32_t made = 0;
+    for (uint32_t i = 0; i < ss->length && res == SS_OK; i = end) {
+        _ss_compact_run(ss, i, values, &end, &length, &keep);
+        if (keep) {
+            if (shared) {
+                ssp_clone(&pieces[made++], &ss->pieces[i]);
+            } else {
+                pieces[made++] = ss->pieces[i];
             }
-            break;
+            continue;
+        }
+        if (length == 0) continue;
+
+        char *cursor = scratch;
+        for (uint32_t j = i; j < end && res == SS_OK; j++) {
+            res = ssp_render_into(&ss->pieces[j], ss->values, cursor, &cursor);
+        }
+        if (res != SS_OK) break;
+
+        res = ss->arena != NULL
+            ? ssp_init_static_copy_arena(ss->arena, &pieces[made], scratch, length)
+            : ssp_init_static_copy(&pieces[made], scratch, length);
+        if (res == SS_OK) made++;
     }
+    SS_FREE(scratch);
 
-    _ss_increment_pieces(ss);
-    ssp_init_placeholder_uint8(&ss->pieces[ss->length - 1], placeholder);
+    if (res != SS_OK) {
+        _ss_compact_unwind(ss, pieces, made, values);
+        if (ss->arena == NULL) SS_FREE(pieces);
+        return res;
+    }
+
+    /**
+     * Only now are the old pieces given back: the ones that were merged, or
+     * our share of all of them.
+     */
+    if (ss->borrowed) {
+        _ss_retain_blocks(ss);
+        ss->borrowed = false;
+    } else if (shared) {
+        if (SS_REF_DEC(*ss->pieces_ref_count) == 0) {
+            _ss_release_pieces(ss->pieces, ss->length, true);
+            SS_FREE(ss->pieces_ref_count);
+        }
+        ss->pieces_ref_count = NULL;
+    } else {
+        for (uint32_t i = 0; i < ss->length; i = end) {
+            _ss_compact_run(ss, i, values, &end, &length, &keep);
+            if (!keep) _ss_release_pieces(&ss->pieces[i], end - i, false);
+        }
+        if (ss->arena == NULL) SS_FREE(ss->pieces);
+    }
+
+    ss->pieces = pieces;
+    ss->length = count;
+    ss->capacity = count;
+
+    ss->depth = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (pieces[i].type == STRING_PIECE_TYPE_NESTED && ss->depth < pieces[i].data.nested->ss.depth + 1) {
+            ss->depth = pieces[i].data.nested->ss.depth + 1;
+        }
+    }
+
+    if (values) {
+        /**
+         * No placeholders are left, so neither are any slots.
+         */
+        _ss_drop_slots(ss);
+        _ss_drop_names(ss);
+        _ss_drop_cache(ss);
+        if (ss->arena == NULL) SS_FREE(ss->filled);
+        ss->filled = NULL;
+        ss->values = NULL;
+        ss->slot_types = NULL;
+        ss->slot_count = 0;
+        ss->slot_capacity = 0;
+        ss->unfilled_slots = 0;
+        ss->type = count > 0 ? STATIC_STRING : EMPTY_STRING;
+    } else {
+        _ss_pieces_changed(ss);
+        if (count == 0 && ss->type == STATIC_STRING) ss->type = EMPTY_STRING;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Merges every run of adjacent static pieces into one static piece, owning
+ * a copy of its bytes. Nested strings are merged into the runs around them
+ * too, as nothing can change what they render to, unless they have a string
+ * placeholder somewhere inside. Pieces that render to nothing are dropped.
+ * Placeholders are left where they are, and so are single static pieces
+ * with nothing to merge with, which keep sharing their data.
+ *
+ * Repeated appends, `ss_append_ssp` and `ss_concat` all leave a string in
+ * many small pieces, each an indirection to follow on every render. This
+ * pays for that once, by copying: a string that will be rendered many more
+ * times than it is built, such as one kept in a cache, comes out with as few
+ * pieces as its placeholders allow. A string sharing its pieces with clones
+ * gets an array of its own, as with an append.
+ *
+ * Valid String Types: All but STRING_LIST
+ * Output String Type: Same as input, or EMPTY_STRING if a STATIC_STRING
+ *                     turns out to render to nothing.
+ */
+SS_RESULT ss_compact(struct segmented_string *ss) {
+    return _ss_compact(ss, false);
+}
+
+/**
+ * Same as `ss_compact`, with placeholders rendered into the static runs as
+ * well, so the string becomes at most one piece and one buffer: the bytes it
+ * renders to now. String placeholders are rendered as their value is at the
+ * time. Its slots go with its placeholders, so it can't be filled again.
+ *
+ * Valid String Types: FULLY_FILLED_TEMPLATE_STRING, STATIC_STRING, EMPTY_STRING
+ * Output String Type: STATIC_STRING, or EMPTY_STRING if it renders to nothing.
+ */
+SS_RESULT ss_compact_values(struct segmented_string *ss) {
+    return _ss_compact(ss, true);
+}
+
+/**
+ * `ss_compact_auto` leaves strings with fewer pieces than this alone, and
+ * strings whose pieces render to this many bytes each on average: for those,
+ * the bytes cost more than the pieces do, and compacting would only copy
+ * data that may be shared.
+ */
+#define SS_COMPACT_MIN_PIECES 8
+#define SS_COMPACT_MAX_AVERAGE 64
+
+/**
+ * How many pieces rendering this string walks, the pieces of nested strings
+ * counting rather than the nested piece itself.
+ */
+size_t _ss_leaf_pieces(struct segmented_string *ss) {
+    size_t count = 0;
+    for (uint32_t i = 0; i < ss->length; i++) {
+        struct segmented_string_piece *ssp = &ss->pieces[i];
+        count += ssp->type == STRING_PIECE_TYPE_NESTED ? _ss_leaf_pieces(&ssp->data.nested->ss) : 1;
+    }
+    return count;
+}
+
+/**
+ * The compaction policy for strings that are finished: a FULLY_FILLED_TEMPLATE_STRING
+ * or STATIC_STRING made of at least SS_COMPACT_MIN_PIECES pieces averaging
+ * under SS_COMPACT_MAX_AVERAGE bytes each is compacted, with
+ * `ss_compact_values` (so a template becomes a STATIC_STRING and can't be
+ * filled again). Anything else is left as it is, which is not an error.
+ * `*compacted` says which happened.
+ *
+ * Valid String Types: All
+ */
+SS_RESULT ss_compact_auto(struct segmented_string *ss, bool *compacted) {
+    *compacted = false;
+    if (ss->frozen) return SS_FROZEN;
+    if (ss->type != FULLY_FILLED_TEMPLATE_STRING && ss->type != STATIC_STRING) return SS_OK;
+
+    size_t pieces = _ss_leaf_pieces(ss);
+    if (pieces < SS_COMPACT_MIN_PIECES) return SS_OK;
+
+    size_t length;
+    SS_RESULT res = ss_render_length(ss, &length);
+    if (res != SS_OK) return res;
+    if (length >= pieces * SS_COMPACT_MAX_AVERAGE) return SS_OK;
+
+    res = _ss_compact(ss, true);
+    if (res != SS_OK) return res;
 
+    *compacted = true;
     return SS_OK;
 }
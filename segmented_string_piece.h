@@ -1,38 +1,138 @@
 #pragma once
 
 #include "common.h"
+#include "intern.h"
 #include "string_data.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
+/**
+ * New types go on the end: template images (see image.h) store these values.
+ */
 enum StringPieceType {
     STRING_PIECE_TYPE_STATIC,
-    STRING_PIECE_TYPE_PLACEHOLDER_UINT8
+    STRING_PIECE_TYPE_PLACEHOLDER_UINT8,
+    STRING_PIECE_TYPE_NESTED,
+    STRING_PIECE_TYPE_PLACEHOLDER_UINT16,
+    STRING_PIECE_TYPE_PLACEHOLDER_UINT32,
+    STRING_PIECE_TYPE_PLACEHOLDER_UINT64,
+    STRING_PIECE_TYPE_PLACEHOLDER_INT8,
+    STRING_PIECE_TYPE_PLACEHOLDER_INT16,
+    STRING_PIECE_TYPE_PLACEHOLDER_INT32,
+    STRING_PIECE_TYPE_PLACEHOLDER_INT64,
+    STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE,
+    STRING_PIECE_TYPE_PLACEHOLDER_STRING
 };
 
+/**
+ * Every type but STATIC and NESTED is a placeholder. Anything past the end of
+ * the enum is not, so a type read from outside (see `ss_image_load`) can be
+ * checked with this.
+ */
+bool _ssp_is_placeholder_type(enum StringPieceType type) {
+    return type == STRING_PIECE_TYPE_PLACEHOLDER_UINT8
+        || (type >= STRING_PIECE_TYPE_PLACEHOLDER_UINT16 && type <= STRING_PIECE_TYPE_PLACEHOLDER_STRING);
+}
+
+struct segmented_string;
+
+/**
+ * The value in a slot. Integers are stored widened to 64 bits, unsigned in
+ * `u` and signed in `i`, so the integer placeholder types only differ in
+ * what they can be filled with; they all render the same way. A string
+ * placeholder's value is another segmented string, which is rendered in
+ * place and which the caller keeps alive (see `ss_fill_string`).
+ */
+union ss_value {
+    uint64_t u;
+    int64_t i;
+    double d;
+    struct segmented_string *s;
+};
+
+/**
+ * A nested piece is a whole segmented string linked in by `ss_concat`. Those
+ * are defined in segmented_string.h, along with what a piece needs to do with
+ * one.
+ */
+struct ss_nested;
+
+void _ss_nested_retain(struct ss_nested *nested);
+SS_RESULT _ss_nested_release(struct ss_nested *nested);
+SS_RESULT _ss_nested_print(struct ss_nested *nested);
+SS_RESULT _ss_nested_render_length(struct ss_nested *nested, size_t *length);
+SS_RESULT _ss_nested_render_into(struct ss_nested *nested, char *buf, char **end);
+
+/**
+ * The same for the value of a string placeholder, which is a whole string.
+ */
+SS_RESULT _ss_string_print(struct segmented_string *ss);
+SS_RESULT _ss_string_render_length(struct segmented_string *ss, size_t *length);
+SS_RESULT _ss_string_render_into(struct segmented_string *ss, char *buf, char **end);
+
+/**
+ * How many string placeholder values deep a walk over a string can go.
+ */
+#define SS_VALUE_MAX_DEPTH 32
+
+SS_THREAD_LOCAL uint32_t _ss_value_depth = 0;
+
+/**
+ * Nested pieces are bounded by SS_CONCAT_MAX_DEPTH when they are made, but a
+ * string placeholder's value is only looked at when we walk it. It can have
+ * string placeholders of its own, filled with strings that do too, and can
+ * even lead back to where we started. Every walk into a value is bracketed by
+ * these, which count how many values deep this thread is and give up with
+ * SS_ERR past SS_VALUE_MAX_DEPTH rather than recursing for ever.
+ */
+SS_RESULT _ss_value_enter(void) {
+    if (_ss_value_depth >= SS_VALUE_MAX_DEPTH) return SS_ERR;
+    _ss_value_depth++;
+    return SS_OK;
+}
+
+void _ss_value_leave(void) {
+    _ss_value_depth--;
+}
+
 /**
  * A template string piece is one "piece" of a template string. This can be ANY
  * piece, so this is the most dynamic part of the entire puzzle. It's basically
  * just a tagged union.
+ *
+ * Pieces are 16 bytes: the pointer, the 32-bit field below, and the tag, with
+ * no padding. Four of them share a cache line, and everything needed to size
+ * a piece is in the piece itself.
  */
 struct segmented_string_piece {
-    enum StringPieceType type;
-
     union {
         struct string_data *static_string;
         struct {
             struct string_data *placeholder;
-            uint8_t value;
-        } uint8_data;
+        } placeholder_data;
+        struct ss_nested *nested;
     } data;
-};
 
-/** FORWARD DECLARATIONS **/
-struct segmented_string;
-SS_RESULT ss_append_ssp(struct segmented_string *ss, struct segmented_string_piece *ssp);
-/** END FORWARD DECLARATIONS **/
+    union {
+        /**
+         * Static pieces: the length of `static_string`, kept here so that
+         * working out how long a render will be never follows the pointer.
+         */
+        uint32_t length;
+
+        /**
+         * Placeholders: index into the owning string's slot values. Every
+         * placeholder with the same name shares a slot, and the value lives
+         * there rather than in the piece, so that pieces can be shared between
+         * clones that fill them differently.
+         */
+        uint32_t slot;
+    };
+
+    enum StringPieceType type;
+};
 
 SS_RESULT ssp_free(struct segmented_string_piece *ssp) {
     switch (ssp->type) {
@@ -41,75 +141,563 @@ SS_RESULT ssp_free(struct segmented_string_piece *ssp) {
                 sd_release(ssp->data.static_string);
             }
             break;
-        case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
+        case STRING_PIECE_TYPE_NESTED:
             {
-                sd_release(ssp->data.uint8_data.placeholder);
+                return _ss_nested_release(ssp->data.nested);
             }
-            break;
         default:
-            return SS_INVALID_STRING_TYPE;
+            {
+                if (!_ssp_is_placeholder_type(ssp->type)) return SS_INVALID_STRING_TYPE;
+                sd_release(ssp->data.placeholder_data.placeholder);
+            }
+            break;
     }
     return SS_OK;
 }
 
 SS_RESULT ssp_from_sd(struct string_data *sd, struct segmented_string_piece **ssp) {
-    *ssp = (struct segmented_string_piece *)malloc(sizeof(struct segmented_string_piece));
+    *ssp = (struct segmented_string_piece *)SS_MALLOC(sizeof(struct segmented_string_piece));
     if (*ssp == NULL) return SS_ALLOC_ERROR;
     
     (*ssp)->type = STRING_PIECE_TYPE_STATIC;
     (*ssp)->data.static_string = sd;
+    (*ssp)->length = sd_length(sd);
     return SS_OK;
 }
 
-SS_RESULT ssp_explode_by_char(struct segmented_string_piece *ssp, struct segmented_string *ss, char c) {
+/**
+ * Same as `ssp_from_sd`, but the piece comes out of `arena`.
+ */
+SS_RESULT ssp_from_sd_arena(struct ss_arena *arena, struct string_data *sd, struct segmented_string_piece **ssp) {
+    *ssp = (struct segmented_string_piece *)ss_arena_alloc(arena, sizeof(struct segmented_string_piece));
+    if (*ssp == NULL) return SS_ALLOC_ERROR;
+
+    (*ssp)->type = STRING_PIECE_TYPE_STATIC;
+    (*ssp)->data.static_string = sd;
+    (*ssp)->length = sd_length(sd);
+    return SS_OK;
+}
+
+/**
+ * Decimal text for every uint8. Each entry is the digits, zero padded out to
+ * three bytes, followed by the digit count. Formatting is then a table load,
+ * and in the hot loops a single unaligned 4-byte store followed by advancing
+ * the cursor by the width -- no division and no branches.
+ */
+const char _ssp_uint8_decimal[256][4] = {
+    {'0',0,0,1}, {'1',0,0,1}, {'2',0,0,1}, {'3',0,0,1}, {'4',0,0,1}, {'5',0,0,1}, {'6',0,0,1}, {'7',0,0,1},
+    {'8',0,0,1}, {'9',0,0,1}, {'1','0',0,2}, {'1','1',0,2}, {'1','2',0,2}, {'1','3',0,2}, {'1','4',0,2}, {'1','5',0,2},
+    {'1','6',0,2}, {'1','7',0,2}, {'1','8',0,2}, {'1','9',0,2}, {'2','0',0,2}, {'2','1',0,2}, {'2','2',0,2}, {'2','3',0,2},
+    {'2','4',0,2}, {'2','5',0,2}, {'2','6',0,2}, {'2','7',0,2}, {'2','8',0,2}, {'2','9',0,2}, {'3','0',0,2}, {'3','1',0,2},
+    {'3','2',0,2}, {'3','3',0,2}, {'3','4',0,2}, {'3','5',0,2}, {'3','6',0,2}, {'3','7',0,2}, {'3','8',0,2}, {'3','9',0,2},
+    {'4','0',0,2}, {'4','1',0,2}, {'4','2',0,2}, {'4','3',0,2}, {'4','4',0,2}, {'4','5',0,2}, {'4','6',0,2}, {'4','7',0,2},
+    {'4','8',0,2}, {'4','9',0,2}, {'5','0',0,2}, {'5','1',0,2}, {'5','2',0,2}, {'5','3',0,2}, {'5','4',0,2}, {'5','5',0,2},
+    {'5','6',0,2}, {'5','7',0,2}, {'5','8',0,2}, {'5','9',0,2}, {'6','0',0,2}, {'6','1',0,2}, {'6','2',0,2}, {'6','3',0,2},
+    {'6','4',0,2}, {'6','5',0,2}, {'6','6',0,2}, {'6','7',0,2}, {'6','8',0,2}, {'6','9',0,2}, {'7','0',0,2}, {'7','1',0,2},
+    {'7','2',0,2}, {'7','3',0,2}, {'7','4',0,2}, {'7','5',0,2}, {'7','6',0,2}, {'7','7',0,2}, {'7','8',0,2}, {'7','9',0,2},
+    {'8','0',0,2}, {'8','1',0,2}, {'8','2',0,2}, {'8','3',0,2}, {'8','4',0,2}, {'8','5',0,2}, {'8','6',0,2}, {'8','7',0,2},
+    {'8','8',0,2}, {'8','9',0,2}, {'9','0',0,2}, {'9','1',0,2}, {'9','2',0,2}, {'9','3',0,2}, {'9','4',0,2}, {'9','5',0,2},
+    {'9','6',0,2}, {'9','7',0,2}, {'9','8',0,2}, {'9','9',0,2}, {'1','0','0',3}, {'1','0','1',3}, {'1','0','2',3}, {'1','0','3',3},
+    {'1','0','4',3}, {'1','0','5',3}, {'1','0','6',3}, {'1','0','7',3}, {'1','0','8',3}, {'1','0','9',3}, {'1','1','0',3}, {'1','1','1',3},
+    {'1','1','2',3}, {'1','1','3',3}, {'1','1','4',3}, {'1','1','5',3}, {'1','1','6',3}, {'1','1','7',3}, {'1','1','8',3}, {'1','1','9',3},
+    {'1','2','0',3}, {'1','2','1',3}, {'1','2','2',3}, {'1','2','3',3}, {'1','2','4',3}, {'1','2','5',3}, {'1','2','6',3}, {'1','2','7',3},
+    {'1','2','8',3}, {'1','2','9',3}, {'1','3','0',3}, {'1','3','1',3}, {'1','3','2',3}, {'1','3','3',3}, {'1','3','4',3}, {'1','3','5',3},
+    {'1','3','6',3}, {'1','3','7',3}, {'1','3','8',3}, {'1','3','9',3}, {'1','4','0',3}, {'1','4','1',3}, {'1','4','2',3}, {'1','4','3',3},
+    {'1','4','4',3}, {'1','4','5',3}, {'1','4','6',3}, {'1','4','7',3}, {'1','4','8',3}, {'1','4','9',3}, {'1','5','0',3}, {'1','5','1',3},
+    {'1','5','2',3}, {'1','5','3',3}, {'1','5','4',3}, {'1','5','5',3}, {'1','5','6',3}, {'1','5','7',3}, {'1','5','8',3}, {'1','5','9',3},
+    {'1','6','0',3}, {'1','6','1',3}, {'1','6','2',3}, {'1','6','3',3}, {'1','6','4',3}, {'1','6','5',3}, {'1','6','6',3}, {'1','6','7',3},
+    {'1','6','8',3}, {'1','6','9',3}, {'1','7','0',3}, {'1','7','1',3}, {'1','7','2',3}, {'1','7','3',3}, {'1','7','4',3}, {'1','7','5',3},
+    {'1','7','6',3}, {'1','7','7',3}, {'1','7','8',3}, {'1','7','9',3}, {'1','8','0',3}, {'1','8','1',3}, {'1','8','2',3}, {'1','8','3',3},
+    {'1','8','4',3}, {'1','8','5',3}, {'1','8','6',3}, {'1','8','7',3}, {'1','8','8',3}, {'1','8','9',3}, {'1','9','0',3}, {'1','9','1',3},
+    {'1','9','2',3}, {'1','9','3',3}, {'1','9','4',3}, {'1','9','5',3}, {'1','9','6',3}, {'1','9','7',3}, {'1','9','8',3}, {'1','9','9',3},
+    {'2','0','0',3}, {'2','0','1',3}, {'2','0','2',3}, {'2','0','3',3}, {'2','0','4',3}, {'2','0','5',3}, {'2','0','6',3}, {'2','0','7',3},
+    {'2','0','8',3}, {'2','0','9',3}, {'2','1','0',3}, {'2','1','1',3}, {'2','1','2',3}, {'2','1','3',3}, {'2','1','4',3}, {'2','1','5',3},
+    {'2','1','6',3}, {'2','1','7',3}, {'2','1','8',3}, {'2','1','9',3}, {'2','2','0',3}, {'2','2','1',3}, {'2','2','2',3}, {'2','2','3',3},
+    {'2','2','4',3}, {'2','2','5',3}, {'2','2','6',3}, {'2','2','7',3}, {'2','2','8',3}, {'2','2','9',3}, {'2','3','0',3}, {'2','3','1',3},
+    {'2','3','2',3}, {'2','3','3',3}, {'2','3','4',3}, {'2','3','5',3}, {'2','3','6',3}, {'2','3','7',3}, {'2','3','8',3}, {'2','3','9',3},
+    {'2','4','0',3}, {'2','4','1',3}, {'2','4','2',3}, {'2','4','3',3}, {'2','4','4',3}, {'2','4','5',3}, {'2','4','6',3}, {'2','4','7',3},
+    {'2','4','8',3}, {'2','4','9',3}, {'2','5','0',3}, {'2','5','1',3}, {'2','5','2',3}, {'2','5','3',3}, {'2','5','4',3}, {'2','5','5',3}
+};
+
+/**
+ * Number of decimal digits needed to print `value`.
+ */
+uint8_t _ssp_uint8_width(uint8_t value) {
+    return _ssp_uint8_decimal[value][3];
+}
+
+/**
+ * Writes `value` as decimal into `buf` without going through stdio. Returns a
+ * pointer just past the last digit. Only writes the digits themselves.
+ */
+char *_ssp_format_uint8(char *buf, uint8_t value) {
+    uint8_t width = _ssp_uint8_width(value);
+    memcpy(buf, _ssp_uint8_decimal[value], width);
+
+    return buf + width;
+}
+
+/**
+ * Like `_ssp_format_uint8`, but always stores four bytes. The caller must have
+ * room for them; whatever lands past the digits is overwritten by the next
+ * write.
+ */
+char *_ssp_format_uint8_wide(char *buf, uint8_t value) {
+    memcpy(buf, _ssp_uint8_decimal[value], 4);
+
+    return buf + _ssp_uint8_decimal[value][3];
+}
+
+/**
+ * "00" to "99", so that wider integers are written two digits per division.
+ */
+const char _ssp_digit_pairs[201] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+const uint64_t _ssp_powers_of_10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/**
+ * Number of decimal digits needed to print `value`. The bit length gives the
+ * digit count to within one (1233 / 4096 is just over log10(2)), and a single
+ * compare against a power of ten settles which.
+ */
+uint8_t _ssp_uint64_width(uint64_t value) {
+    uint64_t v = value | 1;
+    uint32_t guess = (uint32_t)(64 - __builtin_clzll(v)) * 1233 >> 12;
+
+    return guess + (v >= _ssp_powers_of_10[guess]);
+}
+
+/**
+ * Writes `value` as decimal into `buf`, which needs room for
+ * `_ssp_uint64_width(value)` bytes, back to front, two digits at a time.
+ * Returns a pointer just past the last digit.
+ */
+char *_ssp_format_uint64(char *buf, uint64_t value) {
+    if (value < 256) return _ssp_format_uint8(buf, (uint8_t)value);
+
+    char *end = buf + _ssp_uint64_width(value);
+    char *cursor = end;
+
+    while (value >= 100) {
+        cursor -= 2;
+        memcpy(cursor, &_ssp_digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+
+    if (value >= 10) {
+        cursor -= 2;
+        memcpy(cursor, &_ssp_digit_pairs[value * 2], 2);
+    } else {
+        cursor[-1] = (char)('0' + value);
+    }
+
+    return end;
+}
+
+/**
+ * The magnitude is worked out in unsigned arithmetic, so that INT64_MIN has
+ * one.
+ */
+uint8_t _ssp_int64_width(int64_t value) {
+    if (value < 0) return 1 + _ssp_uint64_width(0 - (uint64_t)value);
+    return _ssp_uint64_width((uint64_t)value);
+}
+
+char *_ssp_format_int64(char *buf, int64_t value) {
+    if (value < 0) {
+        *buf = '-';
+        return _ssp_format_uint64(buf + 1, 0 - (uint64_t)value);
+    }
+    return _ssp_format_uint64(buf, (uint64_t)value);
+}
+
+/**
+ * The longest a double can format to: a sign, 17 digits, a decimal point and
+ * a 5 character exponent ("-1.2345678901234567e-308").
+ */
+#define SSP_DOUBLE_MAX_WIDTH 24
+
+/**
+ * Shortest double formatting is Grisu2 (Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", 2010), done entirely in
+ * 64-bit integer arithmetic against a table of cached powers of ten.
+ *
+ * A `_ssp_diy_fp` is `f * 2^e` with a full 64-bit significand.
+ */
+struct _ssp_diy_fp {
+    uint64_t f;
+    int e;
+};
+
+/**
+ * 10^k for k = -348, -340, ..., 340, as normalized `_ssp_diy_fp`s.
+ */
+const uint64_t _ssp_cached_powers_f[87] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+const int16_t _ssp_cached_powers_e[87] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066,
+};
+
+struct _ssp_diy_fp _ssp_diy_fp_multiply(struct _ssp_diy_fp a, struct _ssp_diy_fp b) {
+    unsigned __int128 product = (unsigned __int128)a.f * b.f;
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low = (uint64_t)product;
+
+    struct _ssp_diy_fp result = { high + (low >> 63), a.e + b.e + 64 };
+    return result;
+}
+
+struct _ssp_diy_fp _ssp_diy_fp_normalize(struct _ssp_diy_fp x) {
+    int shift = __builtin_clzll(x.f);
+    struct _ssp_diy_fp result = { x.f << shift, x.e - shift };
+    return result;
+}
+
+/**
+ * Moves the last digit towards the exact value while the digits stay inside
+ * the rounding interval.
+ */
+void _ssp_grisu_round(char *digits, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t distance) {
+    while (rest < distance && delta - rest >= ten_kappa
+        && (rest + ten_kappa < distance || distance - rest > rest + ten_kappa - distance)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+/**
+ * Writes the digits of a positive, finite `value` to `digits` (at most 17 of
+ * them) and returns how many there are. `*exponent` is set so that the
+ * value is the digits times 10^`*exponent`.
+ */
+int _ssp_grisu2(double value, char *digits, int *exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint64_t significand = bits & 0xFFFFFFFFFFFFFULL;
+    int biased = (int)(bits >> 52);
+
+    struct _ssp_diy_fp v;
+    if (biased != 0) {
+        v.f = significand | (1ULL << 52);
+        v.e = biased - 1075;
+    } else {
+        v.f = significand;
+        v.e = -1074;
+    }
+
+    /**
+     * The boundaries halfway to the neighbouring doubles, with the same
+     * exponent. The lower one is closer when `v` is a power of two.
+     */
+    struct _ssp_diy_fp plus = { (v.f << 1) + 1, v.e - 1 };
+    while (!(plus.f & (1ULL << 53))) {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= 10;
+    plus.e -= 10;
+
+    struct _ssp_diy_fp minus = v.f == (1ULL << 52)
+        ? (struct _ssp_diy_fp){ (v.f << 2) - 1, v.e - 2 }
+        : (struct _ssp_diy_fp){ (v.f << 1) - 1, v.e - 1 };
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    /**
+     * The cached power that scales `plus` into [2^-60, 2^-32) times 2^64.
+     */
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) k++;
+    unsigned index = (unsigned)((k >> 3) + 1);
+    *exponent = -(-348 + (int)(index << 3));
+
+    struct _ssp_diy_fp power = { _ssp_cached_powers_f[index], _ssp_cached_powers_e[index] };
+    struct _ssp_diy_fp w = _ssp_diy_fp_multiply(_ssp_diy_fp_normalize(v), power);
+    struct _ssp_diy_fp high = _ssp_diy_fp_multiply(plus, power);
+    struct _ssp_diy_fp low = _ssp_diy_fp_multiply(minus, power);
+    low.f++;
+    high.f--;
+
+    /**
+     * Generate digits of `high` until they are within `delta` of it.
+     */
+    uint64_t delta = high.f - low.f;
+    uint64_t distance = high.f - w.f;
+    int shift = -high.e;
+    uint64_t one = 1ULL << shift;
+    uint32_t integral = (uint32_t)(high.f >> shift);
+    uint64_t fraction = high.f & (one - 1);
+    int kappa = _ssp_uint64_width(integral);
+    int length = 0;
+
+    while (kappa > 0) {
+        uint32_t divisor = (uint32_t)_ssp_powers_of_10[kappa - 1];
+        uint32_t digit = integral / divisor;
+        integral %= divisor;
+
+        if (digit != 0 || length != 0) digits[length++] = (char)('0' + digit);
+        kappa--;
+
+        uint64_t rest = ((uint64_t)integral << shift) + fraction;
+        if (rest <= delta) {
+            *exponent += kappa;
+            _ssp_grisu_round(digits, length, delta, rest, _ssp_powers_of_10[kappa] << shift, distance);
+            return length;
+        }
+    }
+
+    while (true) {
+        fraction *= 10;
+        delta *= 10;
+        char digit = (char)(fraction >> shift);
+        if (digit != 0 || length != 0) digits[length++] = (char)('0' + digit);
+        fraction &= one - 1;
+        kappa--;
+
+        if (fraction < delta) {
+            *exponent += kappa;
+            _ssp_grisu_round(digits, length, delta, fraction, one, -kappa < 20 ? distance * _ssp_powers_of_10[-kappa] : 0);
+            return length;
+        }
+    }
+}
+
+/**
+ * Writes text that reads back as exactly `value`, in the style of "%g": no
+ * trailing zeros, and an exponent (of at least two digits) only when the
+ * decimal exponent is below -4 or 15 and up. Returns a pointer just past the
+ * last byte.
+ *
+ * Whole numbers under 10^15 go straight through the integer formatter; -0
+ * keeps its sign, so it doesn't. Everything else is Grisu2, which always
+ * reads back as the same double, and is the shortest text that does for all
+ * but a tiny fraction of doubles (where it is one digit longer). Infinities
+ * and NaN print the way "%g" prints them.
+ */
+char *_ssp_format_double(char *buf, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bool negative = bits >> 63;
+
+    if (value > -1e15 && value < 1e15 && value == (double)(int64_t)value && !(value == 0 && negative)) {
+        return _ssp_format_int64(buf, (int64_t)value);
+    }
+
+    if (negative) *buf++ = '-';
+
+    if ((bits & 0x7FF0000000000000ULL) == 0x7FF0000000000000ULL) {
+        memcpy(buf, (bits & 0xFFFFFFFFFFFFFULL) != 0 ? "nan" : "inf", 3);
+        return buf + 3;
+    }
+
+    if (value == 0) {
+        *buf = '0';
+        return buf + 1;
+    }
+
+    char digits[18];
+    int exponent;
+    int length = _ssp_grisu2(negative ? -value : value, digits, &exponent);
+
+    /**
+     * The value is d.ddd * 10^`point`.
+     */
+    int point = length + exponent - 1;
+
+    if (point < -4 || point >= 15) {
+        *buf++ = digits[0];
+        if (length > 1) {
+            *buf++ = '.';
+            memcpy(buf, digits + 1, length - 1);
+            buf += length - 1;
+        }
+
+        *buf++ = 'e';
+        *buf++ = point < 0 ? '-' : '+';
+        uint32_t magnitude = point < 0 ? -point : point;
+        if (magnitude < 10) *buf++ = '0';
+        return _ssp_format_uint64(buf, magnitude);
+    }
+
+    if (point < 0) {
+        memcpy(buf, "0.", 2);
+        memset(buf + 2, '0', -point - 1);
+        buf += 2 + (-point - 1);
+        memcpy(buf, digits, length);
+        return buf + length;
+    }
+
+    if (exponent >= 0) {
+        memcpy(buf, digits, length);
+        memset(buf + length, '0', exponent);
+        return buf + length + exponent;
+    }
+
+    memcpy(buf, digits, point + 1);
+    buf[point + 1] = '.';
+    memcpy(buf + point + 2, digits + point + 1, length - point - 1);
+    return buf + length + 1;
+}
+
+/**
+ * Exact, but it has to format the value to know.
+ */
+uint8_t _ssp_double_width(double value) {
+    char text[SSP_DOUBLE_MAX_WIDTH];
+    return _ssp_format_double(text, value) - text;
+}
+
+/**
+ * Formats a number placeholder's value into `buf`, which needs room for
+ * SSP_SCRATCH_SIZE bytes. Returns a pointer just past the last byte, or NULL
+ * for types that aren't numbers.
+ */
+#define SSP_SCRATCH_SIZE 32
+
+char *_ssp_format_value(enum StringPieceType type, union ss_value value, char *buf) {
+    switch (type) {
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
+            return _ssp_format_uint8(buf, (uint8_t)value.u);
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT16:
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT32:
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT64:
+            return _ssp_format_uint64(buf, value.u);
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT8:
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT16:
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT32:
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT64:
+            return _ssp_format_int64(buf, value.i);
+        case STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE:
+            return _ssp_format_double(buf, value.d);
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * The exact number of bytes `ssp_render_into` will write for this piece.
+ */
+SS_RESULT ssp_render_length(struct segmented_string_piece *ssp, const union ss_value *values, size_t *length) {
     switch (ssp->type) {
+        case STRING_PIECE_TYPE_STATIC:
+            {
+                *length = ssp->length;
+            }
+            break;
         case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
             {
-                return SS_INVALID_STRING_TYPE;
+                *length = _ssp_uint8_width((uint8_t)values[ssp->slot].u);
+            }
+            break;
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT16:
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT32:
+        case STRING_PIECE_TYPE_PLACEHOLDER_UINT64:
+            {
+                *length = _ssp_uint64_width(values[ssp->slot].u);
+            }
+            break;
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT8:
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT16:
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT32:
+        case STRING_PIECE_TYPE_PLACEHOLDER_INT64:
+            {
+                *length = _ssp_int64_width(values[ssp->slot].i);
+            }
+            break;
+        case STRING_PIECE_TYPE_PLACEHOLDER_DOUBLE:
+            {
+                *length = _ssp_double_width(values[ssp->slot].d);
             }
             break;
+        case STRING_PIECE_TYPE_PLACEHOLDER_STRING:
+            {
+                SS_RESULT res = _ss_value_enter();
+                if (res != SS_OK) return res;
+
+                res = _ss_string_render_length(values[ssp->slot].s, length);
+                _ss_value_leave();
+                return res;
+            }
+        case STRING_PIECE_TYPE_NESTED:
+            {
+                return _ss_nested_render_length(ssp->data.nested, length);
+            }
+        default:
+            return SS_INVALID_STRING_TYPE;
+    }
+
+    return SS_OK;
+}
+
+/**
+ * Renders this piece into `buf`, which must have room for at least
+ * `ssp_render_length` bytes. `*end` is set to just past the last byte
+ * written.
+ */
+SS_RESULT ssp_render_into(struct segmented_string_piece *ssp, const union ss_value *values, char *buf, char **end) {
+    switch (ssp->type) {
         case STRING_PIECE_TYPE_STATIC:
             {
-                uint8_t start = 0;
-                uint8_t end = 0;
-
-                while (true) {
-                    if (
-                        end >= ssp->data.static_string->length
-                            || ssp->data.static_string->data[end] == c
-                    ) {
-                        struct string_data *sd;
-                        SS_RESULT res = sd_create_from(
-                            ssp->data.static_string,
-                            start,
-                            end,
-                            &sd
-                        );
-                        if (res != SS_OK) return res;
-
-                        start = end + 1;
-
-                        struct segmented_string_piece *ssp;
-                        res = ssp_from_sd(sd, &ssp);
-                        if (res != SS_OK) return res;
-
-                        ss_append_ssp(
-                            ss,
-                            ssp
-                        );
-                    } else {
-
-                    }
-                    if (end >= ssp->data.static_string->length) {
-                        break;
-                    }
-                    end++;
-                }
-
-                // TODO: Why are we even doing this??
-                struct string_data *sd;
-                SS_RESULT res = sd_create_from(ssp->data.static_string, start, end, &sd);
+                memcpy(buf, ssp->data.static_string->data, ssp->length);
+                *end = buf + ssp->length;
+            }
+            break;
+        case STRING_PIECE_TYPE_PLACEHOLDER_STRING:
+            {
+                SS_RESULT res = _ss_value_enter();
                 if (res != SS_OK) return res;
+
+                res = _ss_string_render_into(values[ssp->slot].s, buf, end);
+                _ss_value_leave();
+                return res;
+            }
+        case STRING_PIECE_TYPE_NESTED:
+            {
+                return _ss_nested_render_into(ssp->data.nested, buf, end);
+            }
+        default:
+            {
+                *end = _ssp_format_value(ssp->type, values[ssp->slot], buf);
+                if (*end == NULL) return SS_INVALID_STRING_TYPE;
             }
             break;
     }
@@ -117,75 +705,221 @@ SS_RESULT ssp_explode_by_char(struct segmented_string_piece *ssp, struct segment
     return SS_OK;
 }
 
-SS_RESULT ssp_print(struct segmented_string_piece *ssp) {
+/**
+ * Gets at the bytes this piece renders to, without copying static data.
+ * Static pieces point straight at their string_data; number placeholders are
+ * formatted into `scratch`, which needs room for SSP_SCRATCH_SIZE bytes.
+ * Nested pieces and string placeholders have no bytes of their own;
+ * `ss_for_each_span` walks into them.
+ */
+SS_RESULT ssp_bytes(struct segmented_string_piece *ssp, const union ss_value *values, char *scratch, const char **data, size_t *length) {
+    if (ssp->type == STRING_PIECE_TYPE_STATIC) {
+        *data = ssp->data.static_string->data;
+        *length = ssp->length;
+        return SS_OK;
+    }
+
+    if (!_ssp_is_placeholder_type(ssp->type)) return SS_INVALID_STRING_TYPE;
+
+    char *end = _ssp_format_value(ssp->type, values[ssp->slot], scratch);
+    if (end == NULL) return SS_INVALID_STRING_TYPE;
+
+    *data = scratch;
+    *length = end - scratch;
+    return SS_OK;
+}
+
+/**
+ * Placeholder pieces don't carry their value; `values` is the owning string's
+ * slot values (see `segmented_string`). It is not used for static pieces.
+ * Unfilled placeholders print as 0, and unfilled string placeholders as
+ * nothing.
+ */
+SS_RESULT ssp_print(struct segmented_string_piece *ssp, const union ss_value *values) {
     switch (ssp->type) {
         case STRING_PIECE_TYPE_STATIC:
             {
                 return sd_print(ssp->data.static_string);
             }
             break;
-        case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
+        case STRING_PIECE_TYPE_PLACEHOLDER_STRING:
             {
-                printf("%d", ssp->data.uint8_data.value);
+                if (values[ssp->slot].s == NULL) return SS_OK;
+
+                SS_RESULT res = _ss_value_enter();
+                if (res != SS_OK) return res;
+
+                res = _ss_string_print(values[ssp->slot].s);
+                _ss_value_leave();
+                return res;
+            }
+        case STRING_PIECE_TYPE_NESTED:
+            {
+                return _ss_nested_print(ssp->data.nested);
             }
-            break;
         default:
-            return SS_INVALID_STRING_TYPE;
+            {
+                char scratch[SSP_SCRATCH_SIZE];
+                const char *data;
+                size_t length;
+
+                SS_RESULT res = ssp_bytes(ssp, values, scratch, &data, &length);
+                if (res != SS_OK) return res;
+                printf("%.*s", (int)length, data);
+            }
+            break;
     }
 
     return SS_OK;
 }
 
 SS_RESULT ssp_clone(struct segmented_string_piece *out, struct segmented_string_piece *in) {
+    SS_STAT(ssp_clones, 1);
+
     switch (in->type) {
         case STRING_PIECE_TYPE_STATIC:
             {
-                out->type = STRING_PIECE_TYPE_STATIC;
-                out->data.static_string = in->data.static_string;
-                out->data.static_string->ref_count++;
+                *out = *in;
+                sd_retain(out->data.static_string);
             }
             break;
-        case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
+        case STRING_PIECE_TYPE_NESTED:
             {
-                out->type = STRING_PIECE_TYPE_PLACEHOLDER_UINT8;
-                out->data.uint8_data = in->data.uint8_data;
+                *out = *in;
+                _ss_nested_retain(out->data.nested);
             }
             break;
         default:
-            return SS_INVALID_STRING_TYPE;
+            {
+                if (!_ssp_is_placeholder_type(in->type)) return SS_INVALID_STRING_TYPE;
+                *out = *in;
+                sd_retain(out->data.placeholder_data.placeholder);
+            }
+            break;
     }
 
     return SS_OK;
 }
 
-SS_RESULT ssp_fill_uint8(struct segmented_string_piece *ssp, uint8_t value) {
-    // TODO: Error checking?
-    ssp->data.uint8_data.value = value;
+bool ssp_is_template(struct segmented_string_piece *ssp) {
+    return _ssp_is_placeholder_type(ssp->type);
+}
 
-    return SS_OK;
+bool ssp_is_template_uint8(struct segmented_string_piece *ssp, const char *placeholder) {
+    if (ssp->type != STRING_PIECE_TYPE_PLACEHOLDER_UINT8) return false;
+    return sd_is_equal_bytes(ssp->data.placeholder_data.placeholder, placeholder, strlen(placeholder));
 }
 
-bool ssp_is_template(struct segmented_string_piece *ssp) {
-    switch (ssp->type) {
-        case STRING_PIECE_TYPE_PLACEHOLDER_UINT8:
-            return true;
-        default:
-            return false;
+/**
+ * Same as `ssp_is_template_uint8`, with the name already in a string_data.
+ * Placeholder names are interned in `sd_intern_default()`, so if `name` is the
+ * interned copy this is a pointer compare.
+ */
+bool ssp_is_template_uint8_sd(struct segmented_string_piece *ssp, struct string_data *name) {
+    if (ssp->type != STRING_PIECE_TYPE_PLACEHOLDER_UINT8) return false;
+
+    struct string_data *placeholder = ssp->data.placeholder_data.placeholder;
+    if ((placeholder->flags & name->flags & STRING_INTERNED) == STRING_INTERNED) {
+        return placeholder == name;
     }
+    return sd_is_equal_bytes(placeholder, name->data, sd_length(name));
 }
 
-bool ssp_is_template_uint8(struct segmented_string_piece *ssp, const char *placeholder) {
-    if (ssp->type != STRING_PIECE_TYPE_PLACEHOLDER_UINT8) return false;
-    return sd_is_equal_cstring(ssp->data.uint8_data.placeholder, placeholder);
+/**
+ * Same as `ssp_is_template_uint8_sd`, for a placeholder of any type.
+ */
+bool ssp_is_template_named_sd(struct segmented_string_piece *ssp, struct string_data *name) {
+    if (!_ssp_is_placeholder_type(ssp->type)) return false;
+
+    struct string_data *placeholder = ssp->data.placeholder_data.placeholder;
+    if ((placeholder->flags & name->flags & STRING_INTERNED) == STRING_INTERNED) {
+        return placeholder == name;
+    }
+    return sd_is_equal_bytes(placeholder, name->data, sd_length(name));
 }
 
-SS_RESULT ssp_init_static_copy(struct segmented_string_piece *ssp, const char *value, uint8_t length) {
+/**
+ * Same as `ssp_is_template_uint8`, for a placeholder of any type.
+ */
+bool ssp_is_template_named(struct segmented_string_piece *ssp, const char *placeholder) {
+    if (!_ssp_is_placeholder_type(ssp->type)) return false;
+    return sd_is_equal_bytes(ssp->data.placeholder_data.placeholder, placeholder, strlen(placeholder));
+}
+
+SS_RESULT ssp_init_static_copy(struct segmented_string_piece *ssp, const char *value, uint32_t length) {
     ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->length = length;
 
     return sd_create_copy(value, length, &(ssp->data.static_string));
 }
 
-SS_RESULT ssp_init_placeholder_uint8(struct segmented_string_piece *ssp, const char *placeholder) {
-    ssp->type = STRING_PIECE_TYPE_PLACEHOLDER_UINT8;
-    return sd_create_copy(placeholder, strlen(placeholder), &(ssp->data.uint8_data.placeholder));
+/**
+ * A static piece that borrows `value` rather than copying it. See
+ * `ss_append_static_borrow` for how long `value` has to live.
+ */
+SS_RESULT ssp_init_static_borrow(struct segmented_string_piece *ssp, const char *value, uint32_t length) {
+    ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->length = length;
+
+    return sd_create_borrow(value, length, &(ssp->data.static_string));
+}
+
+/**
+ * A placeholder of `type`, which has to be one of the placeholder types.
+ * Placeholder names are interned in `sd_intern_default()`: every template
+ * that uses a name shares one copy of it, and matching names is a pointer
+ * compare.
+ */
+SS_RESULT ssp_init_placeholder(struct segmented_string_piece *ssp, enum StringPieceType type, const char *placeholder, uint32_t length) {
+    ssp->type = type;
+
+    return sd_intern_shared(placeholder, length, &(ssp->data.placeholder_data.placeholder));
+}
+
+SS_RESULT ssp_init_placeholder_uint8(struct segmented_string_piece *ssp, const char *placeholder, uint32_t length) {
+    return ssp_init_placeholder(ssp, STRING_PIECE_TYPE_PLACEHOLDER_UINT8, placeholder, length);
+}
+
+/**
+ * Same as `ssp_init_static_copy`, but the data is shared through
+ * `sd_intern_default()` with every other interned fragment with the same
+ * contents.
+ */
+SS_RESULT ssp_init_static_interned(struct segmented_string_piece *ssp, const char *value, uint32_t length) {
+    ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->length = length;
+
+    return sd_intern_shared(value, length, &(ssp->data.static_string));
+}
+
+/**
+ * Same as `ssp_init_static_copy`, but the copy comes out of `arena`.
+ */
+SS_RESULT ssp_init_static_copy_arena(struct ss_arena *arena, struct segmented_string_piece *ssp, const char *value, uint32_t length) {
+    ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->length = length;
+
+    return sd_create_copy_arena(arena, value, length, &(ssp->data.static_string));
+}
+
+/**
+ * Same as `ssp_init_static_borrow`, but the header comes out of `arena`.
+ */
+SS_RESULT ssp_init_static_borrow_arena(struct ss_arena *arena, struct segmented_string_piece *ssp, const char *value, uint32_t length) {
+    ssp->type = STRING_PIECE_TYPE_STATIC;
+    ssp->length = length;
+
+    return sd_create_borrow_arena(arena, value, length, &(ssp->data.static_string));
+}
+
+/**
+ * Same as `ssp_init_placeholder`, but the name comes out of `arena`.
+ */
+SS_RESULT ssp_init_placeholder_arena(struct ss_arena *arena, struct segmented_string_piece *ssp, enum StringPieceType type, const char *placeholder, uint32_t length) {
+    ssp->type = type;
+    return sd_create_copy_arena(arena, placeholder, length, &(ssp->data.placeholder_data.placeholder));
+}
+
+SS_RESULT ssp_init_placeholder_uint8_arena(struct ss_arena *arena, struct segmented_string_piece *ssp, const char *placeholder, uint32_t length) {
+    return ssp_init_placeholder_arena(arena, ssp, STRING_PIECE_TYPE_PLACEHOLDER_UINT8, placeholder, length);
 }
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SS_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Byte scanning primitives. Each one comes in a plain scalar version, an SSE2
+ * version (always there on x86_64) and an AVX2 version. The public functions
+ * pick the best one the CPU we are running on supports the first time they
+ * are called.
+ *
+ * Everything returns positions relative to `data`; "not found" is `length`.
+ */
+
+typedef size_t (*_ss_char_scan_fn)(const char *data, size_t length, char c);
+typedef size_t (*_ss_bytes_scan_fn)(const char *data, size_t length, const char *needle, size_t needle_length);
+
+size_t _ss_find_char_scalar(const char *data, size_t length, char c) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == c) return i;
+    }
+
+    return length;
+}
+
+size_t _ss_count_char_scalar(const char *data, size_t length, char c) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        count += data[i] == c;
+    }
+
+    return count;
+}
+
+/**
+ * Substring search, for needles of two bytes or more that are no longer than
+ * `data`. The vector versions look for the needle's first and last bytes a
+ * block of positions at a time, at the right distance apart, and only
+ * compare the rest where both match; text that has both bytes at that
+ * distance everywhere is the one case where this is slow.
+ */
+size_t _ss_find_bytes_scalar(const char *data, size_t length, const char *needle, size_t needle_length) {
+    char first = needle[0];
+    char last = needle[needle_length - 1];
+
+    for (size_t i = 0; i + needle_length <= length; i++) {
+        if (data[i] == first && data[i + needle_length - 1] == last
+            && memcmp(data + i + 1, needle + 1, needle_length - 2) == 0) {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+#ifdef SS_SIMD_X86
+
+__attribute__((target("sse2")))
+size_t _ss_find_bytes_sse2(const char *data, size_t length, const char *needle, size_t needle_length) {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(data + i + needle_length - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(block_first, first),
+            _mm_cmpeq_epi8(block_last, last)
+        ));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle + 1, needle_length - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    if (i == 0) return _ss_find_bytes_scalar(data, length, needle, needle_length);
+    if (i + needle_length > length) return length;
+
+    /**
+     * The last positions are done as one more block, ending at the end of
+     * `data` and overlapping the one before, with the positions that block
+     * already covered masked off.
+     */
+    size_t end = length - (needle_length - 1) - 16;
+    __m128i block_first = _mm_loadu_si128((const __m128i *)(data + end));
+    __m128i block_last = _mm_loadu_si128((const __m128i *)(data + end + needle_length - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(block_first, first),
+        _mm_cmpeq_epi8(block_last, last)
+    )) & (0xffffu << (i - end));
+
+    while (mask != 0) {
+        unsigned bit = __builtin_ctz(mask);
+        if (memcmp(data + end + bit + 1, needle + 1, needle_length - 2) == 0) return end + bit;
+        mask &= mask - 1;
+    }
+
+    return length;
+}
+
+__attribute__((target("sse2")))
+size_t _ss_find_char_sse2(const char *data, size_t length, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    return i + _ss_find_char_scalar(data + i, length - i, c);
+}
+
+__attribute__((target("sse2")))
+size_t _ss_count_char_sse2(const char *data, size_t length, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+    }
+
+    return count + _ss_count_char_scalar(data + i, length - i, c);
+}
+
+__attribute__((target("avx2")))
+size_t _ss_find_char_avx2(const char *data, size_t length, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    /**
+     * The tail is handled by SSE code, which is very slow to run with the
+     * upper halves of the ymm registers dirty. gcc doesn't always clear them
+     * before the call by itself.
+     */
+    _mm256_zeroupper();
+    return i + _ss_find_char_sse2(data + i, length - i, c);
+}
+
+__attribute__((target("avx2")))
+size_t _ss_find_bytes_avx2(const char *data, size_t length, const char *needle, size_t needle_length) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(data + i + needle_length - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first),
+            _mm256_cmpeq_epi8(block_last, last)
+        ));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle + 1, needle_length - 2) == 0) {
+                _mm256_zeroupper();
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    if (i == 0) {
+        _mm256_zeroupper();
+        return _ss_find_bytes_sse2(data, length, needle, needle_length);
+    }
+    if (i + needle_length > length) {
+        _mm256_zeroupper();
+        return length;
+    }
+
+    /**
+     * As in the SSE2 version, one last overlapping block.
+     */
+    size_t end = length - (needle_length - 1) - 32;
+    __m256i block_first = _mm256_loadu_si256((const __m256i *)(data + end));
+    __m256i block_last = _mm256_loadu_si256((const __m256i *)(data + end + needle_length - 1));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(block_first, first),
+        _mm256_cmpeq_epi8(block_last, last)
+    )) & (0xffffffffu << (i - end));
+    _mm256_zeroupper();
+
+    while (mask != 0) {
+        unsigned bit = __builtin_ctz(mask);
+        if (memcmp(data + end + bit + 1, needle + 1, needle_length - 2) == 0) return end + bit;
+        mask &= mask - 1;
+    }
+
+    return length;
+}
+
+__attribute__((target("avx2")))
+size_t _ss_count_char_avx2(const char *data, size_t length, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+    }
+
+    _mm256_zeroupper();
+    return count + _ss_count_char_sse2(data + i, length - i, c);
+}
+
+#endif
+
+/**
+ * Which implementation we'll use on this machine: 2 for AVX2, 1 for SSE2, 0
+ * for the scalar fallback.
+ */
+int ss_simd_level(void) {
+#ifdef SS_SIMD_X86
+    if (__builtin_cpu_supports("avx2")) return 2;
+    if (__builtin_cpu_supports("sse2")) return 1;
+#endif
+    return 0;
+}
+
+/**
+ * Each entry point below picks its implementation on first use and keeps it
+ * in a static. Threads can get there at the same time; they all pick the same
+ * function, and the loads and stores are atomic so that is all that happens.
+ */
+
+/**
+ * Position of the first `c` in `data`, or `length` if there isn't one.
+ */
+size_t ss_find_char(const char *data, size_t length, char c) {
+    static _ss_char_scan_fn chosen = NULL;
+    _ss_char_scan_fn impl;
+
+    impl = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+    if (impl == NULL) {
+        switch (ss_simd_level()) {
+#ifdef SS_SIMD_X86
+            case 2: impl = _ss_find_char_avx2; break;
+            case 1: impl = _ss_find_char_sse2; break;
+#endif
+            default: impl = _ss_find_char_scalar; break;
+        }
+        __atomic_store_n(&chosen, impl, __ATOMIC_RELAXED);
+    }
+
+    return impl(data, length, c);
+}
+
+/**
+ * Number of times `c` occurs in `data`.
+ */
+size_t ss_count_char(const char *data, size_t length, char c) {
+    static _ss_char_scan_fn chosen = NULL;
+    _ss_char_scan_fn impl;
+
+    impl = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+    if (impl == NULL) {
+        switch (ss_simd_level()) {
+#ifdef SS_SIMD_X86
+            case 2: impl = _ss_count_char_avx2; break;
+            case 1: impl = _ss_count_char_sse2; break;
+#endif
+            default: impl = _ss_count_char_scalar; break;
+        }
+        __atomic_store_n(&chosen, impl, __ATOMIC_RELAXED);
+    }
+
+    return impl(data, length, c);
+}
+
+/**
+ * Position of the first occurrence of `needle[0, needle_length)` in `data`,
+ * or `length` if there isn't one. An empty needle is found at 0.
+ */
+size_t ss_find_bytes(const char *data, size_t length, const char *needle, size_t needle_length) {
+    static _ss_bytes_scan_fn chosen = NULL;
+    _ss_bytes_scan_fn impl;
+
+    if (needle_length == 0) return 0;
+    if (needle_length > length) return length;
+    if (needle_length == 1) return ss_find_char(data, length, needle[0]);
+
+    impl = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+    if (impl == NULL) {
+        switch (ss_simd_level()) {
+#ifdef SS_SIMD_X86
+            case 2: impl = _ss_find_bytes_avx2; break;
+            case 1: impl = _ss_find_bytes_sse2; break;
+#endif
+            default: impl = _ss_find_bytes_scalar; break;
+        }
+        __atomic_store_n(&chosen, impl, __ATOMIC_RELAXED);
+    }
+
+    return impl(data, length, needle, needle_length);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Counters for what a workload costs: heap traffic, string_data lifetimes,
+ * reference count bumps and piece array growth. They are for sizing arenas
+ * and spotting leaks (`sd_creates - sd_frees` heap headers are still alive).
+ *
+ * Build with SS_ENABLE_STATS defined to turn them on. Without it every
+ * `SS_STAT` compiles to nothing and the counters stay at zero. With
+ * SS_THREAD_SAFE as well the counters are updated atomically.
+ *
+ * The allocation counters only see the default SS_MALLOC hooks; a program
+ * that plugs in its own allocator counts for itself.
+ */
+struct ss_stats {
+    uint64_t mallocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes_allocated;
+
+    uint64_t sd_creates;
+    uint64_t sd_retains;
+    uint64_t sd_releases;
+    uint64_t sd_frees;
+
+    uint64_t piece_growths;
+    uint64_t ssp_clones;
+    uint64_t ss_clones;
+};
+
+struct ss_stats _ss_stats;
+
+#ifdef SS_ENABLE_STATS
+#ifdef SS_THREAD_SAFE
+#define SS_STAT(field, n) ((void)__atomic_add_fetch(&_ss_stats.field, (n), __ATOMIC_RELAXED))
+#else
+#define SS_STAT(field, n) ((void)(_ss_stats.field += (n)))
+#endif
+#else
+#define SS_STAT(field, n) ((void)0)
+#endif
+
+#ifdef SS_ENABLE_STATS
+void *_ss_stats_malloc(size_t size) {
+    SS_STAT(mallocs, 1);
+    SS_STAT(bytes_allocated, size);
+    return malloc(size);
+}
+
+void *_ss_stats_calloc(size_t count, size_t size) {
+    SS_STAT(mallocs, 1);
+    SS_STAT(bytes_allocated, count * size);
+    return calloc(count, size);
+}
+
+void *_ss_stats_realloc(void *ptr, size_t size) {
+    SS_STAT(reallocs, 1);
+    SS_STAT(bytes_allocated, size);
+    return realloc(ptr, size);
+}
+
+void _ss_stats_free(void *ptr) {
+    if (ptr != NULL) SS_STAT(frees, 1);
+    free(ptr);
+}
+#endif
+
+/**
+ * Applies `X` to the name of every counter.
+ */
+#define _SS_STATS_FIELDS(X) \
+    X(mallocs) X(reallocs) X(frees) X(bytes_allocated) \
+    X(sd_creates) X(sd_retains) X(sd_releases) X(sd_frees) \
+    X(piece_growths) X(ssp_clones) X(ss_clones)
+
+/**
+ * Copies the counters into `*stats`. In SS_THREAD_SAFE builds each one is
+ * loaded atomically, so while other threads are still working each counter
+ * is exact but they aren't taken at quite the same instant.
+ */
+void ss_stats_snapshot(struct ss_stats *stats) {
+#ifdef SS_THREAD_SAFE
+#define _SS_STATS_LOAD(field) stats->field = __atomic_load_n(&_ss_stats.field, __ATOMIC_RELAXED);
+    _SS_STATS_FIELDS(_SS_STATS_LOAD)
+#undef _SS_STATS_LOAD
+#else
+    memcpy(stats, &_ss_stats, sizeof(struct ss_stats));
+#endif
+}
+
+void ss_stats_reset(void) {
+#ifdef SS_THREAD_SAFE
+#define _SS_STATS_CLEAR(field) __atomic_store_n(&_ss_stats.field, 0, __ATOMIC_RELAXED);
+    _SS_STATS_FIELDS(_SS_STATS_CLEAR)
+#undef _SS_STATS_CLEAR
+#else
+    memset(&_ss_stats, 0, sizeof(struct ss_stats));
+#endif
+}
+
+/**
+ * Prints one `name=value` line per counter.
+ */
+void ss_stats_print(const struct ss_stats *stats) {
+    printf("mallocs=%llu\n", (unsigned long long)stats->mallocs);
+    printf("reallocs=%llu\n", (unsigned long long)stats->reallocs);
+    printf("frees=%llu\n", (unsigned long long)stats->frees);
+    printf("bytes_allocated=%llu\n", (unsigned long long)stats->bytes_allocated);
+    printf("sd_creates=%llu\n", (unsigned long long)stats->sd_creates);
+    printf("sd_retains=%llu\n", (unsigned long long)stats->sd_retains);
+    printf("sd_releases=%llu\n", (unsigned long long)stats->sd_releases);
+    printf("sd_frees=%llu\n", (unsigned long long)stats->sd_frees);
+    printf("piece_growths=%llu\n", (unsigned long long)stats->piece_growths);
+    printf("ssp_clones=%llu\n", (unsigned long long)stats->ssp_clones);
+    printf("ss_clones=%llu\n", (unsigned long long)stats->ss_clones);
+}
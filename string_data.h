@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arena.h"
 #include "common.h"
 
 #include <stdbool.h>
@@ -8,60 +9,239 @@
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * These are combined as a bitmask, so each one needs its own bit.
+ */
 enum StringDataFlag {
-    STRING_DATA_ASCII,
-    STRING_DATA_UTF8,
-    STRING_OWNS_DATA,
-    STRING_CSTRING
+    STRING_DATA_ASCII      = 1 << 0,
+    STRING_DATA_UTF8       = 1 << 1,
+    STRING_OWNS_DATA       = 1 << 2,
+    STRING_CSTRING         = 1 << 3,
+    STRING_EXTERNAL_HEADER = 1 << 4,
+    STRING_INLINE_DATA     = 1 << 5,
+    STRING_INTERNED        = 1 << 6,
+    STRING_FROZEN          = 1 << 7
 };
 
+/**
+ * Payloads up to this many bytes are stored inside the string_data itself.
+ * Chosen so that the whole struct is 32 bytes on 64-bit platforms.
+ */
+#define SD_INLINE_CAPACITY 15
+
+/**
+ * Build with SD_NO_INLINE_DATA defined and copies always get a buffer of their
+ * own, as they did before payloads could be inline. The header is the same
+ * size either way. It's there so the benchmarks can be compared with and
+ * without (`make bench-no-inline.csv`).
+ */
+bool _sd_copy_is_inline(uint32_t length) {
+#ifdef SD_NO_INLINE_DATA
+    (void)length;
+    return false;
+#else
+    return length <= SD_INLINE_CAPACITY;
+#endif
+}
+
 /**
  * String Data is used in several places for several purposes. It should be
  * very generic. This same data structure is used for ASCII and UTF8, as well
  * as for data that we own and data that we are merely borrowing, as well as
  * c-style strings (null terminated) and z-style strings (strings with a
  * specific length).
+ *
+ * STRING_EXTERNAL_HEADER means that this struct itself lives in memory that
+ * somebody else manages (currently only an arena), so releasing it must never
+ * free anything.
+ *
+ * STRING_INTERNED means that this instance is the shared copy held by an intern
+ * table (see intern.h).
+ *
+ * STRING_FROZEN means that this string is immutable and lives for the rest of
+ * the process, like a string literal. Its reference count is never touched
+ * again, so any number of threads can share it without writing to it (see
+ * `ss_freeze`).
+ *
+ * STRING_INLINE_DATA means that the payload is short enough to live in
+ * `inline_data`, and `data` points there. Such a string costs one allocation
+ * instead of two, and the bytes sit on the same cache line as the header. We
+ * still own inline data, so STRING_OWNS_DATA is set as well; it just never
+ * needs a separate free.
+ *
+ * When the payload isn't inline, the last eight bytes of `inline_data` hold
+ * the string's fragment hash once it has been worked out (see
+ * `sd_fragment_hash`). There is no flag bit left to say so, so the word is
+ * zeroed when the header is made, and a cached hash has its top bit set.
+ *
+ * Lengths and reference counts are 32 bits wide. The fields are ordered
+ * widest first and the flags (a mask of `enum StringDataFlag`) are stored in
+ * a single byte, so that the header plus the inline buffer still packs into
+ * the same 32 bytes it took when both counters were a byte each. Short strings
+ * pay nothing for being allowed to be long.
  */
 struct string_data {
-    enum StringDataFlag flags;
-
-    uint8_t ref_count;
-    uint8_t length;
     char *data;
+    uint32_t length;
+    uint32_t ref_count;
+
+    uint8_t flags;
+    char inline_data[SD_INLINE_CAPACITY];
 };
 
 /**
- * NOTE: Not currently used. Will be used for a hashing implementation that is
- *       planned for the future.
+ * Where the cached fragment hash lives: the 8-byte aligned tail of
+ * `inline_data`.
+ */
+#define SD_HASH_WORD_OFFSET (SD_INLINE_CAPACITY - 8)
+
+SS_STATIC_ASSERT(
+    (offsetof(struct string_data, inline_data) + SD_HASH_WORD_OFFSET) % 8 == 0,
+    "the cached hash word must be 8-byte aligned"
+);
+
+#ifdef SS_THREAD_SAFE
+/**
+ * The word is read and written atomically, through a type that may alias the
+ * `char` bytes it overlays.
+ */
+typedef uint64_t __attribute__((__may_alias__)) _sd_hash_word_t;
+#endif
+
+/**
+ * Reads the cached hash word. Plain builds copy it out of the bytes, which
+ * compiles to a single load without breaking aliasing rules.
+ */
+uint64_t _sd_load_hash(struct string_data *sd) {
+#ifdef SS_THREAD_SAFE
+    return __atomic_load_n((_sd_hash_word_t *)(void *)(sd->inline_data + SD_HASH_WORD_OFFSET), __ATOMIC_RELAXED);
+#else
+    uint64_t word;
+    memcpy(&word, sd->inline_data + SD_HASH_WORD_OFFSET, sizeof(word));
+    return word;
+#endif
+}
+
+void _sd_store_hash(struct string_data *sd, uint64_t word) {
+#ifdef SS_THREAD_SAFE
+    __atomic_store_n((_sd_hash_word_t *)(void *)(sd->inline_data + SD_HASH_WORD_OFFSET), word, __ATOMIC_RELAXED);
+#else
+    memcpy(sd->inline_data + SD_HASH_WORD_OFFSET, &word, sizeof(word));
+#endif
+}
+
+void _sd_clear_hash(struct string_data *sd) {
+    _sd_store_hash(sd, 0);
+}
+
+/**
+ * 64-bit FNV-1a over `length` bytes. Cheap, and good enough to key the small
+ * tables we build over placeholder names.
+ */
+uint64_t sd_hash_bytes(const char *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Content equality for two string data. Only the encoding flags matter here;
+ * whether we own the bytes, where the header lives and so on do not.
  */
 bool sd_matches(struct string_data *a, struct string_data *b) {
+    if (a == b) return true;
     if (a->length != b->length) return false;
 
-    // TODO: This might not be the best idea if flags are used for things that "don't matter" for equality.
-    if (a->flags != b->flags) return false;
+    uint8_t encoding = STRING_DATA_ASCII | STRING_DATA_UTF8;
+    if ((a->flags & encoding) != (b->flags & encoding)) return false;
 
-    return strncmp(a->data, b->data, a->length) == 0;
+    return memcmp(a->data, b->data, a->length) == 0;
 }
 
 SS_RESULT sd_create(struct string_data **sd) {
-    *sd = (struct string_data *)malloc(sizeof(struct string_data));
+    *sd = (struct string_data *)SS_MALLOC(sizeof(struct string_data));
     if (*sd == NULL) return SS_ALLOC_ERROR;
-    
+    SS_STAT(sd_creates, 1);
+
     (*sd)->flags = 0;
     (*sd)->length = 0;
     (*sd)->ref_count = 1;
     (*sd)->data = NULL;
+    _sd_clear_hash(*sd);
 
     return SS_OK;
 }
 
+/**
+ * Same as `sd_create`, but the header comes out of `arena`.
+ */
+SS_RESULT sd_create_arena(struct ss_arena *arena, struct string_data **sd) {
+    *sd = (struct string_data *)ss_arena_alloc(arena, sizeof(struct string_data));
+    if (*sd == NULL) return SS_ALLOC_ERROR;
+    SS_STAT(sd_creates, 1);
+
+    (*sd)->flags = STRING_EXTERNAL_HEADER;
+    (*sd)->length = 0;
+    (*sd)->ref_count = 1;
+    (*sd)->data = NULL;
+    _sd_clear_hash(*sd);
+
+    return SS_OK;
+}
+
+/**
+ * `ss_freeze` marks string_data that strings on other threads may still be
+ * retaining and releasing, so in SS_THREAD_SAFE builds STRING_FROZEN is set
+ * and tested atomically, like the reference count it switches off.
+ */
+bool sd_is_frozen(struct string_data *sd) {
+#ifdef SS_THREAD_SAFE
+    return (__atomic_load_n(&sd->flags, __ATOMIC_ACQUIRE) & STRING_FROZEN) == STRING_FROZEN;
+#else
+    return (sd->flags & STRING_FROZEN) == STRING_FROZEN;
+#endif
+}
+
+void sd_freeze(struct string_data *sd) {
+#ifdef SS_THREAD_SAFE
+    __atomic_or_fetch(&sd->flags, STRING_FROZEN, __ATOMIC_RELEASE);
+#else
+    sd->flags |= STRING_FROZEN;
+#endif
+}
+
+/**
+ * Takes another reference to `sd`, to be given back with `sd_release`.
+ */
+void sd_retain(struct string_data *sd) {
+    if (sd_is_frozen(sd)) return;
+    SS_STAT(sd_retains, 1);
+    SS_REF_INC(sd->ref_count);
+}
+
 SS_RESULT sd_release(struct string_data *sd) {
-    sd->ref_count--;
-    if (sd->ref_count <= 0) {
-        if ((sd->flags & STRING_OWNS_DATA) == STRING_OWNS_DATA) {
-            free(sd->data);
-            free(sd);
+    if (sd_is_frozen(sd)) return SS_OK;
+    SS_STAT(sd_releases, 1);
+
+    uint32_t remaining = SS_REF_DEC(sd->ref_count);
+    if ((sd->flags & STRING_EXTERNAL_HEADER) == STRING_EXTERNAL_HEADER) return SS_OK;
+
+    /**
+     * Whether we own the data only decides whether it gets freed. Every header
+     * that isn't external came from `sd_create`, so it is always ours, borrowed
+     * data (see `sd_create_from`) or not.
+     */
+    if (remaining == 0) {
+        if ((sd->flags & (STRING_OWNS_DATA | STRING_INLINE_DATA)) == STRING_OWNS_DATA) {
+            SS_FREE(sd->data);
         }
+        SS_STAT(sd_frees, 1);
+        SS_FREE(sd);
     }
 
     return SS_OK;
@@ -77,6 +257,32 @@ SS_RESULT sd_print(struct string_data *sd) {
     return SS_OK;
 }
 
+/**
+ * The number of bytes this string data renders to. C-style strings are
+ * measured, everything else trusts `length`.
+ */
+size_t sd_length(struct string_data *sd) {
+    if ((sd->flags & STRING_CSTRING) == STRING_CSTRING) {
+        return strlen(sd->data);
+    }
+
+    return sd->length;
+}
+
+/**
+ * Copies the contents of this string data into `buf`. The caller is expected
+ * to have checked that there is room for `sd_length(sd)` bytes; this is the
+ * inner loop of rendering and does no checking of its own.
+ *
+ * Returns a pointer just past the last byte written.
+ */
+char *sd_render_into(struct string_data *sd, char *buf) {
+    size_t length = sd_length(sd);
+    memcpy(buf, sd->data, length);
+
+    return buf + length;
+}
+
 /**
  * Creates a new string data from the given string data.
  *
@@ -84,39 +290,256 @@ SS_RESULT sd_print(struct string_data *sd) {
  * being removed out from under it gracefully. This is done as an efficiency
  * thing -- don't misuse it!
  */
-SS_RESULT sd_create_from(struct string_data *in, uint8_t start, uint8_t end, struct string_data **sd) {
+SS_RESULT sd_create_from(struct string_data *in, uint32_t start, uint32_t end, struct string_data **sd) {
     SS_RESULT res = sd_create(sd);
     if (res != SS_OK) return res;
 
-    (*sd)->flags = in->flags ^ (STRING_OWNS_DATA | STRING_CSTRING);
+    uint8_t dropped = STRING_OWNS_DATA | STRING_CSTRING | STRING_EXTERNAL_HEADER | STRING_INLINE_DATA
+        | STRING_FROZEN | STRING_INTERNED;
+    (*sd)->flags = in->flags & ~dropped;
     (*sd)->length = end - start;
     (*sd)->data = &in->data[start];
 
     return SS_OK;
 }
 
+/**
+ * Creates a string data that points straight at `value` without copying it.
+ * Only the header is allocated. The caller keeps ownership of the bytes and
+ * has to keep them alive, and unchanged, for as long as anything uses this
+ * string data.
+ */
+SS_RESULT sd_create_borrow(const char *value, uint32_t length, struct string_data **sd) {
+    SS_RESULT res = sd_create(sd);
+    if (res != SS_OK) return res;
+
+    (*sd)->flags = STRING_DATA_ASCII;
+    (*sd)->length = length;
+    (*sd)->data = (char *)value;
+
+    return SS_OK;
+}
+
+/**
+ * Same as `sd_create_borrow`, but the header comes out of `arena`.
+ */
+SS_RESULT sd_create_borrow_arena(struct ss_arena *arena, const char *value, uint32_t length, struct string_data **sd) {
+    SS_RESULT res = sd_create_arena(arena, sd);
+    if (res != SS_OK) return res;
+
+    (*sd)->flags |= STRING_DATA_ASCII;
+    (*sd)->length = length;
+    (*sd)->data = (char *)value;
+
+    return SS_OK;
+}
+
 /**
  * Creates a new `string string_data` and returns a pointer. Copies the `value`
  * and considers itself to "own" the copy. You can do whatever you want with
  * the argument afterward.
+ *
+ * Copies of up to SD_INLINE_CAPACITY bytes are stored inline.
  */
-SS_RESULT sd_create_copy(const char *value, uint8_t length, struct string_data **sd) {
+SS_RESULT sd_create_copy(const char *value, uint32_t length, struct string_data **sd) {
     SS_RESULT res = sd_create(sd);
     if (res != SS_OK) return res;
 
-    (*sd)->flags = (STRING_DATA_ASCII | STRING_OWNS_DATA);
     (*sd)->length = length;
-    (*sd)->data = (char *)malloc(sizeof(char) * (*sd)->length);
-    if ((*sd)->data == NULL) return SS_ALLOC_ERROR;
+
+    if (_sd_copy_is_inline(length)) {
+        (*sd)->flags = (STRING_DATA_ASCII | STRING_OWNS_DATA | STRING_INLINE_DATA);
+        (*sd)->data = (*sd)->inline_data;
+    } else {
+        (*sd)->flags = (STRING_DATA_ASCII | STRING_OWNS_DATA);
+        (*sd)->data = (char *)SS_MALLOC(sizeof(char) * (*sd)->length);
+        if ((*sd)->data == NULL) return SS_ALLOC_ERROR;
+    }
     strncpy((*sd)->data, value, (*sd)->length);
 
     return SS_OK;
 }
 
+/**
+ * Same as `sd_create_copy`, but both the header and the copy come out of
+ * `arena` in a single bump. The copy lives until the arena is reset.
+ */
+SS_RESULT sd_create_copy_arena(struct ss_arena *arena, const char *value, uint32_t length, struct string_data **sd) {
+    bool is_inline = _sd_copy_is_inline(length);
+
+    *sd = (struct string_data *)ss_arena_alloc(
+        arena,
+        sizeof(struct string_data) + (is_inline ? 0 : length)
+    );
+    if (*sd == NULL) return SS_ALLOC_ERROR;
+    SS_STAT(sd_creates, 1);
+
+    (*sd)->length = length;
+    (*sd)->ref_count = 1;
+
+    if (is_inline) {
+        (*sd)->flags = (STRING_DATA_ASCII | STRING_EXTERNAL_HEADER | STRING_INLINE_DATA);
+        (*sd)->data = (*sd)->inline_data;
+    } else {
+        (*sd)->flags = (STRING_DATA_ASCII | STRING_EXTERNAL_HEADER);
+        (*sd)->data = (char *)(*sd + 1);
+        _sd_clear_hash(*sd);
+    }
+    strncpy((*sd)->data, value, length);
+
+    return SS_OK;
+}
+
+uint64_t sd_hash(struct string_data *sd) {
+    return sd_hash_bytes(sd->data, sd_length(sd));
+}
+
+/**
+ * Fragment hashes are polynomials in SD_POLY_BASE over the bytes (each plus
+ * one, so that leading zero bytes count), modulo the prime 2^61 - 1:
+ *
+ *     H(s) = (s[0] + 1) B^(n-1) + (s[1] + 1) B^(n-2) + ... + (s[n-1] + 1)
+ *
+ * Unlike FNV this composes: H(a b) = H(a) B^|b| + H(b). That is what lets
+ * `ss_hash` combine the cached hashes of a string's pieces into the hash of
+ * the whole, whatever the pieces are.
+ */
+#define SD_POLY_MOD 0x1fffffffffffffffULL
+#define SD_POLY_BASE 0x016a09e667f3bcc9ULL
+
+/**
+ * B, then B^2 ... B^8, for taking eight bytes a step.
+ */
+const uint64_t _sd_poly_powers[8] = {
+    0x016a09e667f3bcc9ULL, 0x1ff76525aecdd5d0ULL, 0x169be6ca05cc79a4ULL, 0x00e12ee299d32cacULL,
+    0x07c6557e84d8c200ULL, 0x1df59bc28cbad3f0ULL, 0x1885b90d426da605ULL, 0x1fb4f9e3da987c12ULL
+};
+
+uint64_t _sd_poly_reduce(unsigned __int128 x) {
+    uint64_t r = ((uint64_t)x & SD_POLY_MOD) + ((uint64_t)(x >> 61) & SD_POLY_MOD) + (uint64_t)(x >> 122);
+    r = (r & SD_POLY_MOD) + (r >> 61);
+    return r >= SD_POLY_MOD ? r - SD_POLY_MOD : r;
+}
+
+uint64_t _sd_poly_multiply(uint64_t a, uint64_t b) {
+    return _sd_poly_reduce((unsigned __int128)a * b);
+}
+
+/**
+ * B^(2^k) for k up to 31: enough for any string_data's length.
+ */
+const uint64_t _sd_poly_squares[32] = {
+    0x016a09e667f3bcc9ULL, 0x1ff76525aecdd5d0ULL, 0x00e12ee299d32cacULL, 0x1fb4f9e3da987c12ULL,
+    0x1b29bdba93cc656bULL, 0x0d6c63c419217359ULL, 0x1fa083604a09f1a6ULL, 0x0cf10445477b1f35ULL,
+    0x1453db94b06ecec2ULL, 0x1e2d36cbe8506e17ULL, 0x055d33e97ca13a14ULL, 0x12ba75e482a2c1baULL,
+    0x0ee4cea7efbd142fULL, 0x145529819270b8a1ULL, 0x1457bf026344c6c7ULL, 0x145ef0b22b46ae55ULL,
+    0x17de66d43a7eaa89ULL, 0x1477005f83a66463ULL, 0x1252b35fd4b5be67ULL, 0x185ebe5a6b2ae1c2ULL,
+    0x0b26ca5967073dafULL, 0x17aebda84b2237bdULL, 0x05b636206e987261ULL, 0x1315dfc59151c8b5ULL,
+    0x0d1c04be169386d3ULL, 0x12b745c72106e071ULL, 0x0270e7e11eeb0298ULL, 0x00b476e33f0ce5c1ULL,
+    0x1ba0b3bc8c826b5fULL, 0x076dcbc09da7758cULL, 0x13a4af95b124e471ULL, 0x02af52cc91c5010eULL
+};
+
+/**
+ * B^n: one multiply per set bit of `n`, out of the table, and squaring past
+ * the end of it.
+ */
+uint64_t sd_poly_power(size_t n) {
+    uint64_t result = 1;
+
+    for (int k = 0; n > 0 && k < 32; k++, n >>= 1) {
+        if (n & 1) result = _sd_poly_multiply(result, _sd_poly_squares[k]);
+    }
+
+    uint64_t base = _sd_poly_multiply(_sd_poly_squares[31], _sd_poly_squares[31]);
+    while (n > 0) {
+        if (n & 1) result = _sd_poly_multiply(result, base);
+        base = _sd_poly_multiply(base, base);
+        n >>= 1;
+    }
+
+    return result;
+}
+
+/**
+ * Carries the hash `hash` of some prefix on over `data[0, length)`: the
+ * result is the hash of the prefix followed by these bytes. Eight bytes go
+ * in per step, as nine independent products summed without reducing in
+ * between, so the multiplies overlap instead of waiting on each other; the
+ * last few bytes are one more step of the same kind.
+ */
+uint64_t sd_poly_hash_bytes(uint64_t hash, const char *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    const uint64_t *p = _sd_poly_powers;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        unsigned __int128 sum = (unsigned __int128)hash * p[7]
+            + (unsigned __int128)(bytes[i] + 1u) * p[6]
+            + (unsigned __int128)(bytes[i + 1] + 1u) * p[5]
+            + (unsigned __int128)(bytes[i + 2] + 1u) * p[4]
+            + (unsigned __int128)(bytes[i + 3] + 1u) * p[3]
+            + (unsigned __int128)(bytes[i + 4] + 1u) * p[2]
+            + (unsigned __int128)(bytes[i + 5] + 1u) * p[1]
+            + (unsigned __int128)(bytes[i + 6] + 1u) * p[0]
+            + (bytes[i + 7] + 1u);
+        hash = _sd_poly_reduce(sum);
+    }
+
+    /**
+     * The last few bytes go in as one step too.
+     */
+    size_t tail = length - i;
+    if (tail > 0) {
+        unsigned __int128 sum = (unsigned __int128)hash * p[tail - 1] + (bytes[length - 1] + 1u);
+        for (size_t j = 0; j + 1 < tail; j++) {
+            sum += (unsigned __int128)(bytes[i + j] + 1u) * p[tail - 2 - j];
+        }
+        hash = _sd_poly_reduce(sum);
+    }
+
+    return hash;
+}
+
+/**
+ * The fragment hash of this string data's contents. The first call on a
+ * string that isn't inline stores it in the header, and later calls just
+ * read it back, so static data shared by many strings is only ever hashed
+ * once. Inline strings are too short to be worth it, and frozen strings are
+ * never written to: `ss_freeze`, `ss_append_static_literal`,
+ * `ss_image_load` and `fixed_template` fill their cache before freezing
+ * them. In SS_THREAD_SAFE builds the cache is read and written atomically,
+ * as strings sharing it may be hashed on several threads at once; they all
+ * store the same value.
+ */
+uint64_t sd_fragment_hash(struct string_data *sd) {
+    if ((sd->flags & STRING_INLINE_DATA) == STRING_INLINE_DATA) {
+        return sd_poly_hash_bytes(0, sd->data, sd->length);
+    }
+
+    uint64_t cached = _sd_load_hash(sd);
+    if (cached >> 63) return cached & SD_POLY_MOD;
+
+    uint64_t hash = sd_poly_hash_bytes(0, sd->data, sd_length(sd));
+    if (sd_is_frozen(sd)) return hash;
+
+    _sd_store_hash(sd, hash | 1ULL << 63);
+    return hash;
+}
+
+/**
+ * Compares the contents of this string data against `length` bytes. Unlike
+ * `sd_is_equal_cstring` this is an exact match: a prefix does not count.
+ */
+bool sd_is_equal_bytes(struct string_data *sd, const char *compared_to, size_t length) {
+    if (sd_length(sd) != length) return false;
+
+    return memcmp(sd->data, compared_to, length) == 0;
+}
+
 bool sd_is_equal_cstring(struct string_data *sd, const char *compared_to) {
     if ((sd->flags & STRING_CSTRING) == STRING_CSTRING) {
         return strcmp(sd->data, compared_to) == 0;
     } else {
         return strncmp(sd->data, compared_to, sd->length) == 0;
     }
-}
\ No newline at end of file
+}